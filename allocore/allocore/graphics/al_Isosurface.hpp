@@ -61,11 +61,13 @@
 			This code is public domain.
 */
 
+#include <algorithm>
 #include <map>
 #include <unordered_map>
 #include <vector>
 #include "allocore/types/al_Buffer.hpp"
 #include "allocore/graphics/al_Mesh.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
 #include "allocore/types/al_Voxels.hpp"
 
 namespace al{
@@ -158,6 +160,16 @@ public:
 	/// Set whether to normalize normals (if being computed)
 	Isosurface& normalize(bool v){ mNormalize=v; return *this; }
 
+	/// Set number of threads used by generate()
+
+	/// The field is split into slabs along z that are extracted in parallel
+	/// on the global ThreadPool and then stitched together. The resulting
+	/// mesh is identical to the one produced using a single thread.
+	Isosurface& threads(int n){ mThreads = n<1 ? 1 : n; return *this; }
+
+	/// Get number of threads used by generate()
+	int threads() const { return mThreads; }
+
 
 	/// Begin cell-at-a-time mode
 	void begin();
@@ -189,6 +201,11 @@ public:
 
 
 	/// Generate isosurface from scalar field
+
+	/// Cells are visited in bricks of brickSize^3 cells. Bricks whose corner
+	/// values all lie on one side of the isolevel are skipped. Edge vertices
+	/// are shared through a cache of two field slices rather than a map over
+	/// the whole field, so this does not depend on inBox().
 	template <class T>
 	void generate(const T * scalarField);
 
@@ -229,8 +246,25 @@ public:
 	/// it is recommended to set this to false to save memory.
 	Isosurface& inBox(bool v);
 
+	/// Number of cells along each edge of bricks tested by generate()
+	static const int brickSize = 8;
+
 protected:
 
+	// Range of cell layers extracted independently by generate()
+	struct Slab{
+		int z0, z1;							// cell layers [z0, z1)
+		int lower;							// which of planes is at cell bottoms
+		std::vector<EdgeVertex> vertices;	// vertices local to slab
+		std::vector<int> indices;			// triangles in terms of local vertices
+		std::vector<int> planes[2][2];		// local vertex of x and y edges of two slices
+		std::vector<int> zEdges;			// local vertex of z edges of current layer
+		std::vector<int> touched[3];		// cache entries set in planes and zEdges
+		std::vector<int> top;				// (cache entry, local vertex) pairs on plane z1
+		std::vector<int> remap;				// local vertex to mesh vertex
+		std::vector<char> bricks;			// whether each brick may contain surface
+	};
+
 	struct IsosurfaceHashInt{
 		size_t operator()(int v) const { return v; }
 	//	size_t operator()(int v) const { return v*2654435761UL; }
@@ -250,14 +284,99 @@ protected:
 	float mIsolevel;			// isosurface level
 	VertexAction * mVertexAction;
 	bool mValidSurface;			// indicates whether a valid surface is present
+	unsigned mSurfaceID;		// incremented each time the mesh is rebuilt
 	bool mComputeNormals;		// whether to compute normals
 	bool mNormalize;			// whether to normalize normals
 	bool mInBox;
+	int mThreads;
+	std::vector<Slab> mSlabs;
 
 	EdgeVertex calcIntersection(int nX, int nY, int nZ, int nEdgeNo, const float * vals) const;
 	void addEdgeVertex(int x, int y, int z, int cellID, int edge, const float * vals);
 
 	void compressTriangles();
+
+	int beginSlabs();
+	void beginLayer(Slab& s, int z);
+	void addSlabCell(Slab& s, int x, int y, int z, const float * vals);
+	void endSlabs();
+
+	template <class T>
+	void generateSlab(Slab& s, const T * vals);
+};
+
+
+
+/// Isosurface partitioned into bricks that are extracted independently
+
+/// Each brick of cells keeps its own piece of the surface. When the field is
+/// edited or the isolevel changes, update() only re-triangulates bricks marked
+/// dirty and bricks whose value range straddles the old or new isolevel. The
+/// pieces are then merged into this mesh with vertices shared across bricks.
+/// @ingroup allocore
+class BrickedIsosurface : public Isosurface {
+public:
+
+	/// @param[in] brickDim	number of cells along each edge of a brick
+	/// @param[in] level	value to construct surface on
+	/// @param[in] action	user defined functor called upon adding a new edge vertex
+	BrickedIsosurface(int brickDim=16, float level=0, VertexAction& action = noVertexAction);
+
+	/// Get number of cells along each edge of a brick
+	int brickDim() const { return mBrickDim; }
+
+	/// Get number of bricks
+	int numBricks() const { return mBricks.size(); }
+
+	/// Get number of bricks re-triangulated by last update
+	int numUpdated() const { return mUpdated.size(); }
+
+	/// Mark region of field points [min, max] as changed
+	BrickedIsosurface& dirty(int x0, int y0, int z0, int x1, int y1, int z1);
+
+	/// Mark whole field as changed
+	BrickedIsosurface& dirty();
+
+	/// Update surface from scalar field
+
+	/// The field must have the dimensions set with fieldDims(). Changing the
+	/// dimensions marks the whole field as changed.
+	template <class T>
+	void update(const T * scalarField);
+
+protected:
+
+	struct Brick{
+		float min, max;						// range of field values
+		std::vector<EdgeVertex> vertices;
+		std::vector<int> indices;			// triangles in terms of brick vertices
+		std::vector<int> shared;			// edge ID of vertices on brick faces, else -1
+		bool dirty;
+	};
+
+	// Per-thread edge to vertex map of one brick
+	struct BrickCache{
+		int origin[3];
+		std::vector<int> edges;
+		std::vector<int> touched;
+	};
+
+	std::vector<Brick> mBricks;
+	std::vector<int> mUpdated;				// bricks to re-triangulate
+	std::vector<BrickCache> mCaches;
+	std::vector<int> mRemap;
+	int mBrickDim;
+	int mNB[3];								// number of bricks along each axis
+	int mDims[3];							// field dimensions of bricks
+	float mBrickLevel;						// isolevel of brick triangulations
+	unsigned mMergedID;						// surface ID of last merge of bricks
+
+	int beginUpdate();
+	void addBrickCell(Brick& b, BrickCache& c, int x, int y, int z, const float * vals);
+	void endUpdate();
+
+	template <class T>
+	void updateBrick(int i, BrickCache& c, const T * vals);
 };
 
 
@@ -266,51 +385,155 @@ protected:
 
 template <class T>
 void Isosurface::generate(const T * vals){
-	inBox(true);
-	begin();
+	int numSlabs = beginSlabs();
 
-	int Nx = mNF[0];
-	int Nxy = Nx*mNF[1];
+	ThreadPool::global().parallelFor(0, numSlabs, [this, vals](int i){
+		generateSlab(mSlabs[i], vals);
+	}, 1);
+
+	endSlabs();
+}
+
+template <class T>
+void Isosurface::generateSlab(Slab& s, const T * vals){
+	const int Nx = mNF[0];
+	const int Nxy = Nx*mNF[1];
+	const int Cx = mNF[0]-1;
+	const int Cy = mNF[1]-1;
+	const int Bx = (Cx + brickSize-1)/brickSize;
+	const int By = (Cy + brickSize-1)/brickSize;
+	const int Bz = (s.z1-s.z0 + brickSize-1)/brickSize;
+	const float lev = level();
+
+	// Mark bricks having field points on both sides of isolevel
+	s.bricks.assign(Bx*By*Bz, 0);
+	for(int bz=0; bz<Bz; ++bz){
+		int za = s.z0 + bz*brickSize;
+		int zb = std::min(za + brickSize, s.z1);
+		for(int by=0; by<By; ++by){
+			int ya = by*brickSize;
+			int yb = std::min(ya + brickSize, Cy);
+			for(int bx=0; bx<Bx; ++bx){
+				int xa = bx*brickSize;
+				int xb = std::min(xa + brickSize, Cx);
+				bool below = false, above = false;
+				for(int z=za; z<=zb; ++z){
+				for(int y=ya; y<=yb; ++y){
+					const T * row = vals + z*Nxy + y*Nx;
+					for(int x=xa; x<=xb; ++x){
+						// same test as used to classify cell corners
+						if(float(row[x]) < lev)	below = true;
+						else					above = true;
+					}
+				}}
+				s.bricks[(bz*By + by)*Bx + bx] = below && above;
+			}
+		}
+	}
 
-	// iterate through cubes (not field points)
-	//for(int z=0; z < mNF[2]-1; ++z){
-	// support transparency (assumes higher indices are farther away)
-	for(int z=mNF[2]-2; z>=0; --z){
+	// Iterate through cells in the same order as a serial pass
+	for(int z=s.z1-1; z>=s.z0; --z){
+		beginLayer(s, z);
+		const char * brickRow = &s.bricks[((z-s.z0)/brickSize)*By*Bx];
 		int z0 = z   *Nxy;
 		int z1 =(z+1)*Nxy;
-		for(int y=0; y < mNF[1]-1; ++y){
-			int y0 = y   *Nx;
-			int y1 =(y+1)*Nx;
+		for(int y=0; y<Cy; ++y){
+			const char * bricks = brickRow + (y/brickSize)*Bx;
+			int z0y0 = z0 + y*Nx;
+			int z0y1 = z0y0 + Nx;
+			int z1y0 = z1 + y*Nx;
+			int z1y1 = z1y0 + Nx;
+			for(int bx=0; bx<Bx; ++bx){
+				if(!bricks[bx]) continue;
+				int xb = std::min((bx+1)*brickSize, Cx);
+				for(int x=bx*brickSize; x<xb; ++x){
+					float v8[] = {
+						float(vals[z0y0 + x]), float(vals[z0y0 + x+1]),
+						float(vals[z0y1 + x]), float(vals[z0y1 + x+1]),
+						float(vals[z1y0 + x]), float(vals[z1y0 + x+1]),
+						float(vals[z1y1 + x]), float(vals[z1y1 + x+1])
+					};
+					addSlabCell(s, x,y,z, v8);
+				}
+			}
+		}
+	}
+}
 
-			int z0y0 = z0+y0;
-			int z0y1 = z0+y1;
-			int z1y0 = z1+y0;
-			int z1y1 = z1+y1;
+template <class T>
+void BrickedIsosurface::update(const T * vals){
+	int numThreads = beginUpdate();
+
+	ThreadPool::global().parallelFor(0, numThreads, [this, vals, numThreads](int t){
+		for(unsigned i=t; i<mUpdated.size(); i+=numThreads){
+			updateBrick(mUpdated[i], mCaches[t], vals);
+		}
+	}, 1);
 
-			int z0y0_1 = z0y0+1;
-			int z0y1_1 = z0y1+1;
-			int z1y0_1 = z1y0+1;
-			int z1y1_1 = z1y1+1;
+	endUpdate();
+}
 
-			for(int x=0; x < mNF[0]-1; ++x){
+template <class T>
+void BrickedIsosurface::updateBrick(int i, BrickCache& c, const T * vals){
+	Brick& b = mBricks[i];
+	const int Nx = mNF[0];
+	const int Nxy = Nx*mNF[1];
+	const int bx = i % mNB[0];
+	const int by = (i / mNB[0]) % mNB[1];
+	const int bz = i / (mNB[0]*mNB[1]);
+	const int x0 = bx*mBrickDim, x1 = std::min(x0 + mBrickDim, mNF[0]-1);
+	const int y0 = by*mBrickDim, y1 = std::min(y0 + mBrickDim, mNF[1]-1);
+	const int z0 = bz*mBrickDim, z1 = std::min(z0 + mBrickDim, mNF[2]-1);
+
+	if(b.dirty){
+		float mn = float(vals[(z0*mNF[1] + y0)*Nx + x0]);
+		float mx = mn;
+		for(int z=z0; z<=z1; ++z){
+		for(int y=y0; y<=y1; ++y){
+			const T * row = vals + z*Nxy + y*Nx;
+			for(int x=x0; x<=x1; ++x){
+				float v = float(row[x]);
+				if(v < mn) mn = v;
+				if(v > mx) mx = v;
+			}
+		}}
+		b.min = mn;
+		b.max = mx;
+		b.dirty = false;
+	}
 
+	b.vertices.clear();
+	b.indices.clear();
+	b.shared.clear();
+	if(!(b.min < level() && b.max >= level())) return;
+
+	c.origin[0] = x0;
+	c.origin[1] = y0;
+	c.origin[2] = z0;
+
+	for(int z=z1-1; z>=z0; --z){
+		for(int y=y0; y<y1; ++y){
+			int z0y0 = z*Nxy + y*Nx;
+			int z0y1 = z0y0 + Nx;
+			int z1y0 = z0y0 + Nxy;
+			int z1y1 = z1y0 + Nx;
+			for(int x=x0; x<x1; ++x){
 				float v8[] = {
-					float(vals[z0y0 + x]), float(vals[z0y0_1 + x]),
-					float(vals[z0y1 + x]), float(vals[z0y1_1 + x]),
-					float(vals[z1y0 + x]), float(vals[z1y0_1 + x]),
-					float(vals[z1y1 + x]), float(vals[z1y1_1 + x])
+					float(vals[z0y0 + x]), float(vals[z0y0 + x+1]),
+					float(vals[z0y1 + x]), float(vals[z0y1 + x+1]),
+					float(vals[z1y0 + x]), float(vals[z1y0 + x+1]),
+					float(vals[z1y1 + x]), float(vals[z1y1 + x+1])
 				};
-
-				int i3[] = {x,y,z};
-
-				addCell(i3,	v8);
+				addBrickCell(b, c, x,y,z, v8);
 			}
 		}
 	}
 
-	end();
+	for(unsigned k=0; k<c.touched.size(); ++k) c.edges[c.touched[k]] = -1;
+	c.touched.clear();
 }
 
+
 } // al::
 
 #endif
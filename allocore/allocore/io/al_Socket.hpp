@@ -149,6 +149,16 @@ public:
 	/// \returns bytes sent
 	size_t send(const char * buffer, size_t len);
 
+	/// Send several datagrams
+
+	/// On Linux, the datagrams are passed to the kernel with a single call
+	/// (sendmmsg). Elsewhere, this calls send() for each buffer.
+	/// @param[in] buffers	The data of each datagram
+	/// @param[in] lengths	The length, in bytes, of each datagram
+	/// @param[in] count	The number of datagrams
+	/// \returns number of datagrams sent
+	int sendBatch(const char * const * buffers, const size_t * lengths, int count);
+
 
 	/// Listen for incoming connections from remote clients
 
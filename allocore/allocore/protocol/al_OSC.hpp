@@ -179,6 +179,93 @@ protected:
 };
 
 
+/// Encoder of OSC packets into a fixed buffer
+
+/// This writes the same bytes as Packet, but never allocates or throws, so
+/// it can encode into a buffer on the stack. Writes that would not fit in
+/// the buffer are ignored and ok() becomes false.
+/// @code
+///	char buf[256];
+///	osc::PacketWriter w(buf, sizeof(buf));
+///	w.addMessage("/freq", 440.f);
+///	if(w.ok()) socket.send(w.data(), w.size());
+/// @endcode
+/// @ingroup allocore
+class PacketWriter{
+public:
+
+	/// @param[in] buffer		buffer to write packet into
+	/// @param[in] capacity		size, in bytes, of buffer
+	PacketWriter(char * buffer, int capacity);
+
+	const char * data() const { return mData; }	///< Get raw packet data
+	int size() const { return mSize; }			///< Get number of bytes written
+	int capacity() const { return mCapacity; }	///< Get size of buffer
+
+	/// Whether all data written so far fit in the buffer and was well-formed
+	bool ok() const { return mOK; }
+
+	/// Clear packet contents and error state
+	PacketWriter& clear();
+
+	/// Discard data written after a given number of bytes and clear error state
+
+	/// @param[in] size		a previous size() outside of any open message
+	///
+	PacketWriter& rewind(int size);
+
+	/// Begin a new bundle
+	PacketWriter& beginBundle(TimeTag timeTag=1);
+
+	/// End bundle
+	PacketWriter& endBundle();
+
+	/// Start a new message
+	PacketWriter& beginMessage(const char * addressPattern);
+
+	/// End message
+	PacketWriter& endMessage();
+
+	/// Add message with any number of arguments
+	template <class... Args>
+	PacketWriter& addMessage(const char * addr, const Args&... args){
+		beginMessage(addr); add(args...); return endMessage();
+	}
+
+	PacketWriter& operator<< (int v);				///< Add integer to message
+	PacketWriter& operator<< (unsigned v);			///< Add integer to message
+	PacketWriter& operator<< (float v);				///< Add float to message
+	PacketWriter& operator<< (double v);			///< Add double to message
+	PacketWriter& operator<< (char v);				///< Add char to message
+	PacketWriter& operator<< (const char* v);		///< Add C-string to message
+	PacketWriter& operator<< (const std::string& v);///< Add string to message
+	PacketWriter& operator<< (const Blob& v);		///< Add Blob to message
+
+private:
+	enum{ MAX_ARGS = 60, MAX_DEPTH = 8 };
+	char * mData;
+	int mCapacity;
+	int mSize;
+	int mMessage;				// offset of open message, or -1
+	int mArgs;					// offset of arguments of open message
+	int mNumTags;
+	char mTags[MAX_ARGS];
+	int mBundles[MAX_DEPTH];	// offsets of open bundles
+	int mDepth;
+	bool mOK;
+
+	void add(){}
+	template <class A, class... Args>
+	void add(const A& a, const Args&... args){ (*this)<<a; add(args...); }
+
+	char * reserve(int bytes);
+	PacketWriter& tag(char t);
+	void putString(const char * v, int len);
+	void beginElement();
+	void endElement(int start);
+};
+
+
 /// Inbound OSC message
 ///
 /// @ingroup allocore
@@ -226,6 +313,20 @@ protected:
 
 
 
+/// Returns whether an OSC address pattern matches an address
+
+/// The pattern may contain the wildcards '?' (any character), '*' (any
+/// sequence of characters), '[abc]', '[a-z]' and '[!abc]' (character sets)
+/// and '{foo,bar}' (alternatives). Wildcards do not match across '/'.
+///
+/// @ingroup allocore
+bool matchPattern(const char * pattern, const char * address);
+
+/// Returns whether a string contains any OSC pattern wildcards
+bool isPattern(const std::string& pattern);
+
+
+
 /// Iterates through all messages contained within an OSC packet
 ///
 /// @ingroup allocore
@@ -311,6 +412,87 @@ public:
 
 
 
+/// Socket for sending many OSC messages in bundles
+
+/// Messages are collected into bundles of at most bundleSize bytes. Full
+/// bundles are queued and the queue is sent with a single call to
+/// Socket::sendBatch() once it holds queueSize bundles, or on flush(). If a
+/// flush interval is set, a bundle is also sent once its first message is
+/// older than the interval, checked on each send() and update().
+///
+/// All buffers are allocated on construction and messages are encoded with
+/// PacketWriter, so sending does not allocate. This class is not
+/// thread-safe.
+///
+/// @ingroup allocore
+class BundleSend : public SocketClient{
+public:
+
+	/// @param[in] port			Port number (valid range is 0-65535)
+	/// @param[in] address		IP address
+	/// @param[in] timeout		< 0: block forever; = 0: no blocking; > 0 block with timeout
+	/// @param[in] bundleSize	Maximum size, in bytes, of a datagram. The
+	///							default fits the 1500 byte Ethernet MTU.
+	/// @param[in] queueSize	Number of bundles sent together
+	BundleSend(uint16_t port, const char * address = "localhost", al_sec timeout=0,
+		int bundleSize=1472, int queueSize=32);
+
+	~BundleSend();
+
+	/// Set maximum time to hold messages before sending, in seconds
+
+	/// 0 (the default) sends only when the queue is full or on flush().
+	///
+	BundleSend& flushInterval(al_sec v){ mFlushInterval=v; return *this; }
+
+	/// Add message to the current bundle
+
+	/// \returns false if the message is larger than a bundle and was dropped
+	template <class... Args>
+	bool send(const char * addr, const Args&... args);
+
+	/// Add message to the current bundle
+	template <class... Args>
+	bool send(const std::string& addr, const Args&... args){
+		return send(addr.c_str(), args...);
+	}
+
+	/// Send all collected messages
+
+	/// \returns number of datagrams sent
+	///
+	int flush();
+
+	/// Send collected messages if the flush interval has passed
+
+	/// \returns number of datagrams sent
+	///
+	int update();
+
+	unsigned long long packetsSent() const { return mPacketsSent; }	///< Get number of datagrams sent
+	unsigned long long bytesSent() const { return mBytesSent; }		///< Get number of bytes sent
+	unsigned long long dropped() const { return mDropped; }			///< Get number of messages too large or in datagrams that failed to send
+
+private:
+	std::vector<char> mBuffer;
+	std::vector<const char *> mPackets;
+	std::vector<size_t> mSizes;
+	std::vector<int> mCounts;	// number of messages in each queued bundle
+	PacketWriter mWriter;
+	int mBundleSize;
+	int mQueued;		// number of complete bundles in queue
+	int mMessages;		// number of messages in open bundle
+	al_sec mFlushInterval;
+	al_sec mOpenTime;	// time first message was added to open bundle
+	unsigned long long mPacketsSent, mBytesSent, mDropped;
+
+	void openBundle();
+	void closeBundle();
+	int sendQueued();
+};
+
+
+
 /// Socket for receiving OSC packets
 
 /// Supports explicit polling or implicit background thread polling
@@ -361,6 +543,27 @@ protected:
 };
 
 
+
+template <class... Args>
+bool BundleSend::send(const char * addr, const Args&... args){
+	for(int i=0; i<2; ++i){
+		bool empty = 0 == mMessages;
+		if(empty) openBundle();
+		int mark = mWriter.size();
+		mWriter.addMessage(addr, args...);
+		if(mWriter.ok()){
+			++mMessages;
+			if(mFlushInterval > 0) update();
+			return true;
+		}
+		mWriter.rewind(mark);
+		if(empty) break; // does not fit in an empty bundle
+		closeBundle();
+	}
+	++mDropped;
+	return false;
+}
+
 } // osc::
 } // al::
 
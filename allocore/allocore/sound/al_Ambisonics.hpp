@@ -135,6 +135,22 @@ public:
 	/// Compute spherical harmonic weights based on unit direction vector (in the listener's coordinate frame)
 	static void encodeWeightsFuMa(float * ws, int dim, int order, float x, float y, float z);
 
+	/// Compute spherical harmonic weights for a block of direction vectors
+
+	/// The weight of channel c for direction i is written to ws[c*stride + i].
+	/// Weights are evaluated as polynomials of the direction components with
+	/// the inner loops over directions, so they vectorize.
+	/// @param[out] ws		weights of each channel (non-interleaved)
+	/// @param[in]  stride	distance between channels in weights buffer
+	/// @param[in]  x		x components of unit direction vectors
+	/// @param[in]  y		y components of unit direction vectors
+	/// @param[in]  z		z components of unit direction vectors
+	/// @param[in]  n		number of directions
+	static void encodeWeightsFuMa(
+		float * ws, int stride, int dim, int order,
+		const float * x, const float * y, const float * z, int n
+	);
+
 	/// Brute force 3rd order.  Weights must be of size 16.
 	static void encodeWeightsFuMa16(float * weights, float azimuth, float elevation);
 	/// (x,y,z unit vector in the listener's coordinate frame)
@@ -174,6 +190,14 @@ public:
 	virtual ~AmbiDecode();
 
 
+	/// Decode Ambisonic domain buffers to speaker buffers
+
+	/// Decoding is the product of the (speakers x channels) weighted decode
+	/// matrix and the (channels x frames) input. Frames are processed in
+	/// blocks small enough to stay in cache while being decoded to every
+	/// speaker. Orders up to 3 use kernels with the number of channels fixed
+	/// at compile time. Output is accumulated into the speaker buffers.
+	///
 	/// @param[out] dec				output time domain buffers (non-interleaved)
 	/// @param[in ] enc				input Ambisonic domain buffers (non-interleaved)
 	/// @param[in ] numDecFrames	number of frames in time domain buffers
@@ -219,12 +243,14 @@ protected:
 	int mFlavor;				// decode flavor
 	float * mDecodeMatrix;		// deccoding matrix for each ambi channel & speaker
 								// cols are channels and rows are speakers
+	float * mWeightedMatrix;	// decoding matrix multiplied by channel weights
 	float mWOrder[5];			// weights for each order
     Speakers* mSpeakers;
     //float * mPositions;		// speakers' azimuths + elevations
 	//float * mFrame;			// an ambisonic channel frame used for decode(int)
 
 	void updateChanWeights();
+	void updateWeightedMatrix(int speaker);
 	void resizeArrays(int numChannels, int numSpeakers);
 
 	float decode(float * encFrame, int encNumChannels, int speakerNum);	// is this useful?
@@ -267,6 +293,25 @@ public:
 	template <class XYZ>
 	void encode(float * ambiChans, const XYZ * dir, const float * input, int numFrames);
 
+	/// Encode buffers of many sources
+
+	/// Each source's samples are weighted by the spherical harmonics of its
+	/// direction at every frame and accumulated into the Ambisonic channels.
+	/// Weights are computed a block of frames at a time, without going
+	/// through the encoder's current direction.
+	///
+	/// @param[in,out] ambiChans	Ambisonic domain channels (non-interleaved)
+	/// @param[in] numFrames		number of frames in each buffer
+	/// @param[in] numSources		number of sources
+	/// @param[in] dirs				per source unit direction vectors in the
+	///								listener's coordinate frame, stored as
+	///								non-interleaved x, y and z buffers
+	/// @param[in] inputs			per source time-domain sample buffers
+	void encode(
+		float * ambiChans, int numFrames, int numSources,
+		const float * const * dirs, const float * const * inputs
+	) const;
+
 	/// Set spherical direction of source to be encoded
 	void direction(float az, float el);
 
@@ -298,11 +343,13 @@ public:
 
 	void prepare();
 
+	using Spatializer::perform;
+
 	/// Per sample processing
-	void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample);
+	void perform(AudioIOData& io, SoundSource& src, int index, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample);
 
 	/// Per buffer processing
-	void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, float *samples);
+	void perform(AudioIOData& io, SoundSource& src, int index, Vec3d& relpos, const int& numFrames, float *samples);
 
 	void finalize(AudioIOData& io);
 
@@ -310,6 +357,7 @@ private:
 	AmbiDecode mDecoder;
 	AmbiEncode mEncoder;
 	std::vector<float> mAmbiDomainChannels;
+	std::vector<float> mDirections;	// per frame source directions (x, y, z)
 	Listener* mListener;
 	int mNumFrames;
 };
@@ -463,7 +511,7 @@ inline float * AmbisonicsSpatializer::ambiChans(unsigned channel) {
 }
 
 inline void AmbisonicsSpatializer::perform(
-	AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample
+	AudioIOData& io, SoundSource& src, int index, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample
 ){
     // compute azimuth & elevation of relative position in current listener's coordinate frame:
     Vec3d urel(relpos);
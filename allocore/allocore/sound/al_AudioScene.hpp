@@ -46,6 +46,7 @@
 
 #include <math.h>
 #include <string.h>
+#include <atomic>
 #include <vector>
 #include <list>
 #include "allocore/types/al_Buffer.hpp"
@@ -107,28 +108,85 @@ public:
 	/// Called once per listener, before sources are rendered. ex. zero ambisonics coefficients
 	virtual void prepare(){};
 
+	/// Set number of sources to keep state for between blocks
+
+	/// AudioScene calls this with the capacity of its source array whenever
+	/// it changes and never during perform(). Spatializers keeping state per
+	/// source, such as the gains of the previous block, size it here and
+	/// index it by the source index passed to perform().
+	virtual void numSources(int num){};
+
+	/// Called when the source at index is removed and later sources move down by one
+	virtual void removeSource(int index){};
+
 	/// Render each source per sample
+
+	/// The index is that of the source in the AudioScene, or negative for
+	/// a source without state kept between blocks.
 	virtual void perform(
 			AudioIOData& io,
 			SoundSource& src,
+			int index,
 			Vec3d& relpos,
 			const int& numFrames,
 			int& frameIndex,
 			float& sample
-			) = 0;
+			){
+		perform(io, src, relpos, numFrames, frameIndex, sample);
+	}
 
 	/// Render each source per buffer
+	virtual void perform(
+			AudioIOData& io,
+			SoundSource& src,
+			int index,
+			Vec3d& relpos,
+			const int& numFrames,
+			float *samples
+			){
+		perform(io, src, relpos, numFrames, samples);
+	}
+
+	/// Render each source per sample, without state kept for the source
+
+	/// \deprecated Override the overload taking the source index. Subclasses
+	/// must override one of the two.
+	virtual void perform(
+			AudioIOData& io,
+			SoundSource& src,
+			Vec3d& relpos,
+			const int& numFrames,
+			int& frameIndex,
+			float& sample
+			){
+		perform(io, src, -1, relpos, numFrames, frameIndex, sample);
+	}
+
+	/// Render each source per buffer, without state kept for the source
+
+	/// \deprecated Override the overload taking the source index. Subclasses
+	/// must override one of the two.
 	virtual void perform(
 			AudioIOData& io,
 			SoundSource& src,
 			Vec3d& relpos,
 			const int& numFrames,
 			float *samples
-			) = 0;
+			){
+		perform(io, src, -1, relpos, numFrames, samples);
+	}
 
 	/// Called once per listener, after sources are rendered. ex. ambisonics decode
 	virtual void finalize(AudioIOData& io){};
 
+	/// Returns whether perform() can be called concurrently for different sources
+
+	/// This must only return true if perform() writes nothing but the
+	/// AudioIOData and SoundSource passed to it and the state of the source
+	/// index passed to it. Spatializers that accumulate
+	/// into internal buffers (e.g., Ambisonics) must return false.
+	virtual bool reentrant() const { return false; }
+
 
 	/// Print out information about spatializer
 	virtual void print(){};
@@ -222,6 +280,48 @@ enum DopplerType{
 	DOPPLER_PHYSICAL			/**< Physically Accurate Doppler Shift. Requires per sample processingfor AudioScene and SoundSource. */
 };
 
+/// Pool of delay line memory shared by many sound sources
+///
+/// Memory is reserved in large slabs and handed out in blocks whose sizes
+/// are powers of two. Freed blocks are kept in a free list per size and
+/// reused. The pool is not thread-safe and must outlive the sources using it.
+///
+/// @ingroup allocore
+class DelayPool{
+public:
+
+	/// @param[in] slabSize		number of samples reserved at a time
+	DelayPool(int slabSize = 1<<18);
+
+	~DelayPool();
+
+	/// Allocate a zeroed block of samples
+
+	/// @param[in,out] size		minimum number of samples; set to the actual
+	///							size, the next power of two large enough
+	///							to hold a pointer
+	/// \returns pointer to first sample of block
+	float * allocate(int& size);
+
+	/// Return a block obtained from allocate() to the pool
+
+	/// This never allocates, so it is safe to call from the audio thread.
+	/// Free blocks are linked through their own first sample.
+	void deallocate(float * block, int size);
+
+	/// Get total number of samples reserved from the system
+	int reserved() const { return mReserved; }
+
+private:
+	std::vector<float *> mSlabs;
+	float * mFree[32];	// heads of lists of free blocks, by log2 of size
+	int mSlabSize;
+	int mSlabUsed;		// samples used of most recent slab
+	int mReserved;
+};
+
+
+
 /// The attenuation policy may be different per source, i.e., because a bee has
 /// a different attenuation characteristic than an airplane.
 ///
@@ -236,12 +336,14 @@ public:
 	/// @param[in] delaySize	Size of internal delay line. This should be
 	///							large enough for the most distant sound:
 	///							samples = sampleRate * (near + range)/speedOfSound
+	///							It is at least four samples, the taps of
+	///							the interpolation.
 	SoundSource(
 	        double nearClip=0.1, double farClip=20, AttenuationLaw law = ATTEN_INVERSE, DopplerType dopplerType = DOPPLER_SYMMETRICAL,
 	        double farBias=0, int delaySize=100000
 	        );
 
-	virtual ~SoundSource(){}
+	virtual ~SoundSource();
 
 
 	/// Returns whether distance-based attenuation is enabled
@@ -256,7 +358,7 @@ public:
 	}
 
 	/// Get size of delay in samples
-	int delaySize() const { return mSound.size(); }
+	int delaySize() const { return mDelaySize; }
 
 	/// Convert delay, in seconds, to an index
 	double delayToIndex(double delay, double sampleRate) const {
@@ -277,13 +379,13 @@ public:
 	/// the buffer. The index must be less than or equal to bufferSize()-2.
 	float readSample(double index) const {
 		int index0 = index;
-		float a = mSound.read(index0);
-		float b = mSound.read(index0+1);
+		float a = read(index0);
+		float b = read(index0+1);
 		float frac = index - index0;
 		//return ipl::linear(frac, a, b);
 
-		float a0 = mSound.read(index0-1);
-		float b1 = mSound.read(index0+2);
+		float a0 = read(index0-1);
+		float b1 = read(index0+2);
 		return ipl::cubic(frac, a0, a, b, b1);
 
 	}
@@ -295,7 +397,38 @@ public:
 	void dopplerType(DopplerType type){ mDopplerType = type; }
 
 	/// Write sample to internal delay-line
-	void writeSample(float v){ mSound.write(v); }
+	void writeSample(float v){
+		if(++mDelayPos == mDelaySize) mDelayPos = 0;
+		delayData()[mDelayPos] = v;
+	}
+
+	/// Read a block of samples from delay-line using cubic interpolation
+
+	/// This is equivalent to dst[i] = gain * readSample(index - i), i.e., it
+	/// reads forward in time starting index samples ago. Since the fraction
+	/// of all read positions is the same, the interpolation weights are
+	/// computed once and the reads are done over contiguous runs of the
+	/// delay-line. Indices beyond maxIndex() are clamped.
+	void readSamples(float * dst, double index, int numFrames, float gain) const;
+
+	/// Use a delay-line from a shared pool, sized for a maximum distance
+
+	/// The delay-line is made just large enough to delay sounds up to
+	/// maxDistance away by one block. This typically needs an order of
+	/// magnitude less memory than the fixed size allocated by the
+	/// constructor, which is released (pass a delaySize of 0 to the
+	/// constructor to allocate only a few samples). Sounds farther than
+	/// maxDistance are read at the maximum delay.
+	///
+	/// @param[in] pool			pool to allocate delay-line from
+	/// @param[in] maxDistance	maximum distance of source, e.g. the far clip
+	/// @param[in] sampleRate	sample rate of scene
+	/// @param[in] speedOfSound	speed of sound of scene
+	/// @param[in] numFrames	block size of scene
+	void delayLine(
+		DelayPool& pool, double maxDistance,
+		double sampleRate, double speedOfSound, int numFrames
+	);
 
 	/// optional onProcessSample for sample rate processing of sound sources
 	virtual void onProcessSample(int frame){}
@@ -308,8 +441,20 @@ public:
 		mUsePerSampleProcessing = shouldUsePerSampleProcessing;
 	}
 
+	/// Get rendering priority
+	int priority() const { return mPriority; }
+
+	/// Set rendering priority (0 by default)
+
+	/// When the number of audible sources exceeds AudioScene::maxSources(),
+	/// sources with lower priority are dropped first, and among sources of
+	/// equal priority, the quietest.
+	void priority(int v){ mPriority = v; }
+
+	/// \deprecated Spatializers keep their state per source index
 	void cachedIndex(unsigned int v){ mCachedIndex = v; }
 
+	/// \deprecated Spatializers keep their state per source index
 	unsigned int cachedIndex(){ return mCachedIndex; }
 
 	// calculate the buffersize needed for given samplerate, speed of sound & distance traveled (e.g. nearClip+clipRange).
@@ -320,11 +465,33 @@ public:
 
 
 protected:
-	RingBuffer<float> mSound;		// spherical wave around position
+	std::vector<float> mSound;		// spherical wave around position
+	float * mPoolDelay;				// delay-line memory from pool, if any
+	DelayPool * mDelayPool;
+	int mDelaySize;
+	int mDelayPos;					// index of newest sample
+
+	float * delayData(){ return mDelayPool ? mPoolDelay : &mSound[0]; }
+	const float * delayData() const { return mDelayPool ? mPoolDelay : &mSound[0]; }
+
+	// Get sample relative to newest sample
+	float read(int i) const {
+		int j = mDelayPos - i;
+		if(j < 0) j += mDelaySize;
+		else if(j >= mDelaySize) j -= mDelaySize;
+		return delayData()[j];
+	}
+	void releaseDelay();
 	bool mUseAtten;
 	DopplerType mDopplerType;
 	bool mUsePerSampleProcessing;
     unsigned int mCachedIndex; // for VBAP with multiple sources
+	int mPriority;
+
+private:
+	// Disable copying; the delay-line is owned by one source
+	SoundSource(const SoundSource&);
+	SoundSource& operator=(const SoundSource&);
 };
 
 
@@ -337,12 +504,28 @@ public:
 	/// A set of listeners
 	typedef std::vector<Listener *> Listeners;
 
-	/// A set of sources
-	typedef std::list<SoundSource *> Sources;
+	/// A set of sources, stored contiguously
+
+	/// This used to be a std::list. Adding or removing a source now
+	/// invalidates iterators into sources(), so sources cannot be removed
+	/// while iterating over them; collect them first and remove them after.
+	typedef std::vector<SoundSource *> Sources;
+
+	/// Source parameters that can be changed with sendParam()
+	enum SourceParam{
+		NEAR_CLIP,			/**< Near clip distance */
+		FAR_CLIP,			/**< Far clip distance */
+		FAR_BIAS,			/**< Amplitude at far clip */
+		ATTEN_LAW,			/**< Attenuation law (an AttenuationLaw) */
+		USE_ATTEN,			/**< Whether attenuation is enabled (0 or 1) */
+		DOPPLER_TYPE		/**< Doppler type (a DopplerType) */
+	};
 
 
 	/// @param[in] numFrames	block size of audio buffers
-	AudioScene(int numFrames);
+	/// @param[in] maxCommands	minimum capacity of the command queue, in
+	///							commands
+	AudioScene(int numFrames, int maxCommands=1024);
 
 	~AudioScene();
 
@@ -364,14 +547,79 @@ public:
 	Listener * createListener(Spatializer * spatializer);
 
 	/// Add a sound source to scene
+
+	/// This modifies the sources directly, so it must not be called while
+	/// render() is running. Use sendAddSource() from other threads.
 	void addSource(SoundSource& src);
 
 	/// Remove a sound source from scene
+
+	/// This modifies the sources directly, so it must not be called while
+	/// render() is running. Use sendRemoveSource() from other threads.
 	void removeSource(SoundSource& src);
 
+	/// Reserve storage for a number of sources
+
+	/// Sources added through the command queue beyond the reserved number
+	/// cause the source array, the voice list and the per source state of
+	/// the spatializers to be reallocated in the audio thread. This
+	/// must not be called while render() is running.
+	void reserveSources(int num);
+
+	/// Queue addition of a sound source
+
+	/// The send functions can be called from any number of control threads
+	/// while the audio thread renders. Each command is copied into a cell of
+	/// a bounded queue, claimed without locking using per-cell sequence
+	/// numbers (D. Vyukov's bounded queue), and applied at the start of the
+	/// next render() in the order the cells were claimed. Neither senders
+	/// nor the audio thread wait on each other.
+	///
+	/// \returns false if the command queue is full
+	bool sendAddSource(SoundSource& src);
+
+	/// Queue removal of a sound source
+
+	/// The source must not be destroyed until the command has been applied,
+	/// i.e., until a render() started after this call has completed.
+	/// \returns false if the command queue is full
+	bool sendRemoveSource(SoundSource& src);
+
+	/// Queue a pose change of a source or listener
+
+	/// \returns false if the command queue is full
+	bool sendPose(AudioSceneObject& obj, const Pose& pose);
+
+	/// Queue a parameter change of a source
+
+	/// \returns false if the command queue is full
+	bool sendParam(SoundSource& src, SourceParam param, double value);
+
 	/// Perform rendering
 	void render(AudioIOData& io);
 
+	/// Set number of threads used to render sources (1 by default)
+
+	/// When greater than 1, the sources are split into contiguous partitions
+	/// that are rendered concurrently by a pool of worker threads, each into
+	/// a private output accumulator. The calling (audio) thread renders the
+	/// first partition, then any partition a worker has not yet started, and
+	/// sums the accumulators into the output in partition order, so results
+	/// are deterministic. Idle workers block until the audio thread hands
+	/// them a block. Listeners whose
+	/// spatializer is not reentrant are always rendered serially, as are
+	/// blocks whose size or channel count does not match the accumulators.
+	/// This must not be called while render() is running.
+	///
+	/// @param[in] num			number of partitions including the audio thread
+	/// @param[in] numChannels	number of output channels of the audio device
+	/// @param[in] priority		priority of worker threads in [0, 99]. A value
+	///							greater than 0 makes the threads "real-time".
+	void numThreads(int num, int numChannels, int priority=0);
+
+	/// Get number of threads used to render sources
+	int numThreads() const;
+
 	/// Set per sample processing (false by default)
 	/// Per sample processing is useful for smoother doppler and gain
 	/// interpolation for high-speed sources, but uses much more CPU.
@@ -384,13 +632,88 @@ public:
 		mPerSampleProcessing = shouldUsePerSampleProcessing;
 	}
 
+	/// Set gain at or below which sources are culled (0 by default)
+
+	/// Before rendering a block for a listener, each source's attenuation
+	/// at its nearest distance over the block is compared to this gain. If
+	/// it is not greater, the source is skipped entirely. With the default
+	/// of 0, only sources that would be silent are culled, i.e., those
+	/// beyond their far clip with a far bias of 0 (linear law) and, with
+	/// per sample processing, those beyond the reach of their delay-line.
+	/// Sources using their own per sample processing are never culled.
+	void cullGain(float v){ mCullGain = v; }
+
+	/// Set distance beyond which sources are rendered per buffer
+
+	/// With per sample processing, sources farther than this distance from
+	/// the listener are rendered with the cheaper per buffer processing.
+	/// Sources using their own per sample processing are not downgraded.
+	/// By default, no sources are downgraded.
+	void lodDistance(double v){ mLODDistance = v; }
+
+	/// Set maximum number of sources rendered per listener (0 = unlimited)
+
+	/// When more sources are audible, the ones with the lowest priority,
+	/// then lowest gain, are dropped for the block.
+	void maxSources(int v){ mMaxSources = v; }
+
+	/// Get number of sources culled in the last block, over all listeners
+	int numCulled() const { return mNumCulled.load(std::memory_order_relaxed); }
+
+	/// Get number of sources dropped due to maxSources() in the last block
+	int numDropped() const { return mNumDropped.load(std::memory_order_relaxed); }
+
+	/// Get number of sources downgraded to per buffer processing in the last block
+	int numDowngraded() const { return mNumDowngraded.load(std::memory_order_relaxed); }
+
 protected:
+	class RenderPool;
+	struct Command;
+	struct CommandCell;
+
+	// A source to be rendered for the current listener
+	struct Voice{
+		SoundSource * src;
+		float gain;			// attenuation at nearest distance in block
+		int index;			// index into mSources
+		bool perSample;		// whether to render per sample
+	};
+
 	Listeners mListeners;
 	Sources mSources;
 	int mNumFrames;				// audio frames per block
 	std::vector<float> mBuffer;	// temporary frame buffer
 	double mSpeedOfSound;		// distance per second
 	bool mPerSampleProcessing;
+	std::vector<Voice> mVoices;	// sources to render for current listener
+	float mCullGain;
+	double mLODDistance;
+	int mMaxSources;
+	std::atomic<int> mNumCulled, mNumDropped, mNumDowngraded;
+	RenderPool * mRenderPool;	// worker threads for parallel rendering
+	CommandCell * mCommands;			// queue of commands from control threads
+	size_t mCommandMask;				// number of cells minus one
+	std::atomic<size_t> mCommandWrite;	// shared by control threads
+	size_t mCommandRead;				// owned by the audio thread
+
+	bool sendCommand(const Command& c);
+	void applyCommands();
+	void numSourcesChanged();
+
+	AudioScene(const AudioScene&);
+	AudioScene& operator=(const AudioScene&);
+
+	// Determine voices to render for a listener
+	void cull(const AudioIOData& io, Listener& l,
+		int& numCulled, int& numDropped, int& numDowngraded);
+
+	// Render voices [beg, end) of mVoices for a listener
+	void renderSources(
+		AudioIOData& io, Listener& l, int listenerIndex,
+		int beg, int end, float * buffer
+	);
+
+	bool renderParallel(AudioIOData& io, Listener& l, int listenerIndex);
 };
 
 } // al::
@@ -60,11 +60,19 @@ public:
 
 	void compile(Listener& listener);
 
+	void numSources(int num);
+
+	void removeSource(int index);
+
+	using Spatializer::perform;
+
 	///Per Sample Processing
-	void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample);
+	void perform(AudioIOData& io, SoundSource& src, int index, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample);
 
 	/// Per Buffer Processing
-	void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, float *samples);
+	void perform(AudioIOData& io, SoundSource& src, int index, Vec3d& relpos, const int& numFrames, float *samples);
+
+	bool reentrant() const { return true; }
 
 	/// focus is an exponent determining the amplitude focus to nearby speakers.
 
@@ -74,12 +82,26 @@ public:
 
 	void print();
 
+	/// Compute gains of all speakers for a source position
+
+	/// @param[out] gains	array of numSpeakers() gains
+	/// @param[in] relpos	source position relative to listener
+	void computeGains(float * gains, const Vec3d& relpos) const;
+
 private:
 	Listener * mListener;
 	Vec3f mSpeakerVecs[DBAP_MAX_NUM_SPEAKERS];
+	// Speaker positions as separate coordinate arrays for vectorization
+	float mSpeakerX[DBAP_MAX_NUM_SPEAKERS];
+	float mSpeakerY[DBAP_MAX_NUM_SPEAKERS];
+	float mSpeakerZ[DBAP_MAX_NUM_SPEAKERS];
 	int mDeviceChannels[DBAP_MAX_NUM_SPEAKERS];
 	int mNumSpeakers;
 	float mFocus;
+	// Gains of the previous block, mNumSpeakers per source. Negative if the
+	// source has not been rendered yet.
+	std::vector<float> mPrevGains;
+	int mNumSources;
 };
 
 
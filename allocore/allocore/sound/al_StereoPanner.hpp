@@ -32,8 +32,10 @@ public:
 			printf("Stereo Panner Requires exactly 2 speakers (%i used), no panning will occur!\n", numSpeakers);
 	}
 
+	using Spatializer::perform;
+
 	///Per Sample Processing
-	void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample)
+	void perform(AudioIOData& io, SoundSource& src, int index, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample)
 	{
 		if(numSpeakers == 2 && mEnabled)
 		{
@@ -52,7 +54,7 @@ public:
 	}
 
 	/// Per Buffer Processing
-	void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, float *samples)
+	void perform(AudioIOData& io, SoundSource& src, int index, Vec3d& relpos, const int& numFrames, float *samples)
 	{
 		if(numSpeakers == 2 && mEnabled)
 		{
@@ -90,7 +90,20 @@ public:
 
 	void setIs3D(bool is3D){mIs3D = is3D;}
 
-	Vec3d computeGains(const Vec3d& vecA, const SpeakerTriple& speak);
+	Vec3d computeGains(const Vec3d& vecA, const SpeakerTriple& speak) const;
+
+	/// Find the triplet containing a direction
+
+	/// The triplet at index is tested first. Otherwise, the triplets whose
+	/// region may contain the direction are looked up in a table built by
+	/// compile() and the first match in cyclic order after index is chosen,
+	/// which is the same triplet a linear search from index would find.
+	///
+	/// @param[in]  vec		direction, in listener coordinates
+	/// @param[in,out] index	starting triplet index; set to matching triplet
+	/// @param[out] gains	unnormalized gains of matching triplet
+	/// \returns whether a triplet containing the direction was found
+	bool findTriplet(const Vec3d& vec, unsigned& index, Vec3d& gains) const;
 
 	/// 2D VBAP, Build internal list of speaker pairs
 	void findSpeakerPairs(const std::vector<Speaker>& spkrs);
@@ -115,9 +128,17 @@ public:
 
 	void compile(Listener& listener);
 
-	void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample);
+	void numSources(int num);
+
+	void removeSource(int index);
+
+	using Spatializer::perform;
+
+	void perform(AudioIOData& io, SoundSource& src, int index, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample);
+
+	void perform(AudioIOData& io,SoundSource& src,int index,Vec3d& relpos,const int& numFrames,float *samples);
 
-	void perform(AudioIOData& io,SoundSource& src,Vec3d& relpos,const int& numFrames,float *samples);
+	bool reentrant() const { return true; }
 
 	void print();
 
@@ -130,6 +151,19 @@ private:
 	unsigned mNumTriplets;
 	Listener* mListener;
 	bool mIs3D;
+	std::vector<unsigned> mSourceTriplets;	// triplet of each source in previous block
+
+	// Direction to triplet lookup table. Directions are binned on the faces
+	// of a cube (3D) or by azimuth (2D). The candidate triplets of bin i are
+	// mBinTriplets[mBinStart[i]] to mBinTriplets[mBinStart[i+1]-1].
+	std::vector<unsigned> mBinStart;
+	std::vector<unsigned> mBinTriplets;
+
+	int numBins() const;
+	int bin(const Vec3d& vec) const;
+	void binCap(int bin, Vec3d& center, double& radius) const;
+	double angleToTriple(const Vec3d& dir, const SpeakerTriple& triple) const;
+	void buildLookup();
 };
 
 } // al::
@@ -48,6 +48,11 @@
 	It is optimized for densely packed points and querying for nearest neighbors
 	within given radii (results will be roughly sorted by distance).
 
+	When all objects move every frame, rebuild() can be used instead of
+	move(). It counting-sorts the objects by voxel into contiguous arrays,
+	optionally across several threads, and queries then scan contiguous
+	ranges instead of following per voxel linked lists.
+
 	TODO: non-toroidal options
 	TODO: have query() automatically (insertion) sort results by distance
 		(perhaps use std::set instead of vector?)
@@ -241,6 +246,67 @@ public:
 	/// the objectId can be reused later via move()
 	HashSpace& remove(uint32_t objectId);
 
+	/**
+		Rebuild the space from the positions of all objects
+
+		Objects are counting-sorted by voxel into contiguous arrays of
+		positions and object indices, which queries then scan directly. All
+		objects are included, whether or not they were removed. The work is
+		split into numThreads tasks run on the global ThreadPool (the
+		calling thread when 1).
+
+		The space stays packed until the next call to move() or remove(),
+		which first rebuilds the per voxel lists of objects.
+
+		@param numThreads number of threads to rebuild with
+	*/
+	HashSpace& rebuild(int numThreads=1);
+
+	/// set the positions of all objects and rebuild the space
+	template<typename T>
+	HashSpace& rebuild(const Vec<3,T> * positions, int numThreads=1);
+
+	/// whether the space was packed by rebuild()
+	bool packed() const { return mPacked; }
+
+	/**
+		Find the k nearest objects to each of a batch of points
+
+		Results are written to flat arrays of n*k elements, where the
+		neighbors of point i are at i*k to i*k+k-1. They are exactly sorted
+		by distance (and then by object index); unused slots are set to
+		invalidHash(). Each point keeps a bounded heap of its k best
+		candidates and stops visiting voxels once no closer object can
+		be found. The points are split into numThreads tasks run on the
+		global ThreadPool (the calling thread when 1).
+
+		@param centers points to search around
+		@param n number of points
+		@param k maximum number of neighbors per point
+		@param maxRadius only find objects nearer this distance
+			(at most maxRadius())
+		@param ids output array of n*k object indices
+		@param distancesSquared output array of n*k squared distances (optional)
+		@param numThreads number of threads to search with
+		@return the total number of neighbors found
+	*/
+	uint32_t nearest(
+		const Vec3d * centers, uint32_t n, uint32_t k, double maxRadius,
+		uint32_t * ids, double * distancesSquared=NULL, int numThreads=1
+	) const;
+
+	/**
+		Find the k nearest neighbors of every object
+
+		This is the same as nearest() with the positions of all objects,
+		but an object is never its own neighbor. The output arrays have
+		numObjects()*k elements.
+	*/
+	uint32_t nearestAll(
+		uint32_t k, double maxRadius,
+		uint32_t * ids, double * distancesSquared=NULL, int numThreads=1
+	) const;
+
 	/// wrap an absolute position within the space:
 	double wrap(double x) const { return wrap(x, dim()); }
 	template<typename T>
@@ -261,6 +327,14 @@ public:
 	static uint32_t invalidHash() { return UINT_MAX; }
 
 protected:
+	struct Packer;
+	struct Searcher;
+
+	// batched k nearest search; centers is NULL to search around all objects
+	uint32_t search(
+		const Vec3d * centers, uint32_t n, uint32_t k, double maxRadius,
+		uint32_t * ids, double * distancesSquared, int numThreads
+	) const;
 
 	// integer distance squared
 	uint32_t distanceSquared(double a1, double a2, double a3) const;
@@ -316,6 +390,16 @@ protected:
 	/// a baked array mapping distance to mVoxelIndices offsets
 	std::vector<uint32_t> mDistanceToVoxelIndices;
 	std::vector<uint32_t> mVoxelIndicesToDistance;
+
+	/// packed objects, sorted by voxel (see rebuild())
+	bool mPacked;
+	std::vector<uint32_t> mPackedStart;	// offset of each voxel's objects
+	std::vector<double> mPackedX, mPackedY, mPackedZ;
+	std::vector<uint32_t> mPackedIds;	// indices into mObjects
+	std::vector<uint32_t> mPackCounts;	// per thread voxel counts
+
+	// rebuild the per voxel lists from the packed arrays
+	void unpack();
 };
 
 
@@ -373,6 +457,23 @@ inline int HashSpace::Query :: operator()(const HashSpace& space, Vec3d center,
 		uint32_t cellend = space.mDistanceToVoxelIndices[imaxr2];
 		for (uint32_t i = cellstart; i < cellend; i++) {
 			uint32_t index = space.hash(center, space.mVoxelIndices[i]);
+			if (space.mPacked) {
+				// scan the contiguous range of objects in this voxel:
+				uint32_t end = space.mPackedStart[index+1];
+				for (uint32_t k = space.mPackedStart[index]; k < end && nres < mMaxResults; k++) {
+					Vec3d rel = space.wrapRelative(
+						Vec3d(space.mPackedX[k], space.mPackedY[k], space.mPackedZ[k]) - center
+					);
+					double d2 = rel.magSqr();
+					if (d2 >= minr2 && d2 <= maxr2) {
+						mObjects[nres].object = const_cast<Object *>(&space.mObjects[space.mPackedIds[k]]);
+						mObjects[nres].distanceSquared = d2;
+						nres++;
+					}
+				}
+				if(nres == mMaxResults) break;
+				continue;
+			}
 			const Voxel& voxel = space.mVoxels[index];
 			// now add any objects in this voxel to the result...
 			Object * head = voxel.mObjects;
@@ -414,6 +515,26 @@ inline int HashSpace::Query :: operator()(const HashSpace& space, const HashSpac
 		uint32_t cellend = space.mDistanceToVoxelIndices[imaxr2];
 		for (uint32_t i = cellstart; i < cellend; i++) {
 			uint32_t index = space.hash(center, space.mVoxelIndices[i]);
+			if (space.mPacked) {
+				// scan the contiguous range of objects in this voxel:
+				uint32_t end = space.mPackedStart[index+1];
+				for (uint32_t k = space.mPackedStart[index]; k < end && nres < mMaxResults; k++) {
+					const Object * o = &space.mObjects[space.mPackedIds[k]];
+					if (o != obj) {
+						Vec3d rel = space.wrapRelative(
+							Vec3d(space.mPackedX[k], space.mPackedY[k], space.mPackedZ[k]) - center
+						);
+						double d2 = rel.magSqr();
+						if (d2 >= minr2 && d2 <= maxr2) {
+							mObjects[nres].object = const_cast<Object *>(o);
+							mObjects[nres].distanceSquared = d2;
+							nres++;
+						}
+					}
+				}
+				if(nres == mMaxResults) break;
+				continue;
+			}
 			const Voxel& voxel = space.mVoxels[index];
 			// now add any objects in this voxel to the result...
 			Object * head = voxel.mObjects;
@@ -463,6 +584,7 @@ inline HashSpace::Object * HashSpace::Query :: nearest(const HashSpace& space, c
 
 
 inline void HashSpace :: numObjects(int numObjects) {
+	mPacked = false;
 	mObjects.clear();
 	mObjects.resize(numObjects);
 	// clear all voxels:
@@ -473,6 +595,7 @@ inline void HashSpace :: numObjects(int numObjects) {
 
 template<typename T>
 inline HashSpace& HashSpace :: move(uint32_t objectId, Vec<3,T> pos) {
+	if (mPacked) unpack();
 	Object& o = mObjects[objectId];
 	o.pos.set(wrap(pos));
 	uint32_t newhash = hash(o.pos);
@@ -485,12 +608,21 @@ inline HashSpace& HashSpace :: move(uint32_t objectId, Vec<3,T> pos) {
 }
 
 inline HashSpace& HashSpace :: remove(uint32_t objectId) {
+	if (mPacked) unpack();
 	Object& o = mObjects[objectId];
 	if (o.hash != invalidHash()) mVoxels[o.hash].remove(&o);
 	o.hash = invalidHash();
 	return *this;
 }
 
+template<typename T>
+inline HashSpace& HashSpace :: rebuild(const Vec<3,T> * positions, int numThreads) {
+	for (unsigned i=0; i<mObjects.size(); i++) {
+		mObjects[i].pos.set(positions[i]);
+	}
+	return rebuild(numThreads);
+}
+
 // integer distance squared
 inline uint32_t HashSpace :: distanceSquared(double x, double y, double z) const {
 	return x*x+y*y+z*z;
@@ -42,6 +42,7 @@
 	Lance Putnam, 2013, putnam.lance@gmail.com
 */
 
+#include <atomic>
 #include "allocore/system/al_Thread.hpp"
 #include "allocore/system/al_Time.hpp"
 
@@ -53,16 +54,47 @@ namespace al{
 /// user-supplied thread function. This prevents drift that would occur in a
 /// more simplistic implementation using a fixed sleep interval.
 ///
+/// In precise mode, calls are instead scheduled on a fixed grid of absolute
+/// deadlines. The thread sleeps until shortly before each deadline and then
+/// spins the remaining time. How the thread recovers from calls that overrun
+/// the period is set by catchUp().
+///
+/// The lateness of each call relative to its deadline is recorded in a
+/// histogram that can be queried with stats() while the thread runs.
+///
 /// @ingroup allocore
 class PeriodicThread : public Thread{
 public:
 
+	/// How to recover when calls overrun the period in precise mode
+	enum CatchUp{
+		SKIP,		///< Drop missed periods and stay on the original grid
+		BURST,		///< Make up missed periods with back-to-back calls
+		STRETCH		///< Restart the grid from the end of the late call
+	};
+
+	/// Timing statistics of calls
+	struct Stats{
+		unsigned long long periods;	///< Number of calls
+		unsigned long long missed;	///< Number of deadlines passed during earlier calls
+		double min;					///< Minimum lateness, in seconds
+		double mean;				///< Mean lateness, in seconds
+		double p99;					///< 99th percentile of lateness, in seconds
+		double max;					///< Maximum lateness, in seconds
+	};
+
+
 	/// @param[in] periodSec	calling period in seconds
 	PeriodicThread(double periodSec=1);
 
 	/// Copy constructor
+
+	/// Timing statistics are not copied.
+	///
 	PeriodicThread(const PeriodicThread& other);
 
+	~PeriodicThread();
+
 
 	/// Set autocorrection factor
 
@@ -82,6 +114,43 @@ public:
 	/// Get period, in seconds
 	double period() const;
 
+	/// Set whether to schedule calls on a grid of absolute deadlines
+	PeriodicThread& precise(bool v){ mPrecise=v; return *this; }
+
+	/// Get whether calls are scheduled on a grid of absolute deadlines
+	bool precise() const { return mPrecise; }
+
+	/// Set time to spin before each deadline in precise mode, in seconds
+
+	/// This should be a little longer than the typical lateness of a wake
+	/// up from sleep on the system.
+	PeriodicThread& spin(double sec);
+
+	/// Set how to recover from calls overrunning the period in precise mode
+	PeriodicThread& catchUp(CatchUp v){ mCatchUp=v; return *this; }
+
+	/// Set real-time priority applied when the thread starts
+
+	/// On Linux, the thread is given the SCHED_FIFO policy with this
+	/// priority in [1, 99]; 0 leaves the policy unchanged. This usually
+	/// requires extra privileges. Ignored on other platforms.
+	PeriodicThread& realtime(int priority){ mRealtime=priority; return *this; }
+
+	/// Set CPU the thread is pinned to when it starts
+
+	/// Pinning is only supported on Linux; -1 lets the thread run on any CPU.
+	///
+	PeriodicThread& affinity(int cpu){ mCPU=cpu; return *this; }
+
+	/// Get timing statistics of calls since start or last reset
+
+	/// This can be called from any thread. The percentile is estimated from
+	/// a histogram with 1 microsecond bins up to 1 millisecond.
+	Stats stats() const;
+
+	/// Reset timing statistics
+	void resetStats();
+
 	/// Start calling the supplied function periodically
 	void start(ThreadFunction& func);
 
@@ -94,8 +163,20 @@ public:
 	PeriodicThread& operator= (PeriodicThread other);
 
 private:
+	enum{ NUM_BINS = 1001 };		// 1 us bins; last bin holds later calls
+
+	struct Timing{
+		std::atomic<unsigned> bins[NUM_BINS];
+		std::atomic<unsigned long long> periods, missed;
+		std::atomic<al_nsec> sum, min, max;
+	};
+
 	static void * sPeriodicFunc(void * userData);
 	void go();
+	void goPrecise();
+	void sleepUntil(al_nsec deadline);
+	void record(al_nsec late);
+	void setScheduling();
 
 	al_nsec mPeriod;
 	al_nsec mTimeCurr, mTimePrev;	// time measurements between frames
@@ -104,6 +185,12 @@ private:
 	float mAutocorrect;
 	ThreadFunction * mUserFunc;
 	bool mRun;
+	bool mPrecise;
+	CatchUp mCatchUp;
+	al_nsec mSpin;
+	int mRealtime;
+	int mCPU;
+	Timing * mTiming;
 };
 
 } // al::
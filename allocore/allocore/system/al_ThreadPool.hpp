@@ -0,0 +1,267 @@
+#ifndef INCLUDE_AL_THREADPOOL_HPP
+#define INCLUDE_AL_THREADPOOL_HPP
+
+
+/*	Allocore --
+	Multimedia / virtual environment application class library
+
+	Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology, UCSB.
+	Copyright (C) 2012. The Regents of the University of California.
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+		Redistributions of source code must retain the above copyright notice,
+		this list of conditions and the following disclaimer.
+
+		Redistributions in binary form must reproduce the above copyright
+		notice, this list of conditions and the following disclaimer in the
+		documentation and/or other materials provided with the distribution.
+
+		Neither the name of the University of California nor the names of its
+		contributors may be used to endorse or promote products derived from
+		this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+
+
+
+	File description:
+	Persistent work-stealing thread pool with task groups and futures
+*/
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "allocore/system/al_Thread.hpp"
+
+namespace al{
+
+
+/// Persistent pool of worker threads
+
+/// Each worker has its own queue of tasks. Workers run their own most
+/// recently queued tasks first and, when idle, steal the oldest tasks from
+/// the other workers. Tasks queued from within a task go to the queue of the
+/// worker running it, so nested parallelism stays local.
+///
+/// An optional real-time lane is a single extra thread with elevated
+/// priority serving its own queue, so short, latency-critical tasks are
+/// never stuck behind bulk work.
+///
+/// @ingroup allocore
+class ThreadPool{
+public:
+
+	typedef std::function<void()> Task;
+
+
+	/// @param[in] numThreads	number of worker threads; 0 for one per processor
+	ThreadPool(int numThreads = 0);
+
+	~ThreadPool();
+
+	/// Get the pool shared by the library, with one worker per processor
+	static ThreadPool& global();
+
+
+	/// Returns number of worker threads
+	int size() const { return mQueues.size(); }
+
+	/// Queue a task
+	void submit(const Task& task);
+
+	/// Queue a task and get a future for its result
+
+	/// Waiting on the future from within a task can deadlock the pool; use
+	/// a TaskGroup to wait on tasks from other tasks.
+	template <class F>
+	std::future<typename std::result_of<F()>::type> async(F f);
+
+	/// Call f(i) for each i in [begin, end) using the pool
+
+	/// The calling thread runs tasks until all calls have returned.
+	/// @param[in] begin	first index
+	/// @param[in] end		one past last index
+	/// @param[in] f		function object taking an int index
+	/// @param[in] grain	indices per task; 0 chooses about 4 tasks per worker
+	template <class F>
+	void parallelFor(int begin, int end, const F& f, int grain = 0);
+
+	/// Run one queued task on the calling thread
+
+	/// \returns false if no task was queued
+	///
+	bool runPending();
+
+
+	/// Start the real-time lane
+
+	/// @param[in] priority		priority of lane thread in [1, 99]
+	///
+	ThreadPool& realtime(int priority = 80);
+
+	/// Returns whether the real-time lane is running
+	bool realtime() const { return mRTRunning; }
+
+	/// Queue a task on the real-time lane
+
+	/// Tasks run in the order queued. If the lane is not running, the task
+	/// is queued on the workers.
+	void submitRealtime(const Task& task);
+
+protected:
+	struct Queue{
+		std::mutex lock;
+		std::deque<Task> tasks;
+	};
+
+	struct Worker : public ThreadFunction{
+		ThreadPool * pool;
+		int index;
+		void operator()(){ pool->work(index); }
+	};
+
+	struct RTWorker : public ThreadFunction{
+		ThreadPool * pool;
+		void operator()(){ pool->workRealtime(); }
+	};
+
+	std::vector<Queue *> mQueues;
+	std::vector<Worker> mWorkers;
+	std::vector<Thread *> mThreads;
+	std::atomic<int> mQueued;		// tasks in all worker queues
+	std::atomic<int> mSleeping;		// idle workers waiting on mWake
+	std::atomic<unsigned> mNext;	// queue for next task from outside pool
+	std::mutex mSleepLock;
+	std::condition_variable mWake;
+	bool mStop;
+
+	Queue mRTQueue;
+	std::condition_variable mRTWake;
+	RTWorker mRTWorker;
+	Thread mRTThread;
+	bool mRTRunning;
+
+	bool pop(int index, Task& task);
+	void work(int index);
+	void workRealtime();
+};
+
+
+
+/// Set of tasks that can be waited on together
+
+/// Tasks may run further tasks in the same or other groups. A thread waiting
+/// on a group runs queued tasks, so groups can be nested inside pool tasks.
+/// When there is nothing left to run, it sleeps until a task of the group
+/// finishes.
+///
+/// @ingroup allocore
+class TaskGroup{
+public:
+
+	/// @param[in] pool		pool to run tasks on
+	TaskGroup(ThreadPool& pool = ThreadPool::global())
+	:	mPool(pool), mPending(0), mWaiting(0)
+	{}
+
+	/// Waits on all tasks
+	~TaskGroup(){ wait(); }
+
+	/// Queue a function object to run in the group
+	template <class F>
+	void run(const F& f){
+		++mPending;
+		mPool.submit(Runner<F>(f, *this));
+	}
+
+	/// Block until all tasks in the group have finished
+	void wait();
+
+	/// Returns pool the group runs on
+	ThreadPool& pool(){ return mPool; }
+
+protected:
+	// Marks a task finished, even if it throws
+	struct Finish{
+		Finish(TaskGroup& g): group(g){}
+		~Finish(){ group.finish(); }
+		TaskGroup& group;
+	};
+
+	template <class F>
+	struct Runner{
+		Runner(const F& f_, TaskGroup& g): f(f_), group(&g){}
+		void operator()(){ Finish finish(*group); f(); }
+		F f;
+		TaskGroup * group;
+	};
+
+	ThreadPool& mPool;
+	std::atomic<int> mPending;
+	int mWaiting;					// threads sleeping in wait()
+	std::mutex mLock;
+	std::condition_variable mFinished;
+
+	void finish();
+
+private:
+	TaskGroup(const TaskGroup&);
+	TaskGroup& operator=(const TaskGroup&);
+};
+
+
+
+
+// -----------------------------------------------------------------------------
+// Inline implementation
+
+template <class F>
+std::future<typename std::result_of<F()>::type> ThreadPool::async(F f){
+	typedef typename std::result_of<F()>::type R;
+	// std::function needs a copyable target, so share the packaged task
+	std::shared_ptr<std::packaged_task<R()> > task(new std::packaged_task<R()>(f));
+	submit([task](){ (*task)(); });
+	return task->get_future();
+}
+
+template <class F>
+void ThreadPool::parallelFor(int begin, int end, const F& f, int grain){
+	if(end <= begin) return;
+	int n = end - begin;
+	if(grain < 1) grain = n / (size()*4);
+	if(grain < 1) grain = 1;
+
+	if(n <= grain){
+		for(int i=begin; i<end; ++i) f(i);
+		return;
+	}
+
+	TaskGroup group(*this);
+	for(int b=begin; b<end; b+=grain){
+		int e = b + grain < end ? b + grain : end;
+		group.run([&f, b, e](){ for(int i=b; i<e; ++i) f(i); });
+	}
+	group.wait();
+}
+
+} // al::
+
+#endif
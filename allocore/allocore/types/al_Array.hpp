@@ -45,6 +45,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <string>
 #include "allocore/types/al_Array.h"
 #include "allocore/math/al_Functions.hpp"
 #include "allocore/math/al_Vec.hpp"
@@ -154,6 +155,21 @@ public:
 	/// Free memory and set data.ptr to NULL
 	void dataFree();
 
+	/// Map data from a file rather than allocating memory
+
+	/// The file is mapped privately and pages are read on first access, so
+	/// changes to the data are not written back to the file. The layout of
+	/// the data in the file must match the strides of the given header.
+	/// Where mapping is not supported, the data is read into memory instead.
+	/// @param[in] path		path of file
+	/// @param[in] offset	offset, in bytes, of data within file
+	/// @param[in] h2		format of data
+	/// \returns true upon success
+	bool dataMap(const std::string& path, size_t offset, const AlloArrayHeader& h2);
+
+	/// Returns true if data is mapped from a file
+	bool mapped() const { return NULL != mMapBase; }
+
 	/// Set all data to zero
 	void zero();
 
@@ -313,6 +329,9 @@ public:	// temporarily made public, because protected broke some other project c
 	Array& operator= (const Array&);
 protected:
 
+	char * mMapBase;	// start of mapped pages, if data is mapped
+	size_t mMapSize;	// size of mapped pages, in bytes
+
 	// temporary hack because the one in al_Function gave a bad result
 	// for e.g. wrap<double>(-64.0, -32.0);
 	template<typename T>
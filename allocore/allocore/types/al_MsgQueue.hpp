@@ -44,6 +44,7 @@
 
 #include <string.h>
 #include <list>
+#include <vector>
 
 #include "allocore/system/al_Config.h"
 
@@ -67,14 +68,42 @@ public:
 	al_sec now() const { return mNow; }
 
 	// trigger registered callbacks
-	void update(al_sec until, bool defer = false);
-	void advance(al_sec period, bool defer = false) { update(mNow + period, defer); }
+	void update(al_sec until);
+	void advance(al_sec period) { update(mNow + period); }
+
+	/// \deprecated defer never had an effect; use update(al_sec)
+	void update(al_sec until, bool defer) { update(until); }
+
+	/// \deprecated defer never had an effect; use advance(al_sec)
+	void advance(al_sec period, bool defer) { advance(period); }
 
 	void clear();
 
 	// how many messages are scheduled?
 	int len() const { return mLen; }
 
+	/// Statistics of scheduled messages
+	struct Stats {
+		uint64_t scheduled;		///< Number of messages scheduled
+		uint64_t dispatched;	///< Number of messages dispatched
+		uint64_t late;			///< Number of messages dispatched after their time
+		int maxLen;				///< Largest number of messages waiting
+		al_sec totalLatency;	///< Sum of lateness of dispatched messages
+		al_sec maxLatency;		///< Largest lateness of a dispatched message
+
+		/// Mean lateness of dispatched messages
+		al_sec meanLatency() const { return dispatched ? totalLatency / dispatched : 0; }
+	};
+
+	/// Get statistics of scheduled messages
+
+	/// Lateness is measured in logical time; it is how far now() was past the
+	/// time of a message when it was dispatched, i.e. it was scheduled in the past.
+	const Stats& stats() const { return mStats; }
+
+	/// Reset statistics
+	void resetStats();
+
 	// template wrappers for multi-argument functions
 	// be sure to cast the send arguments to exactly match the function argument types!
 	void send(al_sec at, void (*f)(al_sec t)) {
@@ -286,7 +315,7 @@ public:
 
 protected:
 
-	// messages that are larger than this will be heap copied
+	// messages that are larger than this will be copied into pool blocks
 	#define AL_MSGQUEUE_ARGS_SIZE (128 - sizeof(struct Msg *) - sizeof(size_t) - sizeof(al_sec) - sizeof(msg_func))
 
 	struct Msg {
@@ -300,16 +329,40 @@ protected:
 		char * args() { return isBigMessage() ? *(char **)(mArgs) : mArgs; }
 	};
 
-	Msg * mHead;
-	Msg * mTail;
+	// Scheduled message; ordered by time, then by order of scheduling
+	struct Entry {
+		al_sec t;
+		uint64_t id;
+		Msg * msg;
+
+		bool operator< (const Entry& e) const {
+			return t > e.t || (t == e.t && id > e.id);
+		}
+	};
+
+	// Block for arguments of big messages
+	struct Block {
+		Block * next;
+	};
+
+	// block sizes are powers of two from 256 bytes to 32 kB
+	enum { NUM_BLOCK_SIZES = 8, BLOCKS_PER_SLAB = 16 };
+
+	std::vector<Entry> mHeap;	// binary heap with earliest message on top
+	uint64_t mNextID;
 	Msg * mPool;
+	Block * mBlocks[NUM_BLOCK_SIZES];	// free blocks of each size
+	Block * mSlabs;						// allocated slabs of blocks
 	int mLen, mChunkSize;
 	al_sec mNow;
 	malloc_func mMalloc;
 	free_func mFree;
+	Stats mStats;
 
 	void growPool(int size);
 	void recycle(Msg * m);
+	char * allocArgs(size_t size);
+	void freeArgs(char * args, size_t size);
 };
 
 
@@ -42,13 +42,16 @@
 	Graham Wakefield, 2010, grrrwaaa@gmail.com
 */
 
+#include "allocore/system/al_Printing.hpp"
 #include "allocore/system/al_Time.h"
 #include "allocore/types/al_SingleRWRingBuffer.hpp"
 #include <string.h>
+#include <atomic>
 #include <queue>
 #include <cstring>
 
 #define AL_MSGTUBE_DEFAULT_SIZE_BITS (14) // 16384 bytes
+#define AL_MSGTUBEMPSC_CELL_SIZE (128) // bytes per message, including header
 
 /*
 	A C++ class for deferred function calls
@@ -249,6 +252,170 @@ protected:
 	}
 };
 
+///
+/// \brief The MsgTubeMPSC class
+/// Deferred function calls sent from multiple threads to a single thread
+///
+/// Messages are copied into a fixed array of cells, each holding one
+/// message of up to argsSize bytes of arguments. Writers claim cells
+/// without locking using per-cell sequence numbers (D. Vyukov's bounded
+/// queue), so any number of threads can send, while one thread, e.g. the
+/// audio thread, calls executeUntil(). Messages are called in place.
+///
+/// Unlike MsgTube, there is no overflow cache: send() returns false and
+/// the message is dropped if the tube is full.
+///
+/// @ingroup allocore
+class MsgTubeMPSC {
+public:
+
+	typedef void (*msg_func)(al_sec t, char * args);
+
+	/// Maximum size of message arguments, in bytes
+	static const size_t argsSize = AL_MSGTUBEMPSC_CELL_SIZE - sizeof(size_t) - sizeof(al_sec) - sizeof(msg_func);
+
+	/// @param[in] bits		log2 of number of messages that can be pending
+	MsgTubeMPSC(int bits = 10);
+	~MsgTubeMPSC();
+
+	/// Get timestamp applied to sent messages
+	al_sec now() const { return mNow.load(std::memory_order_relaxed); }
+
+	/// Set timestamp applied to sent messages (should increase monotonically)
+	MsgTubeMPSC& now(al_sec t){ mNow.store(t, std::memory_order_relaxed); return *this; }
+
+	/// Call messages timestamped up to a time (reader only)
+
+	/// Messages are called in the order they were sent; this stops at the
+	/// first message later than 'until'.
+	void executeUntil(al_sec until);
+
+	/// Number of messages dropped because the tube was full
+	unsigned dropped() const { return mDropped.load(std::memory_order_relaxed); }
+
+	/// Generic method to send a message (any thread)
+
+	/// \returns false if the tube is full or the message too big
+	bool sched(msg_func func, const char * args, size_t size);
+
+	bool send(void (*f)(al_sec t)) {
+		struct Data {
+			void (*f)(al_sec t);
+			static void call(al_sec t, char * args) {
+				const Data * d = (Data *)args;
+				(d->f)(t);
+			}
+		};
+		Data data = { f };
+		return sched(&Data::call, (char *)(&data), sizeof(Data));
+	}
+
+	template<typename A1>
+	bool send(void (*f)(al_sec t, A1 a1), A1 a1) {
+		struct Data {
+			void (*f)(al_sec t, A1 a1);
+			A1 a1;
+			static void call(al_sec t, char * args) {
+				const Data * d = (Data *)args;
+				(d->f)(t, d->a1);
+			}
+		};
+		Data data = { f, a1 };
+		return sched(&Data::call, (char *)(&data), sizeof(Data));
+	}
+
+	template<typename A1, typename A2>
+	bool send(void (*f)(al_sec t, A1 a1, A2 a2), A1 a1, A2 a2) {
+		struct Data {
+			void (*f)(al_sec t, A1 a1, A2 a2);
+			A1 a1; A2 a2;
+			static void call(al_sec t, char * args) {
+				const Data * d = (Data *)args;
+				(d->f)(t, d->a1, d->a2);
+			}
+		};
+		Data data = { f, a1, a2 };
+		return sched(&Data::call, (char *)(&data), sizeof(Data));
+	}
+
+	template<typename A1, typename A2, typename A3>
+	bool send(void (*f)(al_sec t, A1 a1, A2 a2, A3 a3), A1 a1, A2 a2, A3 a3) {
+		struct Data {
+			void (*f)(al_sec t, A1 a1, A2 a2, A3 a3);
+			A1 a1; A2 a2; A3 a3;
+			static void call(al_sec t, char * args) {
+				const Data * d = (Data *)args;
+				(d->f)(t, d->a1, d->a2, d->a3);
+			}
+		};
+		Data data = { f, a1, a2, a3 };
+		return sched(&Data::call, (char *)(&data), sizeof(Data));
+	}
+
+	template<typename A1, typename A2, typename A3, typename A4>
+	bool send(void (*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4), A1 a1, A2 a2, A3 a3, A4 a4) {
+		struct Data {
+			void (*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4);
+			A1 a1; A2 a2; A3 a3; A4 a4;
+			static void call(al_sec t, char * args) {
+				const Data * d = (Data *)args;
+				(d->f)(t, d->a1, d->a2, d->a3, d->a4);
+			}
+		};
+		Data data = { f, a1, a2, a3, a4 };
+		return sched(&Data::call, (char *)(&data), sizeof(Data));
+	}
+
+	template<typename A1, typename A2, typename A3, typename A4, typename A5>
+	bool send(void (*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5), A1 a1, A2 a2, A3 a3, A4 a4, A5 a5) {
+		struct Data {
+			void (*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5);
+			A1 a1; A2 a2; A3 a3; A4 a4; A5 a5;
+			static void call(al_sec t, char * args) {
+				const Data * d = (Data *)args;
+				(d->f)(t, d->a1, d->a2, d->a3, d->a4, d->a5);
+			}
+		};
+		Data data = { f, a1, a2, a3, a4, a5 };
+		return sched(&Data::call, (char *)(&data), sizeof(Data));
+	}
+
+	template<typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
+	bool send(void (*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5, A6 a6), A1 a1, A2 a2, A3 a3, A4 a4, A5 a5, A6 a6) {
+		struct Data {
+			void (*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5, A6 a6);
+			A1 a1; A2 a2; A3 a3; A4 a4; A5 a5; A6 a6;
+			static void call(al_sec t, char * args) {
+				const Data * d = (Data *)args;
+				(d->f)(t, d->a1, d->a2, d->a3, d->a4, d->a5, d->a6);
+			}
+		};
+		Data data = { f, a1, a2, a3, a4, a5, a6 };
+		return sched(&Data::call, (char *)(&data), sizeof(Data));
+	}
+
+protected:
+
+	struct Cell {
+		std::atomic<size_t> seq;
+		al_sec t;
+		msg_func func;
+		char args[argsSize];
+	};
+
+	enum { CACHE_LINE = 64 };
+
+	Cell * mCells;
+	size_t mMask;
+	std::atomic<al_sec> mNow;
+	std::atomic<unsigned> mDropped;
+	char mPad0[CACHE_LINE];
+	std::atomic<size_t> mWritePos;	// shared by writers
+	char mPad1[CACHE_LINE];
+	size_t mReadPos;				// owned by reader
+	char mPad2[CACHE_LINE];
+};
+
 /*
 	Inline Implementation
 */
@@ -273,9 +440,18 @@ inline void MsgTube :: executeUntil(al_sec until) {
 		if (header.t > until) {
 			return;
 		}
-		char buf[header.size];
-		rb.read(buf, header.size);
-		(header.func)(buf);
+		SingleRWRingBuffer::Span a, b;
+		rb.peekRead(header.size, a, b);
+
+		// call in place if message is contiguous and aligned, otherwise copy
+		if (b.size == 0 && ((uintptr_t)a.data % sizeof(al_sec)) == 0) {
+			(header.func)(a.data);
+			rb.consume(header.size);
+		} else {
+			char buf[header.size];
+			rb.read(buf, header.size);
+			(header.func)(buf);
+		}
 	}
 }
 
@@ -306,6 +482,67 @@ inline void MsgTube :: send_data(void (*func)(al_sec t, char * data), char * dat
 }
 
 
+inline MsgTubeMPSC :: MsgTubeMPSC(int bits)
+:	mMask((size_t(1)<<bits) - 1),
+	mNow(0), mDropped(0), mWritePos(0), mReadPos(0)
+{
+	mCells = new Cell[mMask+1];
+	for (size_t i=0; i<=mMask; i++) {
+		mCells[i].seq.store(i, std::memory_order_relaxed);
+	}
+}
+
+inline MsgTubeMPSC :: ~MsgTubeMPSC() {
+	delete[] mCells;
+}
+
+inline bool MsgTubeMPSC :: sched(msg_func func, const char * args, size_t size) {
+	if (size > argsSize) {
+		AL_WARN("message too big for MsgTubeMPSC");
+		return false;
+	}
+
+	// claim a cell; its sequence equals the write position when it is free
+	size_t pos = mWritePos.load(std::memory_order_relaxed);
+	Cell * c;
+	for (;;) {
+		c = &mCells[pos & mMask];
+		size_t seq = c->seq.load(std::memory_order_acquire);
+		intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+		if (dif == 0) {
+			if (mWritePos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) break;
+		} else if (dif < 0) {
+			mDropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		} else {
+			pos = mWritePos.load(std::memory_order_relaxed);
+		}
+	}
+
+	c->t = now();
+	c->func = func;
+	memcpy(c->args, args, size);
+
+	// publish to reader
+	c->seq.store(pos+1, std::memory_order_release);
+	return true;
+}
+
+inline void MsgTubeMPSC :: executeUntil(al_sec until) {
+	for (;;) {
+		Cell& c = mCells[mReadPos & mMask];
+		if (c.seq.load(std::memory_order_acquire) != mReadPos+1) return;
+		if (c.t > until) return;
+
+		(c.func)(c.t, c.args);
+
+		// release cell to writers for the next lap
+		c.seq.store(mReadPos + mMask + 1, std::memory_order_release);
+		++mReadPos;
+	}
+}
+
+
 } // al::
 
 #endif /* include guard */
@@ -42,6 +42,7 @@
 	Graham Wakefield, 2010, grrrwaaa@gmail.com
 */
 
+#include <atomic>
 #include <cstring>
 
 #include "allocore/system/pstdint.h"
@@ -53,12 +54,27 @@ namespace al {
  * a reader, one a writer. There is no locking in this ring buffer,
  * so it is ideal to pass data to and from a high priority thread
  * like an audio thread.
+ *
+ * The read and write positions are atomics; the writer publishes data with
+ * release ordering and the reader acquires it, so data is never seen torn
+ * on weakly ordered CPUs. The positions are kept on separate cache lines.
+ *
+ * Besides copying with write() and read(), data can be accessed in place.
+ * The writer calls reserveWrite() to get up to two contiguous spans, fills
+ * them, then calls commitWrite(). The reader calls peekRead() to get up to
+ * two spans of readable data, then calls consume().
  */
 
 /// @ingroup allocore
 class SingleRWRingBuffer {
 public:
 
+	/// Contiguous region of ring buffer memory
+	struct Span {
+		char * data;
+		size_t size;
+	};
+
     /** Allocate ringbuffer.
         Actual size rounded up to next power of 2. */
 	SingleRWRingBuffer(size_t sz=256);
@@ -90,11 +106,47 @@ public:
 	*/
 	size_t peek(char * dst, size_t sz);
 
+	/** Get up to sz bytes of space for writing in place (writer only).
+		The space is returned as two spans; the second is only non-empty
+		when the space wraps around the end of the buffer.
+		Returns bytes reserved.
+	*/
+	size_t reserveWrite(size_t sz, Span& first, Span& second);
+
+	/** Make sz bytes of reserved space available to the reader (writer only).
+	*/
+	void commitWrite(size_t sz);
+
+	/** Get up to sz bytes of data for reading in place (reader only).
+		The data is returned as two spans; the second is only non-empty
+		when the data wraps around the end of the buffer.
+		Returns bytes available.
+	*/
+	size_t peekRead(size_t sz, Span& first, Span& second);
+
+	/** Release sz bytes of read data back to the writer (reader only).
+	*/
+	void consume(size_t sz);
+
 protected:
 
+	enum { CACHE_LINE = 64 };
+
 	size_t mSize, mWrap;
-	size_t mRead, mWrite;
 	char * mData;
+	char mPad0[CACHE_LINE];
+
+	// owned by writer
+	std::atomic<size_t> mWrite;
+	size_t mReadCache;			// last read position seen by writer
+	char mPad1[CACHE_LINE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+
+	// owned by reader
+	std::atomic<size_t> mRead;
+	size_t mWriteCache;			// last write position seen by reader
+	char mPad2[CACHE_LINE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+
+	size_t spans(size_t pos, size_t sz, Span& first, Span& second) const;
 };
 
 
@@ -111,8 +163,10 @@ inline uint32_t next_power_of_two(uint32_t v){
 inline SingleRWRingBuffer :: SingleRWRingBuffer(size_t sz)
 :	mSize(next_power_of_two(sz)),
 	mWrap(mSize-1),
+	mWrite(0),
+	mReadCache(0),
 	mRead(0),
-	mWrite(0)
+	mWriteCache(0)
 {
 	mData = new char[mSize];
 }
@@ -122,76 +176,85 @@ inline SingleRWRingBuffer :: ~SingleRWRingBuffer() {
 }
 
 inline size_t SingleRWRingBuffer :: writeSpace() const {
-	const size_t r = mRead;
-	const size_t w = mWrite;
-	if (r==w) return mWrap;
-	return ((mSize + (r - w)) & mWrap) - 1;
+	const size_t r = mRead.load(std::memory_order_acquire);
+	const size_t w = mWrite.load(std::memory_order_acquire);
+	return (r - w - 1) & mWrap;
 }
 
 inline size_t SingleRWRingBuffer :: readSpace() const {
-	const size_t r = mRead;
-	const size_t w = mWrite;
-	return (mSize + (w - r)) & mWrap;
+	const size_t r = mRead.load(std::memory_order_acquire);
+	const size_t w = mWrite.load(std::memory_order_acquire);
+	return (w - r) & mWrap;
 }
 
-inline size_t SingleRWRingBuffer :: write(const char * src, size_t sz) {
-	size_t space = writeSpace();
-	sz = sz > space ? space : sz;
-	if (sz == 0) return 0;
-
-	size_t w = mWrite;
-	size_t end = w + sz;
-
-	if (end < mSize) {
-		memcpy(mData+w, src, sz);
+inline size_t SingleRWRingBuffer :: spans(size_t pos, size_t sz, Span& first, Span& second) const {
+	const size_t split = mSize - pos;
+	first.data = mData + pos;
+	second.data = mData;
+	if (sz <= split) {
+		first.size = sz;
+		second.size = 0;
 	} else {
-		size_t split = mSize-w;
-		end &= mWrap;
-		memcpy(mData+w, src, split);
-		memcpy(mData, src+split, end);
+		first.size = split;
+		second.size = sz - split;
 	}
-
-	mWrite = end;
 	return sz;
 }
 
-inline size_t SingleRWRingBuffer :: read(char * dst, size_t sz) {
-	size_t space = readSpace();
-	sz = sz > space ? space : sz;
-	if (sz == 0) return 0;
+inline size_t SingleRWRingBuffer :: reserveWrite(size_t sz, Span& first, Span& second) {
+	const size_t w = mWrite.load(std::memory_order_relaxed);
+	size_t space = (mReadCache - w - 1) & mWrap;
+	if (space < sz) {
+		// acquire so reader is done with the space before it is overwritten
+		mReadCache = mRead.load(std::memory_order_acquire);
+		space = (mReadCache - w - 1) & mWrap;
+	}
+	return spans(w, sz > space ? space : sz, first, second);
+}
 
-	size_t r = mRead;
-	size_t end = r + sz;
+inline void SingleRWRingBuffer :: commitWrite(size_t sz) {
+	const size_t w = mWrite.load(std::memory_order_relaxed);
+	mWrite.store((w + sz) & mWrap, std::memory_order_release);
+}
 
-	if (end < mSize) {
-		memcpy(dst, mData+r, sz);
-	} else {
-		size_t split = mSize-r;
-		end &= mWrap;
-		memcpy(dst, mData+r, split);
-		memcpy(dst+split, mData, end);
+inline size_t SingleRWRingBuffer :: peekRead(size_t sz, Span& first, Span& second) {
+	const size_t r = mRead.load(std::memory_order_relaxed);
+	size_t space = (mWriteCache - r) & mWrap;
+	if (space < sz) {
+		// acquire so written data is visible
+		mWriteCache = mWrite.load(std::memory_order_acquire);
+		space = (mWriteCache - r) & mWrap;
 	}
+	return spans(r, sz > space ? space : sz, first, second);
+}
 
-	mRead = end;
-	return sz;
+inline void SingleRWRingBuffer :: consume(size_t sz) {
+	const size_t r = mRead.load(std::memory_order_relaxed);
+	mRead.store((r + sz) & mWrap, std::memory_order_release);
 }
 
-inline size_t SingleRWRingBuffer :: peek(char * dst, size_t sz) {
-	size_t space = readSpace();
-	sz = sz > space ? space : sz;
+inline size_t SingleRWRingBuffer :: write(const char * src, size_t sz) {
+	Span a, b;
+	sz = reserveWrite(sz, a, b);
 	if (sz == 0) return 0;
+	memcpy(a.data, src, a.size);
+	memcpy(b.data, src + a.size, b.size);
+	commitWrite(sz);
+	return sz;
+}
 
-	size_t r = mRead;
-	size_t end = r + sz;
+inline size_t SingleRWRingBuffer :: read(char * dst, size_t sz) {
+	sz = peek(dst, sz);
+	consume(sz);
+	return sz;
+}
 
-	if (end < mSize) {
-		memcpy(dst, mData+r, sz);
-	} else {
-		size_t split = mSize-r;
-		end &= mWrap;
-		memcpy(dst, mData+r, split);
-		memcpy(dst+split, mData, end);
-	}
+inline size_t SingleRWRingBuffer :: peek(char * dst, size_t sz) {
+	Span a, b;
+	sz = peekRead(sz, a, b);
+	if (sz == 0) return 0;
+	memcpy(dst, a.data, a.size);
+	memcpy(dst + a.size, b.data, b.size);
 	return sz;
 }
 
@@ -154,32 +154,32 @@ struct MRCHeader {
 class Voxels : public Array {
 public:
   Voxels() :
-      Array() {
+      Array(), m_swapped(false) {
     init(1,1,1, VOX_METERS);
   }
 
   /// Construct dimx x dimy x dimz voxel grid giving 3D size of each voxel cuboid with units
   Voxels(AlloTy ty, uint32_t dimx, uint32_t dimy, uint32_t dimz, float sizex, float sizey, float sizez, UnitsTy units) :
-       Array(1, ty, dimx, dimy, dimz) {
+       Array(1, ty, dimx, dimy, dimz), m_swapped(false) {
     init(sizex, sizey, sizez, units);
   }
 
 
   /// Construct dimx x dimy x dimz voxel grid giving 3D size of each voxel cuboid in meters
   Voxels(AlloTy ty, uint32_t dimx, uint32_t dimy, uint32_t dimz, float sizex, float sizey, float sizez) :
-      Array(1, ty, dimx, dimy, dimz) {
+      Array(1, ty, dimx, dimy, dimz), m_swapped(false) {
     init(sizex, sizey, sizez, VOX_METERS);
   }
 
   /// Construct dimx x dimy x dimz voxel grid giving dimension of each voxel cube with units
   Voxels(AlloTy ty, uint32_t dimx, uint32_t dimy, uint32_t dimz, float voxelsize, UnitsTy units) :
-      Array(1, ty, dimx, dimy, dimz) {
+      Array(1, ty, dimx, dimy, dimz), m_swapped(false) {
     init(voxelsize, voxelsize, voxelsize, units);
   }
 
   /// Construct dimx x dimy x dimz voxel grid with every voxel 1m x 1m x 1m
   Voxels(AlloTy ty, uint32_t dimx, uint32_t dimy, uint32_t dimz) :
-      Array(1, ty, dimx, dimy, dimz) {
+      Array(1, ty, dimx, dimy, dimz), m_swapped(false) {
     init(1, 1, 1, VOX_METERS);
   }
   
@@ -236,12 +236,33 @@ public:
 
   bool loadFromMRC(std::string filename, UnitsTy ty, float voxWidthX, float voxWidthY, float voxWidthZ);
 
+  /// Map data of MRC file rather than reading it into memory
+
+  /// Pages of the file are only read when first accessed. If the file has the
+  /// opposite byte order, prepareSlices() must be called before accessing data.
+  bool mapFromMRC(std::string filename);
+
+  /// Make slices [z0, z1) of mapped data ready for access
+
+  /// This swaps the byte order of slices that have not been accessed yet.
+  ///
+  void prepareSlices(uint32_t z0, uint32_t z1);
+
+  /// Returns true if mapped data has the opposite byte order of the machine
+  bool swapped() const { return m_swapped; }
+
   //functions for loading from images
   bool getdir(std::string dir, std::vector<std::string> &files);
 
   bool parseInfo(std::string dir, std::vector<std::string> &data);
 
   bool loadFromDirectory(std::string dir);
+
+  /// Load directory of images, caching the volume in a file
+
+  /// If the cache file exists, it is mapped and the images are not read.
+  /// Delete the cache file to have it rebuilt from the images.
+  bool loadFromDirectory(std::string dir, std::string cacheFile);
   
   //functions for slicing
   bool linePlaneIntersection(const Vec3f &P0, const Vec3f &P1, const Vec3f &planeCenter, const Vec3f &planeNormal, Vec3f* intersection);
@@ -266,6 +287,9 @@ public:
   bool writeToFile(std::string filename);
   
   bool loadFromFile(std::string filename);
+
+  /// Map data of file written by writeToFile() rather than reading it into memory
+  bool mapFromFile(std::string filename);
   
   void print(FILE * fp = stdout);
 
@@ -285,6 +309,11 @@ protected:
   UnitsTy m_units;
   float m_voxWidth[3];
   float m_min, m_max, m_mean, m_rms;
+  bool m_swapped;                   // mapped data has opposite byte order
+  std::vector<char> m_sliceReady;   // whether mapped slices have been swapped
+
+  // returns true if header byte order had to be swapped
+  static bool parseMRCHeader(MRCHeader& header, AlloTy& ty);
 };
 
 } // namespace al
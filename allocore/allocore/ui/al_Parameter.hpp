@@ -44,7 +44,10 @@
 #include <string>
 #include <mutex>
 #include <atomic>
+#include <cstring>
 #include <iostream>
+#include <type_traits>
+#include <vector>
 #include "allocore/protocol/al_OSC.hpp"
 
 namespace al
@@ -128,9 +131,10 @@ public:
    * @param min Minimum value for the parameter
    * @param max Maximum value for the parameter
    *
-   * The mechanism used to protect data is locking a mutex within the set() function
-   * and doing try_lock() on the mutex to update a cached value in the get()
-   * function. In the worst case this might incur some jitter when reading the value.
+   * Writers are serialized by a mutex. If ParameterType is trivially
+   * copyable, the value is published through a sequence lock, so get() never
+   * takes a lock and always returns the latest value. Otherwise get() does a
+   * try_lock() on the mutex and returns a cached value if it fails.
    */
 	ParameterWrapper(std::string parameterName, std::string group,
 	          ParameterType defaultValue,
@@ -236,6 +240,24 @@ public:
 	void registerChangeCallback(ParameterChangeCallback cb,
 	                           void *userData = nullptr);
 
+	/**
+	 * @brief set whether change callbacks are deferred
+	 *
+	 * When deferred, set() only records that the value has changed, and the
+	 * callbacks registered with registerChangeCallback() are called with the
+	 * latest value by processCallbacks(), on whichever thread calls it. This
+	 * keeps callbacks such as OSC notifications off the audio thread when the
+	 * parameter is set from there. Several changes between calls to
+	 * processCallbacks() result in a single call of each callback.
+	 */
+	void deferCallbacks(bool defer) { mDeferCallbacks = defer; }
+
+	/**
+	 * @brief call change callbacks deferred since the last call
+	 * @return whether the value had changed
+	 */
+	bool processCallbacks();
+
 	std::vector<ParameterWrapper<ParameterType> *> operator<< (ParameterWrapper<ParameterType> &newParam)
 	{ std::vector<ParameterWrapper<ParameterType> *> paramList;
 		paramList.push_back(&newParam);
@@ -258,10 +280,28 @@ protected:
 	void * mProcessUdata;
 	std::vector<ParameterChangeCallback> mCallbacks;
 	std::vector<void *> mCallbackUdata;
+	std::atomic<bool> mDeferCallbacks;
+	std::atomic<bool> mCallbacksPending;
+
+	// Call or defer the change callbacks
+	void changed(ParameterType value);
 
 private:
+	typedef std::integral_constant<bool, std::is_trivially_copyable<ParameterType>::value> Trivial;
+	static const int kNumWords = (sizeof(ParameterType) + sizeof(unsigned) - 1) / sizeof(unsigned);
+
+	void write(const ParameterType &value);
+	void write(const ParameterType &value, std::true_type trivial);
+	void write(const ParameterType &value, std::false_type trivial);
+	ParameterType read(std::true_type trivial);
+	ParameterType read(std::false_type trivial);
+
 	std::mutex mMutex;
-	ParameterType mValue;
+	std::atomic<unsigned> mSeq; // odd while a write is in progress
+	// Trivially copyable values are copied through atomic words, so that
+	// readers racing with a writer only ever access atomics
+	std::atomic<unsigned> mWords[kNumWords];
+	ParameterType mValue; // other values, guarded by mMutex
 	ParameterType mValueCache;
 	std::string mParameterName;
 	std::string mGroup;
@@ -272,9 +312,9 @@ private:
 /**
  * @brief The Parameter class
  *
- * The Parameter class offers a simple way to encapsulate float values. It is
- * not inherently thread safe, but since floats are atomic on most platforms
- * it is safe in practice.
+ * The Parameter class offers a simple way to encapsulate float values. The
+ * value is stored in an atomic, so it can be set and read from any thread
+ * without locking.
  *
  * Parameters are created with:
  * @code
@@ -293,6 +333,13 @@ private:
 	float curFreq = freq.get()
  * @endcode
  *
+ * To avoid zipper noise, the audio thread can instead get a smoothed value
+ * for each sample of the block:
+ * @code
+	// In the audio callback
+	const float * freqs = freq.block(io);
+ * @endcode
+ *
  * The values are clamped between a minimum and maximum set using the min() and
  * max() functions.
  *
@@ -315,8 +362,8 @@ public:
    * @param max Maximum value for the parameter
    *
    * This Parameter class is designed for parameters that can be expressed as a
-   * single float. It realies on float being atomic on the platform so there
-   * is no locking. This is a safe assumption for most platforms today.
+   * single float. The value is stored in a std::atomic<float>, so there is no
+   * locking.
    */
 	Parameter(std::string parameterName, std::string Group,
 	          float defaultValue,
@@ -353,8 +400,49 @@ public:
 
 	float operator= (const float value) { this->set(value); return value; }
 
+	/// How block() follows changes of the value
+	enum Smoothing {
+		NONE,		///< Step to new values at the start of the block
+		RAMP,		///< Ramp linearly to new values over a fixed time
+		ONE_POLE	///< Approach new values exponentially
+	};
+
+	/**
+	 * @brief set how block() smooths changes of the value
+	 * @param type The type of smoothing
+	 * @param timeSec The ramp time for RAMP or the time constant for ONE_POLE
+	 */
+	void smoothing(Smoothing type, float timeSec = 0.02f);
+
+	/**
+	 * @brief get the smoothed value for each frame of one block of audio
+	 * @param frames The number of frames in the block
+	 * @param framesPerSecond The sample rate
+	 * @return values for the block, valid until the next call
+	 *
+	 * This should be called once per block from a single thread, normally
+	 * the audio thread. It does not lock and only allocates memory when the
+	 * block size grows.
+	 */
+	const float * block(int frames, double framesPerSecond);
+
+	/// Get the smoothed value for each frame of an AudioIOData block
+	template <class AudioIOData>
+	const float * block(const AudioIOData &io) {
+		return block(io.framesPerBuffer(), io.fps());
+	}
+
+protected:
+	std::atomic<float> mFloatValue;
+
 private:
-	float mFloatValue;
+	Smoothing mSmoothing;
+	float mSmoothTime;
+	float mSmoothed;	// last value output by block()
+	float mRampTarget;
+	float mRampStep;
+	int mRampFrames;	// frames left in current ramp
+	std::vector<float> mBlock;
 };
 
 class ParameterBool : public Parameter
@@ -408,9 +496,6 @@ public:
 	virtual float get() override;
 
 	float operator= (const float value) { this->set(value); return value; }
-
-private:
-	float mFloatValue;
 };
 
 
@@ -451,6 +536,13 @@ public:
 
 	/**
 	 * Remove a parameter from the server.
+	 *
+	 * When this returns, no message being dispatched on other threads can
+	 * still reach the parameter. When called while this server dispatches a
+	 * message on the calling thread, e.g. from a parameter callback or an
+	 * OSC listener, the removal only applies to messages dispatched after
+	 * the current one, and the parameter must stay valid until the current
+	 * dispatch returns.
 	 */
 	void unregisterParameter(Parameter &param);
 
@@ -489,16 +581,42 @@ public:
 	 */
 	void registerOSCListener(osc::PacketHandler *handler);
 
+	/**
+	 * @brief Set parameters matching an OSC address or address pattern
+	 * @return the number of parameters set
+	 *
+	 * This is what onMessage() does with messages carrying a single float.
+	 * Addresses without wildcards are looked up in a hash table; patterns
+	 * are matched one path segment at a time against a trie of the
+	 * registered addresses. See osc::matchPattern() for the supported
+	 * wildcards.
+	 */
+	int setParameters(const std::string &address, float value);
+
 	virtual void onMessage(osc::Message& m);
 
 protected:
 	static void changeCallback(float value, void *sender, void *userData, void *blockThis);
 
 private:
+	// Immutable snapshot of the parameters and handlers used for dispatch.
+	// It is rebuilt when parameters or handlers change, so that messages
+	// are dispatched without taking mParameterLock.
+	struct AddressIndex;
+
+	// Counts a dispatch with mIndex in mReaders and on the calling thread
+	struct Dispatch;
+
+	void updateIndex();
+
 	std::vector<osc::PacketHandler *> mPacketHandlers;
 	osc::Recv *mServer;
 	std::vector<Parameter *> mParameters;
 	std::mutex mParameterLock;
+	std::atomic<AddressIndex *> mIndex;
+	std::atomic<bool> mIndexDirty;
+	std::atomic<int> mReaders; // threads dispatching with mIndex
+	std::vector<AddressIndex *> mRetired; // old indices possibly in use
 };
 
 
@@ -513,7 +631,8 @@ template<class ParameterType>
 ParameterWrapper<ParameterType>::ParameterWrapper(std::string parameterName, std::string group,
           ParameterType defaultValue,
           std::string prefix) :
-    mParameterName(parameterName), mGroup(group), mPrefix(prefix), mProcessCallback(nullptr)
+    mParameterName(parameterName), mGroup(group), mPrefix(prefix), mProcessCallback(nullptr),
+    mDeferCallbacks(false), mCallbacksPending(false), mSeq(0)
 {
 
 	//TODO: Add better heuristics for slash handling
@@ -535,7 +654,7 @@ ParameterWrapper<ParameterType>::ParameterWrapper(std::string parameterName, std
 		mFullAddress = "/";
 	}
 	mFullAddress += mParameterName;
-	mValue = defaultValue;
+	write(defaultValue);
 	mValueCache = defaultValue;
 }
 
@@ -558,14 +677,8 @@ void ParameterWrapper<ParameterType>::set(ParameterType value)
 	if (mProcessCallback) {
 		value = mProcessCallback(value, mProcessUdata);
 	}
-	mMutex.lock();
-	mValue = value;
-	mMutex.unlock();
-	for(int i = 0; i < mCallbacks.size(); ++i) {
-		if (mCallbacks[i]) {
-			mCallbacks[i](value, (void *) this,  mCallbackUdata[i], NULL);
-		}
-	}
+	write(value);
+	changed(value);
 }
 
 template<class ParameterType>
@@ -584,13 +697,69 @@ void ParameterWrapper<ParameterType>::setNoCalls(ParameterType value, void *bloc
 			}
 		}
 	}
+	write(value);
+}
+
+template<class ParameterType>
+ParameterType ParameterWrapper<ParameterType>::get()
+{
+	return read(Trivial());
+}
+
+template<class ParameterType>
+void ParameterWrapper<ParameterType>::write(const ParameterType &value)
+{
+	write(value, Trivial());
+}
+
+template<class ParameterType>
+void ParameterWrapper<ParameterType>::write(const ParameterType &value, std::true_type)
+{
+	unsigned words[kNumWords] = {};
+	std::memcpy((void *) words, (const void *) &value, sizeof(ParameterType));
+	mMutex.lock(); // serializes writers
+	mSeq.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (int i = 0; i < kNumWords; ++i) {
+		mWords[i].store(words[i], std::memory_order_relaxed);
+	}
+	mSeq.fetch_add(1, std::memory_order_release);
+	mMutex.unlock();
+}
+
+template<class ParameterType>
+void ParameterWrapper<ParameterType>::write(const ParameterType &value, std::false_type)
+{
 	mMutex.lock();
 	mValue = value;
 	mMutex.unlock();
 }
 
 template<class ParameterType>
-ParameterType ParameterWrapper<ParameterType>::get()
+ParameterType ParameterWrapper<ParameterType>::read(std::true_type)
+{
+	// Copy the words and retry if a write happened meanwhile
+	unsigned words[kNumWords];
+	for (;;) {
+		unsigned seq = mSeq.load(std::memory_order_acquire);
+		if (seq & 1) {
+			continue;
+		}
+		for (int i = 0; i < kNumWords; ++i) {
+			words[i] = mWords[i].load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (mSeq.load(std::memory_order_relaxed) == seq) {
+			break;
+		}
+	}
+	ParameterType value;
+	std::memcpy((void *) &value, (const void *) words, sizeof(ParameterType));
+	return value;
+}
+
+template<class ParameterType>
+ParameterType ParameterWrapper<ParameterType>::read(std::false_type)
 {
 	if (mMutex.try_lock()) {
 		mValueCache = mValue;
@@ -599,6 +768,35 @@ ParameterType ParameterWrapper<ParameterType>::get()
 	return mValueCache;
 }
 
+template<class ParameterType>
+void ParameterWrapper<ParameterType>::changed(ParameterType value)
+{
+	if (mDeferCallbacks) {
+		mCallbacksPending = true;
+		return;
+	}
+	for(int i = 0; i < mCallbacks.size(); ++i) {
+		if (mCallbacks[i]) {
+			mCallbacks[i](value, (void *) this,  mCallbackUdata[i], NULL);
+		}
+	}
+}
+
+template<class ParameterType>
+bool ParameterWrapper<ParameterType>::processCallbacks()
+{
+	if (!mCallbacksPending.exchange(false)) {
+		return false;
+	}
+	ParameterType value = get();
+	for(int i = 0; i < mCallbacks.size(); ++i) {
+		if (mCallbacks[i]) {
+			mCallbacks[i](value, (void *) this,  mCallbackUdata[i], NULL);
+		}
+	}
+	return true;
+}
+
 template<class ParameterType>
 std::string ParameterWrapper<ParameterType>::getFullAddress()
 {
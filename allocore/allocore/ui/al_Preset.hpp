@@ -44,12 +44,15 @@
 #include <vector>
 #include <mutex>
 #include <map>
+#include <memory>
 #include <thread>
+#include <type_traits>
 #include <atomic>
 #include <condition_variable>
 
 #include "allocore/ui/al_Parameter.hpp"
 #include "allocore/system/al_Time.hpp"
+#include "allocore/types/al_Array.hpp"
 
 namespace  al
 {
@@ -57,7 +60,11 @@ namespace  al
 /**
  * @brief The PresetHandler class handles sorting and recalling of presets.
  *
- * Presets are saved by name with the ".preset" suffix.
+ * Presets are saved by name with the ".preset" suffix. Preset values are kept
+ * in an in-memory cache keyed by preset index, as one float per registered
+ * parameter, so a preset file is only read the first time it is used. All
+ * presets of a directory can also be stored in a single binary bank file
+ * (see storeBank() and loadBank()).
  */
 class PresetHandler
 {
@@ -126,8 +133,90 @@ public:
 	void setMorphTime(float time);
 	void stopMorph();
 
+	/// Shape of the transition from start to target values during a morph
+	enum MorphCurve {
+		LINEAR,			///< Constant rate of change
+		EXPONENTIAL,	///< Slow start, fast end
+		S_CURVE			///< Slow start and end
+	};
+
+	/** @brief Set the shape of the transition of subsequent morph steps */
+	void setMorphCurve(MorphCurve curve) { mMorphCurve = curve; }
+	MorphCurve getMorphCurve() { return MorphCurve(mMorphCurve.load()); }
+
+	/**
+	 * @brief Get the progress of the current morph
+	 * @return 0 at the start values, 1 when the target is reached
+	 *
+	 * This does not lock and can be polled from any thread.
+	 */
+	float getMorphProgress() { return mMorphProgress.load(); }
+
+	/**
+	 * @brief Advance morphs from stepMorph() instead of the morphing thread
+	 * @param external if true, morphs only progress when stepMorph() is called
+	 */
+	void setExternalMorphClock(bool external);
+
+	/**
+	 * @brief Advance the current morph
+	 * @param seconds time since the previous step
+	 *
+	 * Call this once per block from the audio callback, after
+	 * setExternalMorphClock(true), to time morphs to the sample block. It
+	 * does not allocate or wait: while a new target is being set, the time is
+	 * added to the next step. Parameter change callbacks run on the calling
+	 * thread, unless the parameters defer them.
+	 */
+	void stepMorph(double seconds);
+
+	/// Advance the current morph by the duration of an AudioIOData block
+	template <class AudioIOData>
+	typename std::enable_if<!std::is_arithmetic<AudioIOData>::value>::type
+	stepMorph(const AudioIOData &io) {
+		stepMorph(io.framesPerBuffer() / io.fps());
+	}
+
 	void setSubDirectory(std::string directory);
 
+	/**
+	 * @brief Load presets neighbouring a recalled preset in the background
+	 * @param neighbours number of presets on either side of the recalled
+	 * index to load into the cache. 0 disables prefetching.
+	 */
+	void setPrefetch(int neighbours) { mPrefetch = neighbours; }
+
+	/**
+	 * @brief Forget all cached preset values
+	 *
+	 * Presets are read again from the bank or their preset files the next
+	 * time they are used. Call this if preset files are changed externally.
+	 */
+	void clearCache();
+
+	/**
+	 * @brief Store all presets in the current path in a binary bank file
+	 * @param fileName name of the bank file within getCurrentPath()
+	 * @return true on success
+	 *
+	 * The bank holds the addresses of the registered parameters, the index
+	 * and name of each preset, and a table of float values with one row per
+	 * preset. Preset files are not modified.
+	 */
+	bool storeBank(std::string fileName = "_presetBank.bin");
+
+	/**
+	 * @brief Use the presets from a binary bank file
+	 * @param fileName name of the bank file within getCurrentPath()
+	 * @return true on success
+	 *
+	 * The value table of the bank is mapped into memory and rows are read as
+	 * presets are used. Values are matched to registered parameters by
+	 * address. The index and name of each preset in the bank are added to the
+	 * preset map.
+	 */
+	bool loadBank(std::string fileName = "_presetBank.bin");
+
 	std::vector<std::string> availableSubDirectories();
 
 	std::string getCurrentPath();
@@ -160,7 +249,27 @@ public:
 private:
 	void loadPresetMap();
 	void storePresetMap();
-	std::map<std::string, float> loadPresetValues(std::string name);
+
+	// Values aligned with mParameters; NaN where a preset has no value
+	typedef std::shared_ptr<const std::vector<float> > Values;
+	// Reads a preset file using only its arguments, so it can run on any thread
+	static Values readPresetFile(const std::string &fileName,
+	                             const std::vector<std::string> &addresses,
+	                             bool verbose);
+	std::string presetFileName(const std::string &name);
+	std::vector<std::string> parameterAddresses();
+	Values loadPresetValues(const std::string &name);
+	Values presetValues(int index, const std::string &name);
+	// Cached or bank values; null if none, generation is set to the current one
+	Values cachedPresetValues(int index, unsigned &generation);
+	// Caches values read since generation unless the cache was invalidated
+	Values cachePresetValues(int index, unsigned generation, Values values);
+	int presetIndex(const std::string &name);
+	void prefetchNeighbours(int index);
+	void mapBankColumns();
+
+	void startMorph(std::vector<float> &target, float duration);
+	void advanceMorph(double seconds);
 
 	static void morphingFunction(PresetHandler *handler);
 
@@ -172,13 +281,22 @@ private:
 	std::mutex mFileLock;
 	bool mRunning; // To keep the morphing thread alive
 	bool mMorph; // To be able to trip and stop morphing at any time.
-	std::atomic<int> mMorphRemainingSteps;
 	float mMorphInterval;
 	Parameter mMorphTime;
 
 	std::mutex mTargetLock;
 	std::condition_variable mMorphConditionVar;
-	std::map<std::string, float> mTargetValues;
+	std::vector<float> mTargetValues;
+	// State of the current morph, guarded by mTargetLock
+	bool mMorphing;
+	double mMorphDuration;
+	double mMorphElapsed;
+	double mMorphPending; // time of skipped stepMorph() calls, not guarded
+	std::vector<float> mMorphStart;
+	std::vector<float> mMorphValues;
+	std::atomic<float> mMorphProgress;
+	std::atomic<int> mMorphCurve;
+	std::atomic<bool> mExternalClock;
 
 	std::thread mMorphingThread;
 
@@ -187,6 +305,17 @@ private:
 
 	std::map<int, std::string> mPresetsMap;
 	std::string mCurrentPresetName;
+
+	std::mutex mCacheLock;
+	std::map<int, Values> mCache;
+	unsigned mCacheGeneration; // changes when cached values become invalid
+	int mPrefetch;
+	std::atomic<int> mPrefetching;
+
+	Array mBank; // mapped table of values, one row per preset
+	std::map<int, int> mBankRows; // preset index to bank row
+	std::vector<std::string> mBankAddresses;
+	std::vector<int> mBankColumns; // bank column of each parameter, or -1
 };
 
 class PresetServer : public osc::PacketHandler, public OSCNotifier<>
@@ -77,7 +77,7 @@ inline void perSample(AudioIOData& io){
 			srcs[i].writeSample(smp);
 			srcs[i].pos(x, y, srcElev + z - 0.5);
 //			smp = srcs[i].attenuation(pos.mag())*smp;
-			panner->perform(io,srcs[i],pos,BLOCK_SIZE,j,smp);
+			panner->perform(io,srcs[i],i,pos,BLOCK_SIZE,j,smp);
 		}
 		++t;
 	}
@@ -326,6 +326,8 @@ int main (int argc, char * argv[]){
 		srcs[i].dopplerType(DOPPLER_NONE);
 		scene.addSource(srcs[i]);
 	}
+	// perSample() calls the panner directly, indexing sources as the scene does
+	panner->numSources(NUM_SOURCES);
 
 	scene.usePerSampleProcessing(perSampProcessing);
 	panner->setEnabled(true);
@@ -330,7 +330,8 @@ Isosurface::NoVertexAction Isosurface::noVertexAction;
 
 Isosurface::Isosurface(float lev, VertexAction& va)
 :	mIsolevel(lev), mVertexAction(&va),
-	mValidSurface(false), mComputeNormals(true), mNormalize(true), mInBox(false)
+	mValidSurface(false), mSurfaceID(0), mComputeNormals(true), mNormalize(true), mInBox(false),
+	mThreads(1)
 {
 	cellLengths(1);
 	fieldDims(0);
@@ -371,21 +372,33 @@ Compression pass:
 
 */
 
+// Lower corner (x,y,z) and direction (x=0,y=1,z=2) of each edge
+static const char sEdgeLowerCorner[12][4] = {
+	{0,0,0,1}, {0,1,0,0}, {1,0,0,1}, {0,0,0,0},
+	{0,0,1,1}, {0,1,1,0}, {1,0,1,1}, {0,0,1,0},
+	{0,0,0,2}, {0,1,0,2}, {1,1,0,2}, {1,0,0,2}
+};
+
+// Get isosurface cell index depending on field values at corners of cell
+static inline int cellIndex(const float * vals, float level){
+	int idx = 0;
+	if(vals[0] < level) idx |=   1;
+	if(vals[2] < level) idx |=   2;
+	if(vals[3] < level) idx |=   4;
+	if(vals[1] < level) idx |=   8;
+	if(vals[4] < level) idx |=  16;
+	if(vals[6] < level) idx |=  32;
+	if(vals[7] < level) idx |=  64;
+	if(vals[5] < level) idx |= 128;
+	return idx;
+}
+
 void Isosurface::addCell(const int * cellIdx3, const float * vals){
 	const int &ix = cellIdx3[0];
 	const int &iy = cellIdx3[1];
 	const int &iz = cellIdx3[2];
 
-	// Get isosurface cell index depending on field values at corners of cell
-	int idx = 0;
-	if(vals[0] < level()) idx |=   1;
-	if(vals[2] < level()) idx |=   2;
-	if(vals[3] < level()) idx |=   4;
-	if(vals[1] < level()) idx |=   8;
-	if(vals[4] < level()) idx |=  16;
-	if(vals[6] < level()) idx |=  32;
-	if(vals[7] < level()) idx |=  64;
-	if(vals[5] < level()) idx |= 128;
+	int idx = cellIndex(vals, level());
 
 	// Create a triangulation of the isosurface in this cell
 	const int edgeCode = sEdgeTable[idx];
@@ -468,6 +481,352 @@ void Isosurface::addEdgeVertex(int ix, int iy, int iz, int cellID, int edgeNo, c
 };
 
 
+/*
+Slab pass (generate):
+
+	The cell layers are split into slabs of whole bricks. Each slab is
+	extracted into its own vertex and index buffers, going down in z like the
+	serial pass. Edge vertices are looked up in dense arrays covering the x and
+	y edges of the two field slices bounding the current layer and the z edges
+	in between. When moving down a layer, the upper slice is cleared and
+	becomes the lower one.
+
+	Slabs are then appended to the mesh from the top down. Vertices on the
+	plane shared with the slab above are mapped onto those of the slab above,
+	so the mesh is the same as one produced by calling addCell() in order.
+*/
+
+int Isosurface::beginSlabs(){
+	mValidSurface = false;
+	++mSurfaceID;
+	reset();
+
+	const int Cz = mNF[2]-1;
+	if(mNF[0] < 2 || mNF[1] < 2 || Cz < 1){
+		mSlabs.clear();
+		return 0;
+	}
+
+	const int brickLayers = (Cz + brickSize-1)/brickSize;
+	const int n = std::min(mThreads, brickLayers);
+	mSlabs.resize(n);
+	for(int i=0; i<n; ++i){
+		Slab& s = mSlabs[i];
+		s.z0 = (brickLayers* i   /n)*brickSize;
+		s.z1 = std::min((brickLayers*(i+1)/n)*brickSize, Cz);
+	}
+	return n;
+}
+
+
+static void saveTop(std::vector<int>& top, const std::vector<int>& touched, const std::vector<int> * plane){
+	top.clear();
+	for(unsigned i=0; i<touched.size(); ++i){
+		int e = touched[i];
+		top.push_back(e);
+		top.push_back(plane[e&1][e>>1]);
+	}
+}
+
+void Isosurface::beginLayer(Slab& s, int z){
+
+	// First layer; reset everything
+	if(z == s.z1-1){
+		const int Nxy = mNF[0]*mNF[1];
+		for(int p=0; p<2; ++p){
+			for(int d=0; d<2; ++d) s.planes[p][d].assign(Nxy, -1);
+		}
+		s.zEdges.assign(Nxy, -1);
+		for(int i=0; i<3; ++i) s.touched[i].clear();
+		s.top.clear();
+		s.vertices.clear();
+		s.indices.clear();
+		s.lower = 0;
+		return;
+	}
+
+	const int upper = 1 - s.lower;
+
+	// Leaving first layer, so remember vertices shared with slab above
+	if(z == s.z1-2) saveTop(s.top, s.touched[upper], s.planes[upper]);
+
+	std::vector<int>& touched = s.touched[upper];
+	for(unsigned i=0; i<touched.size(); ++i){
+		int e = touched[i];
+		s.planes[upper][e&1][e>>1] = -1;
+	}
+	touched.clear();
+
+	for(unsigned i=0; i<s.touched[2].size(); ++i) s.zEdges[s.touched[2][i]] = -1;
+	s.touched[2].clear();
+
+	s.lower = upper;
+}
+
+
+void Isosurface::addSlabCell(Slab& s, int x, int y, int z, const float * vals){
+
+	const int idx = cellIndex(vals, level());
+	const int edgeCode = sEdgeTable[idx];
+	if(!edgeCode) return;
+
+	const int Nx = mNF[0];
+	const int upper = 1 - s.lower;
+	int verts[12];
+
+	for(int e=0; e<12; ++e){
+		if(!(edgeCode & (1<<e))) continue;
+
+		const char * c = sEdgeLowerCorner[e];
+		int i = (x+c[0]) + (y+c[1])*Nx;
+		int * slot;
+		int plane;
+		if(c[3] == 2){
+			slot = &s.zEdges[i];
+			plane = 2;
+		}
+		else{
+			plane = c[2] ? upper : s.lower;
+			slot = &s.planes[plane][c[3]][i];
+			i = 2*i + c[3];
+		}
+
+		if(*slot < 0){
+			EdgeVertex ev = calcIntersection(x,y,z, e, vals);
+			ev.pos[0] = x;
+			ev.pos[1] = y;
+			ev.pos[2] = z;
+			*slot = s.vertices.size();
+			s.vertices.push_back(ev);
+			s.touched[plane].push_back(i);
+		}
+		verts[e] = *slot;
+	}
+
+	for(int i=1; i <= sTriTable[idx][0]; i+=3){
+		s.indices.push_back(verts[sTriTable[idx][i+2]]);
+		s.indices.push_back(verts[sTriTable[idx][i+1]]);
+		s.indices.push_back(verts[sTriTable[idx][i  ]]);
+	}
+}
+
+
+void Isosurface::endSlabs(){
+
+	const int n = mSlabs.size();
+
+	// Append slabs farthest first to support transparency
+	for(int k=n-1; k>=0; --k){
+		Slab& s = mSlabs[k];
+
+		if(s.z1 - s.z0 == 1) saveTop(s.top, s.touched[1-s.lower], s.planes[1-s.lower]);
+
+		s.remap.assign(s.vertices.size(), -1);
+
+		// Vertices on plane shared with slab above already are in mesh
+		if(k+1 < n){
+			const Slab& a = mSlabs[k+1];
+			for(unsigned i=0; i<s.top.size(); i+=2){
+				int e = s.top[i];
+				s.remap[s.top[i+1]] = a.remap[a.planes[a.lower][e&1][e>>1]];
+			}
+		}
+
+		for(unsigned i=0; i<s.vertices.size(); ++i){
+			if(s.remap[i] < 0){
+				const EdgeVertex& ev = s.vertices[i];
+				s.remap[i] = Mesh::vertices().size();
+				Mesh::vertex(ev.x, ev.y, ev.z);
+				(*mVertexAction)(ev, *this);
+			}
+		}
+
+		for(unsigned i=0; i<s.indices.size(); ++i){
+			Mesh::index(s.remap[s.indices[i]]);
+		}
+	}
+
+	primitive(Graphics::TRIANGLES); // must be set for proper normal generation
+	if(mComputeNormals) generateNormals(mNormalize);
+	mValidSurface = true;
+}
+
+
+BrickedIsosurface::BrickedIsosurface(int brickDim, float lev, VertexAction& va)
+:	Isosurface(lev, va), mBrickDim(brickDim<1 ? 1 : brickDim), mBrickLevel(lev),
+	mMergedID(0)
+{
+	for(int i=0; i<3; ++i){ mNB[i]=0; mDims[i]=0; }
+}
+
+
+BrickedIsosurface& BrickedIsosurface::dirty(int x0, int y0, int z0, int x1, int y1, int z1){
+	if(mBricks.empty()) return *this;
+
+	// Field points touch cells to both sides of them
+	const int lo[3] = { x0-1, y0-1, z0-1 };
+	const int hi[3] = { x1, y1, z1 };
+	int b0[3], b1[3];
+	for(int i=0; i<3; ++i){
+		b0[i] = std::max(lo[i], 0) / mBrickDim;
+		b1[i] = std::min(hi[i], mDims[i]-2) / mBrickDim;
+		if(hi[i] < 0 || b0[i] > b1[i]) return *this;
+	}
+
+	for(int bz=b0[2]; bz<=b1[2]; ++bz){
+	for(int by=b0[1]; by<=b1[1]; ++by){
+	for(int bx=b0[0]; bx<=b1[0]; ++bx){
+		mBricks[(bz*mNB[1] + by)*mNB[0] + bx].dirty = true;
+	}}}
+	return *this;
+}
+
+
+BrickedIsosurface& BrickedIsosurface::dirty(){
+	for(unsigned i=0; i<mBricks.size(); ++i) mBricks[i].dirty = true;
+	return *this;
+}
+
+
+int BrickedIsosurface::beginUpdate(){
+
+	// New field dimensions require all new bricks
+	if(mDims[0]!=mNF[0] || mDims[1]!=mNF[1] || mDims[2]!=mNF[2]){
+		int n = 1;
+		for(int i=0; i<3; ++i){
+			mDims[i] = mNF[i];
+			mNB[i] = mNF[i] < 2 ? 0 : (mNF[i]-1 + mBrickDim-1)/mBrickDim;
+			n *= mNB[i];
+		}
+		mBricks.clear();
+		mBricks.resize(n);
+		dirty();
+	}
+
+	// Find bricks whose triangulation may have changed
+	const float lev0 = mBrickLevel;
+	const float lev1 = level();
+	mUpdated.clear();
+	for(unsigned i=0; i<mBricks.size(); ++i){
+		const Brick& b = mBricks[i];
+		if(b.dirty
+			|| (lev0 != lev1 && (
+				(b.min < lev0 && b.max >= lev0) ||
+				(b.min < lev1 && b.max >= lev1)
+			))
+		){
+			mUpdated.push_back(i);
+		}
+	}
+	mBrickLevel = lev1;
+
+	const int n = std::min<int>(mThreads, mUpdated.size());
+	if(int(mCaches.size()) < n) mCaches.resize(n);
+	const int D = mBrickDim+1;
+	for(int i=0; i<n; ++i){
+		BrickCache& c = mCaches[i];
+		if(int(c.edges.size()) != 3*D*D*D) c.edges.assign(3*D*D*D, -1);
+	}
+	return n;
+}
+
+
+void BrickedIsosurface::addBrickCell(Brick& b, BrickCache& c, int x, int y, int z, const float * vals){
+
+	const int idx = cellIndex(vals, level());
+	const int edgeCode = sEdgeTable[idx];
+	if(!edgeCode) return;
+
+	const int D = mBrickDim+1;
+	const int cID = cellID(x,y,z);
+	int verts[12];
+
+	for(int e=0; e<12; ++e){
+		if(!(edgeCode & (1<<e))) continue;
+
+		const char * corner = sEdgeLowerCorner[e];
+		int l[3] = {
+			x - c.origin[0] + corner[0],
+			y - c.origin[1] + corner[1],
+			z - c.origin[2] + corner[2]
+		};
+		int k = 3*(l[0] + D*(l[1] + D*l[2])) + corner[3];
+		int& slot = c.edges[k];
+
+		if(slot < 0){
+			EdgeVertex ev = calcIntersection(x,y,z, e, vals);
+			ev.pos[0] = x;
+			ev.pos[1] = y;
+			ev.pos[2] = z;
+			slot = b.vertices.size();
+			b.vertices.push_back(ev);
+			c.touched.push_back(k);
+
+			// Edges on brick faces are also found by neighboring bricks
+			bool onFace = false;
+			for(int i=0; i<3; ++i){
+				if(i == corner[3]) continue;
+				int extent = std::min(mBrickDim, mNF[i]-1 - c.origin[i]);
+				if(l[i] == 0 || l[i] == extent) onFace = true;
+			}
+			b.shared.push_back(onFace ? edgeID(cID, e) : -1);
+		}
+		verts[e] = slot;
+	}
+
+	for(int i=1; i <= sTriTable[idx][0]; i+=3){
+		b.indices.push_back(verts[sTriTable[idx][i+2]]);
+		b.indices.push_back(verts[sTriTable[idx][i+1]]);
+		b.indices.push_back(verts[sTriTable[idx][i  ]]);
+	}
+}
+
+
+void BrickedIsosurface::endUpdate(){
+
+	// Mesh is still current, unless generate() or begin() has since replaced it
+	if(mUpdated.empty() && validSurface() && mMergedID == mSurfaceID) return;
+
+	mValidSurface = false;
+	mMergedID = ++mSurfaceID;
+	reset();
+	mEdgeToVertex.clear();
+
+	// Merge bricks farthest first to support transparency
+	for(int bz=mNB[2]-1; bz>=0; --bz){
+	for(int by=0; by<mNB[1]; ++by){
+	for(int bx=0; bx<mNB[0]; ++bx){
+		const Brick& b = mBricks[(bz*mNB[1] + by)*mNB[0] + bx];
+
+		mRemap.resize(b.vertices.size());
+		for(unsigned i=0; i<b.vertices.size(); ++i){
+			int edge = b.shared[i];
+			if(edge >= 0){
+				EdgeToVertex::iterator it = mEdgeToVertex.find(edge);
+				if(it != mEdgeToVertex.end()){
+					mRemap[i] = it->second;
+					continue;
+				}
+				mEdgeToVertex[edge] = Mesh::vertices().size();
+			}
+			const EdgeVertex& ev = b.vertices[i];
+			mRemap[i] = Mesh::vertices().size();
+			Mesh::vertex(ev.x, ev.y, ev.z);
+			(*mVertexAction)(ev, *this);
+		}
+
+		for(unsigned i=0; i<b.indices.size(); ++i){
+			Mesh::index(mRemap[b.indices[i]]);
+		}
+	}}}
+
+	mEdgeToVertex.clear();
+	primitive(Graphics::TRIANGLES); // must be set for proper normal generation
+	if(mComputeNormals) generateNormals(mNormalize);
+	mValidSurface = true;
+}
+
+
 Isosurface::EdgeVertex
 Isosurface::calcIntersection(int ix, int iy, int iz, int edgeNo, const float * vals) const{
 
@@ -523,6 +882,7 @@ Isosurface::calcIntersection(int ix, int iy, int iz, int edgeNo, const float * v
 
 void Isosurface::begin(){
 	mValidSurface = false;
+	++mSurfaceID;
 	reset();
 }
 
@@ -368,6 +368,12 @@ size_t Socket::send(const char * buffer, size_t len) {
 	return mImpl->send(buffer, len);
 }
 
+int Socket::sendBatch(const char * const * buffers, const size_t * lengths, int count){
+	int sent = 0;
+	while(sent < count && send(buffers[sent], lengths[sent]) == lengths[sent]) ++sent;
+	return sent;
+}
+
 bool Socket::listen(){
 	return mImpl->listen();
 }
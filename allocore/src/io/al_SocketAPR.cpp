@@ -27,7 +27,9 @@ You can actually use connect() on UDP socket as an option. In that case, you can
 
 #include "../private/al_ImplAPR.h"
 #if defined(AL_LINUX)
+#include <sys/socket.h> // sendmmsg
 #include "apr-1.0/apr_network_io.h"
+#include "apr-1.0/apr_portable.h"
 #else
 #include "apr-1/apr_network_io.h"
 #endif
@@ -317,6 +319,39 @@ size_t Socket::send(const char * buffer, size_t len) {
 	return size;
 }
 
+int Socket::sendBatch(const char * const * buffers, const size_t * lengths, int count){
+	if(!mImpl->opened()) return 0;
+	int sent = 0;
+
+	#if defined(AL_LINUX)
+	apr_os_sock_t fd;
+	if(APR_SUCCESS == apr_os_sock_get(&fd, mImpl->mSock)){
+		static const int maxBatch = 64;
+		struct mmsghdr msgs[maxBatch];
+		struct iovec iovs[maxBatch];
+		while(sent < count){
+			int n = count - sent;
+			if(n > maxBatch) n = maxBatch;
+			memset(msgs, 0, sizeof(msgs[0])*n);
+			for(int i=0; i<n; ++i){
+				iovs[i].iov_base = (void *)buffers[sent+i];
+				iovs[i].iov_len = lengths[sent+i];
+				msgs[i].msg_hdr.msg_iov = &iovs[i];
+				msgs[i].msg_hdr.msg_iovlen = 1;
+			}
+			int r = sendmmsg(fd, msgs, n, 0);
+			// APR emulates timeouts on non-blocking sockets, so leave the
+			// rest to send() if this would block
+			if(r <= 0) break;
+			sent += r;
+		}
+	}
+	#endif
+
+	while(sent < count && send(buffers[sent], lengths[sent]) == lengths[sent]) ++sent;
+	return sent;
+}
+
 
 std::string Socket::hostIP(){
 	ImplAPR apr;
@@ -2,6 +2,7 @@
 #include <stdio.h> // printf
 #include <string.h>
 #include "allocore/system/al_Printing.hpp"
+#include "allocore/system/al_Time.hpp"
 #include "allocore/protocol/al_OSC.hpp"
 
 #include "oscpack/osc/OscOutboundPacketStream.h"
@@ -174,6 +175,177 @@ int Packet::size() const { return mImpl->Size(); }
 
 
 
+// OSC data is big-endian
+static void put32(char * p, uint32_t v){
+	p[0] = char(v>>24); p[1] = char(v>>16); p[2] = char(v>>8); p[3] = char(v);
+}
+
+PacketWriter::PacketWriter(char * buffer, int capacity)
+:	mData(buffer), mCapacity(capacity), mDepth(0)
+{
+	clear();
+}
+
+PacketWriter& PacketWriter::clear(){
+	return rewind(0);
+}
+
+PacketWriter& PacketWriter::rewind(int size){
+	if(size < 0) size = 0;
+	mSize = size;
+	mMessage = -1;
+	mNumTags = 0;
+	// bundles begun after the new end are gone
+	while(mDepth > 0 && mBundles[mDepth-1] >= size) --mDepth;
+	mOK = true;
+	return *this;
+}
+
+char * PacketWriter::reserve(int bytes){
+	if(!mOK || mSize + bytes > mCapacity){
+		mOK = false;
+		return NULL;
+	}
+	char * p = mData + mSize;
+	mSize += bytes;
+	return p;
+}
+
+PacketWriter& PacketWriter::tag(char t){
+	if(mMessage < 0 || MAX_ARGS == mNumTags) mOK = false;
+	else mTags[mNumTags++] = t;
+	return *this;
+}
+
+void PacketWriter::putString(const char * v, int len){
+	int padded = (len + 4) & ~3; // at least one terminating zero
+	char * p = reserve(padded);
+	if(p){
+		memcpy(p, v, len);
+		memset(p + len, 0, padded - len);
+	}
+}
+
+// Elements of a bundle are preceded by their size
+void PacketWriter::beginElement(){
+	if(mDepth > 0) reserve(4);
+}
+
+void PacketWriter::endElement(int start){
+	if(mDepth > 0 && mOK) put32(mData + start, mSize - start - 4);
+}
+
+PacketWriter& PacketWriter::beginBundle(TimeTag timeTag){
+	if(mMessage >= 0 || MAX_DEPTH == mDepth){
+		mOK = false;
+		return *this;
+	}
+	int start = mSize;
+	beginElement();
+	mBundles[mDepth++] = start;
+	char * p = reserve(16);
+	if(p){
+		memcpy(p, "#bundle", 8);
+		put32(p+8, uint32_t(timeTag>>32));
+		put32(p+12, uint32_t(timeTag));
+	}
+	return *this;
+}
+
+PacketWriter& PacketWriter::endBundle(){
+	if(mMessage >= 0 || 0 == mDepth){
+		mOK = false;
+		return *this;
+	}
+	int start = mBundles[--mDepth];
+	endElement(start);
+	return *this;
+}
+
+PacketWriter& PacketWriter::beginMessage(const char * addr){
+	if(mMessage >= 0){
+		mOK = false;
+		return *this;
+	}
+	mMessage = mSize;
+	beginElement();
+	putString(addr, strlen(addr));
+	mArgs = mSize;
+	mNumTags = 0;
+	return *this;
+}
+
+PacketWriter& PacketWriter::endMessage(){
+	if(mMessage < 0){
+		mOK = false;
+		return *this;
+	}
+	// The type tags precede the arguments, so move the arguments up
+	int len = mNumTags + 1;
+	int padded = (len + 4) & ~3;
+	if(reserve(padded)){
+		char * args = mData + mArgs;
+		memmove(args + padded, args, mSize - padded - mArgs);
+		args[0] = ',';
+		memcpy(args + 1, mTags, mNumTags);
+		memset(args + len, 0, padded - len);
+	}
+	endElement(mMessage);
+	mMessage = -1;
+	return *this;
+}
+
+PacketWriter& PacketWriter::operator<< (int v){
+	char * p = tag('i').reserve(4);
+	if(p) put32(p, v);
+	return *this;
+}
+PacketWriter& PacketWriter::operator<< (unsigned v){
+	return (*this) << int(v);
+}
+PacketWriter& PacketWriter::operator<< (float v){
+	uint32_t bits;
+	memcpy(&bits, &v, 4);
+	char * p = tag('f').reserve(4);
+	if(p) put32(p, bits);
+	return *this;
+}
+PacketWriter& PacketWriter::operator<< (double v){
+	uint64_t bits;
+	memcpy(&bits, &v, 8);
+	char * p = tag('d').reserve(8);
+	if(p){
+		put32(p, uint32_t(bits>>32));
+		put32(p+4, uint32_t(bits));
+	}
+	return *this;
+}
+PacketWriter& PacketWriter::operator<< (char v){
+	char * p = tag('c').reserve(4);
+	if(p) put32(p, v);
+	return *this;
+}
+PacketWriter& PacketWriter::operator<< (const char * v){
+	tag('s').putString(v, strlen(v));
+	return *this;
+}
+PacketWriter& PacketWriter::operator<< (const std::string& v){
+	tag('s').putString(v.c_str(), v.size());
+	return *this;
+}
+PacketWriter& PacketWriter::operator<< (const Blob& v){
+	int padded = (int(v.size) + 3) & ~3;
+	char * p = tag('b').reserve(4 + padded);
+	if(p){
+		put32(p, v.size);
+		memcpy(p+4, v.data, v.size);
+		memset(p+4+v.size, 0, padded - v.size);
+	}
+	return *this;
+}
+
+
+
 class Message::Impl : public ::osc::ReceivedMessage {
 public:
 	Impl(const char * message, int size)
@@ -342,6 +514,63 @@ int Send::send(const Packet& p){
 
 
 
+BundleSend::BundleSend(uint16_t port, const char * address, al_sec timeout,
+	int bundleSize, int queueSize
+)
+:	SocketClient(port, address, timeout, Socket::UDP),
+	mBuffer(bundleSize * (queueSize > 0 ? queueSize : 1)),
+	mPackets(queueSize > 0 ? queueSize : 1), mSizes(mPackets.size()), mCounts(mPackets.size()),
+	mWriter(&mBuffer[0], bundleSize), mBundleSize(bundleSize),
+	mQueued(0), mMessages(0), mFlushInterval(0), mOpenTime(0),
+	mPacketsSent(0), mBytesSent(0), mDropped(0)
+{}
+
+BundleSend::~BundleSend(){
+	flush();
+}
+
+void BundleSend::openBundle(){
+	mWriter = PacketWriter(&mBuffer[mQueued * mBundleSize], mBundleSize);
+	mWriter.beginBundle();
+	if(mFlushInterval > 0) mOpenTime = al::timeNow();
+}
+
+void BundleSend::closeBundle(){
+	mWriter.endBundle();
+	mPackets[mQueued] = mWriter.data();
+	mSizes[mQueued] = mWriter.size();
+	mCounts[mQueued] = mMessages;
+	mMessages = 0;
+	if(++mQueued == int(mPackets.size())) sendQueued();
+}
+
+int BundleSend::sendQueued(){
+	if(0 == mQueued) return 0;
+	int sent = sendBatch(&mPackets[0], &mSizes[0], mQueued);
+	for(int i=0; i<sent; ++i) mBytesSent += mSizes[i];
+	mPacketsSent += sent;
+	// Datagrams from the first that failed to send on are dropped
+	for(int i=sent; i<mQueued; ++i) mDropped += mCounts[i];
+	mQueued = 0;
+	return sent;
+}
+
+int BundleSend::flush(){
+	if(mMessages > 0) closeBundle();
+	return sendQueued();
+}
+
+int BundleSend::update(){
+	if(mMessages > 0 && mFlushInterval > 0
+		&& al::timeNow() - mOpenTime >= mFlushInterval
+	){
+		return flush();
+	}
+	return 0;
+}
+
+
+
 static void * recvThreadFunc(void * user){
 	Recv * r = static_cast<Recv *>(user);
 	while(r->background()){
@@ -403,5 +632,70 @@ void Recv::stop(){
 	}
 }
 
+
+bool matchPattern(const char * p, const char * a){
+	for(;;){
+		switch(*p){
+		case '\0':
+			return '\0' == *a;
+
+		case '*':
+			while('*' == *p) ++p;
+			// try every split of the rest of the address part
+			for(;; ++a){
+				if(matchPattern(p, a)) return true;
+				if('\0' == *a || '/' == *a) return false;
+			}
+
+		case '?':
+			if('\0' == *a || '/' == *a) return false;
+			++p; ++a;
+			break;
+
+		case '[':{
+			if('\0' == *a || '/' == *a) return false;
+			++p;
+			bool negate = '!' == *p;
+			if(negate) ++p;
+			bool hit = false;
+			while(*p && ']' != *p){
+				if('-' == p[1] && p[2] && ']' != p[2]){
+					if(*a >= p[0] && *a <= p[2]) hit = true;
+					p += 3;
+				}
+				else{
+					if(*a == *p) hit = true;
+					++p;
+				}
+			}
+			if(']' != *p || hit == negate) return false;
+			++p; ++a;
+			break;
+		}
+
+		case '{':{
+			const char * close = strchr(p, '}');
+			if(!close) return false;
+			for(const char * alt = p+1; alt <= close; ){
+				const char * end = alt;
+				while(end < close && ',' != *end) ++end;
+				size_t n = end - alt;
+				if(0 == strncmp(alt, a, n) && matchPattern(close+1, a+n)) return true;
+				alt = end + 1;
+			}
+			return false;
+		}
+
+		default:
+			if(*p != *a) return false;
+			++p; ++a;
+		}
+	}
+}
+
+bool isPattern(const std::string& pattern){
+	return std::string::npos != pattern.find_first_of("*?[{");
+}
+
 } // osc::
 } // al::
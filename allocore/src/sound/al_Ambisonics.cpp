@@ -111,6 +111,68 @@ void AmbiBase::encodeWeightsFuMa(float * ws, int dim, int order, float x, float
 }
 
 
+void AmbiBase::encodeWeightsFuMa(
+	float * ws, int stride, int dim, int order,
+	const float * x, const float * y, const float * z, int n
+){
+	#define FOR_N for(int i=0; i<n; ++i)
+	const float k1_sqrt2 = c1_sqrt2;
+	const float k8_11 = c8_11;
+	const float k40_11 = c40_11;
+	float * w = ws;
+	FOR_N w[i] = k1_sqrt2;							// W
+	w += stride;
+
+	if(order > 0){
+		FOR_N w[i] = x[i];							// X
+		w += stride;
+		FOR_N w[i] = y[i];							// Y
+		w += stride;
+
+		if(order > 1){
+			FOR_N w[i] = x[i]*x[i] - y[i]*y[i];		// U
+			w += stride;
+			FOR_N w[i] = 2.f * x[i] * y[i];			// V
+			w += stride;
+
+			if(order > 2){
+				FOR_N w[i] = x[i] * (x[i]*x[i] - 3.f * y[i]*y[i]);	// P
+				w += stride;
+				FOR_N w[i] = y[i] * (y[i]*y[i] - 3.f * x[i]*x[i]);	// Q
+				w += stride;
+			}
+		}
+
+		if(dim == 3){
+			FOR_N w[i] = z[i];						// Z
+			w += stride;
+
+			if(order > 1){
+				FOR_N w[i] = 2.f * z[i] * x[i];		// S
+				w += stride;
+				FOR_N w[i] = 2.f * z[i] * y[i];		// T
+				w += stride;
+				FOR_N w[i] = 1.5f * z[i]*z[i] - 0.5f;	// R
+				w += stride;
+
+				if(order > 2){
+					FOR_N w[i] = z[i] * (x[i]*x[i] - y[i]*y[i]) * 0.5f;	// N
+					w += stride;
+					FOR_N w[i] = x[i] * y[i] * z[i];						// O
+					w += stride;
+					FOR_N w[i] = (k40_11 * z[i]*z[i] - k8_11) * x[i];		// L
+					w += stride;
+					FOR_N w[i] = (k40_11 * z[i]*z[i] - k8_11) * y[i];		// M
+					w += stride;
+					FOR_N w[i] = z[i] * (2.5f * z[i]*z[i] - 1.5f);		// K
+				}
+			}
+		}
+	}
+	#undef FOR_N
+}
+
+
 void AmbiBase::encodeWeightsFuMa(float * ws, int dim, int order, float az, float el){
 	WRAP(az);
 	WRAP(el);
@@ -192,7 +254,7 @@ float AmbiDecode::flavorWeights[4][5][5] = {
 
 AmbiDecode::AmbiDecode(int dim, int order, int numSpeakers, int flav)
 	: AmbiBase(dim, order),
-	mNumSpeakers(0), mDecodeMatrix(0), mSpeakers(NULL)
+	mNumSpeakers(0), mDecodeMatrix(0), mWeightedMatrix(0), mSpeakers(NULL)
 {
 	resizeArrays(channels(), numSpeakers);
 	flavor(flav);
@@ -200,22 +262,73 @@ AmbiDecode::AmbiDecode(int dim, int order, int numSpeakers, int flav)
 
 AmbiDecode::~AmbiDecode(){
 	delete[] mDecodeMatrix;
+	delete[] mWeightedMatrix;
 	//delete[] mSpeakers; // listener now owns speakers and will delete them
 }
 
+// Number of frames decoded at a time. One block of every Ambisonic channel
+// (at most 16 x 64 floats) stays in L1 cache while it is decoded to each
+// speaker.
+static const int decodeBlockSize = 64;
+
+// Accumulate one speaker's block: out[i] += sum_c w[c] * in[c*stride + i].
+// With the channel count known at compile time, the channel loop is fully
+// unrolled and the frame loop vectorizes. Summing into a local buffer first
+// spares the compiler from checking the output against every input channel
+// for aliasing.
+template <int C>
+static void decodeBlock(
+	float * out, const float * w, const float * in, int /*channels*/, int stride, int n
+){
+	float acc[decodeBlockSize];
+	for(int i=0; i<n; ++i){
+		float smp = 0.f;
+		for(int c=0; c<C; ++c) smp += w[c] * in[c*stride + i];
+		acc[i] = smp;
+	}
+	for(int i=0; i<n; ++i) out[i] += acc[i];
+}
+
+static void decodeBlockN(
+	float * out, const float * w, const float * in, int channels, int stride, int n
+){
+	float acc[decodeBlockSize];
+	for(int i=0; i<n; ++i) acc[i] = w[0] * in[i];
+	for(int c=1; c<channels; ++c){
+		const float * inc = in + c*stride;
+		const float wc = w[c];
+		for(int i=0; i<n; ++i) acc[i] += wc * inc[i];
+	}
+	for(int i=0; i<n; ++i) out[i] += acc[i];
+}
+
 void AmbiDecode::decode(float * dec, const float * ambi, int numDecFrames) const {
 
-	// iterate speakers
-	for(int s=0; s<numSpeakers(); ++s){
-		// skip zero-amp speakers:
-		if ((*mSpeakers)[s].gain != 0.) {
-			float * out = dec + (*mSpeakers)[s].deviceChannel * numDecFrames;
+	typedef void (* Kernel)(float *, const float *, const float *, int, int, int);
+	Kernel kernel;
+
+	switch(channels()){
+	case  3: kernel = decodeBlock< 3>; break; // 2D, 1st order
+	case  4: kernel = decodeBlock< 4>; break; // 3D, 1st order
+	case  5: kernel = decodeBlock< 5>; break; // 2D, 2nd order
+	case  7: kernel = decodeBlock< 7>; break; // 2D, 3rd order
+	case  9: kernel = decodeBlock< 9>; break; // 3D, 2nd order
+	case 16: kernel = decodeBlock<16>; break; // 3D, 3rd order
+	default: kernel = decodeBlockN;
+	}
 
-			// iterate ambi channels
-			for(int c=0; c<channels(); ++c){
-				const float * in = ambi + c * numDecFrames;
-				float w = decodeWeight(s, c);
-				for(int i=0; i<numDecFrames; ++i) out[i] += in[i] * w;
+	// iterate frame blocks
+	for(int i=0; i<numDecFrames; i+=decodeBlockSize){
+		int n = numDecFrames - i;
+		if(n > decodeBlockSize) n = decodeBlockSize;
+
+		// iterate speakers
+		for(int s=0; s<numSpeakers(); ++s){
+			// skip zero-amp speakers:
+			if ((*mSpeakers)[s].gain != 0.) {
+				float * out = dec + (*mSpeakers)[s].deviceChannel * numDecFrames + i;
+				const float * w = mWeightedMatrix + s * channels();
+				kernel(out, w, ambi + i, channels(), numDecFrames, n);
 			}
 		}
 	}
@@ -252,6 +365,7 @@ void AmbiDecode::setSpeakerRadians(int index, int deviceChannel, float az, float
 	for (int i=0; i<channels(); i++) {
 		mDecodeMatrix[index * channels() + i] *= amp;
 	}
+	updateWeightedMatrix(index);
 }
 
 void AmbiDecode::setSpeaker(int index, int deviceChannel, float az, float el, float amp){
@@ -298,6 +412,14 @@ void AmbiDecode::updateChanWeights(){
 			}
 		}
 	}
+
+	for(int s=0; s<mNumSpeakers; ++s) updateWeightedMatrix(s);
+}
+
+void AmbiDecode::updateWeightedMatrix(int s){
+	for(int c=0; c<channels(); ++c){
+		mWeightedMatrix[s * channels() + c] = decodeWeight(s, c);
+	}
 }
 
 void AmbiDecode::resizeArrays(int numChannels, int numSpeakers){
@@ -308,6 +430,7 @@ void AmbiDecode::resizeArrays(int numChannels, int numSpeakers){
 	if(oldSize != newSize){
 
 		resize(mDecodeMatrix, newSize);
+		resize(mWeightedMatrix, newSize);
 		//resize(mFrame, newSize);
 
 		// resize number of speakers (?)
@@ -338,6 +461,39 @@ void AmbiDecode::print(FILE * fp, const char * append) const {
 }
 
 
+// AmbiEncode
+
+// Number of frames whose weights are computed at a time
+static const int encodeBlockSize = 64;
+
+void AmbiEncode::encode(
+	float * ambiChans, int numFrames, int numSources,
+	const float * const * dirs, const float * const * inputs
+) const {
+	float ws[16 * encodeBlockSize];
+
+	for(int s=0; s<numSources; ++s){
+		const float * x = dirs[s];
+		const float * y = x + numFrames;
+		const float * z = y + numFrames;
+		const float * in = inputs[s];
+
+		for(int i=0; i<numFrames; i+=encodeBlockSize){
+			int n = numFrames - i;
+			if(n > encodeBlockSize) n = encodeBlockSize;
+
+			encodeWeightsFuMa(ws, encodeBlockSize, mDim, mOrder, x+i, y+i, z+i, n);
+
+			for(int c=0; c<channels(); ++c){
+				float * ambi = ambiChans + c*numFrames + i;
+				const float * w = ws + c*encodeBlockSize;
+				for(int j=0; j<n; ++j) ambi[j] += w[j] * in[i+j];
+			}
+		}
+	}
+}
+
+
 AmbisonicsSpatializer::AmbisonicsSpatializer(
 	SpeakerLayout &sl, int dim, int order, int flavor
 )
@@ -361,6 +517,7 @@ void AmbisonicsSpatializer::numFrames(int v){
     if(mAmbiDomainChannels.size() != (unsigned long)(mDecoder.channels() * v)){
 		mAmbiDomainChannels.resize(mDecoder.channels() * v);
 	}
+	mDirections.resize(3 * v);
 }
 
 void AmbisonicsSpatializer::numSpeakers(int num){
@@ -390,7 +547,7 @@ void AmbisonicsSpatializer::prepare(){
 }
 
 void AmbisonicsSpatializer::perform(
-	AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, float *samples
+	AudioIOData& io, SoundSource& src, int index, Vec3d& relpos, const int& numFrames, float *samples
 ){
 	// compute azimuth & elevation of relative position in current listener's coordinate frame:
 	Vec3d urel(relpos);
@@ -406,15 +563,25 @@ void AmbisonicsSpatializer::perform(
 	double rf = urel.dot(axis);
 	//*/
 
+	if(mDirections.size() < (unsigned)(3 * numFrames)) mDirections.resize(3 * numFrames);
+	float * x = &mDirections[0];
+	float * y = x + numFrames;
+	float * z = y + numFrames;
+
 	for(int i = 0; i < numFrames; i++){
 		// cheaper:
 		Vec3d direction = mListener->quatHistory()[i].rotateTransposed(urel);
 
 		//mEncoder.direction(azimuth, elevation);
 		//mEncoder.direction(-rf, -rr, ru);
-		mEncoder.direction(-direction[2], -direction[0], direction[1]);
-		mEncoder.encode(ambiChans(), numFrames, i, samples[i]);
+		x[i] = -direction[2];
+		y[i] = -direction[0];
+		z[i] =  direction[1];
 	}
+
+	const float * dirs = x;
+	const float * inputs = samples;
+	mEncoder.encode(ambiChans(), numFrames, 1, &dirs, &inputs);
 }
 
 
@@ -1,5 +1,10 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include "allocore/sound/al_AudioScene.hpp"
 #include "allocore/math/al_Constants.hpp"
+#include "allocore/system/al_Thread.hpp"
 
 namespace al{
 
@@ -48,12 +53,76 @@ void Listener::compile(){
 
 
 
+// Get log2 of block size for a number of samples
+static int delayBlockLog2(int size){
+	int sizeLog2 = 0;
+	while((1<<sizeLog2) < size || (sizeof(float)<<sizeLog2) < sizeof(float *)){
+		++sizeLog2;
+	}
+	return sizeLog2;
+}
+
+// Link of a free block, stored in its first samples
+static float * nextFree(const float * block){
+	float * next;
+	memcpy(&next, block, sizeof(next));
+	return next;
+}
+
+DelayPool::DelayPool(int slabSize)
+:	mSlabSize(slabSize), mSlabUsed(slabSize), mReserved(0)
+{
+	for(int i=0; i<32; ++i) mFree[i] = NULL;
+}
+
+DelayPool::~DelayPool(){
+	for(unsigned i=0; i<mSlabs.size(); ++i) delete[] mSlabs[i];
+}
+
+float * DelayPool::allocate(int& size){
+	int sizeLog2 = delayBlockLog2(size);
+	size = 1<<sizeLog2;
+
+	float * block;
+	if(mFree[sizeLog2]){
+		block = mFree[sizeLog2];
+		mFree[sizeLog2] = nextFree(block);
+	}
+	else if(size > mSlabSize){ // block gets a slab of its own
+		block = new float[size];
+		mSlabs.push_back(block);
+		mReserved += size;
+	}
+	else{
+		if(mSlabUsed + size > mSlabSize){
+			mSlabs.push_back(new float[mSlabSize]);
+			mReserved += mSlabSize;
+			mSlabUsed = 0;
+		}
+		block = mSlabs.back() + mSlabUsed;
+		mSlabUsed += size;
+	}
+
+	memset(block, 0, size*sizeof(float));
+	return block;
+}
+
+void DelayPool::deallocate(float * block, int size){
+	int sizeLog2 = delayBlockLog2(size);
+	memcpy(block, &mFree[sizeLog2], sizeof(float *));
+	mFree[sizeLog2] = block;
+}
+
+
+
 SoundSource::SoundSource(double nearClip, double farClip, AttenuationLaw law, DopplerType dopplerType,
         double farBias, int delaySize
         )
 	:	DistAtten<double>(nearClip, farClip, law, farBias),
-      mSound(delaySize), mUseAtten(true), mDopplerType(dopplerType), mUsePerSampleProcessing(false),
-      mCachedIndex(0)
+      mSound(std::max(delaySize, 4)), mPoolDelay(NULL), mDelayPool(NULL),
+      mDelaySize(mSound.size()), mDelayPos(mDelaySize-1),
+      mUseAtten(true), mDopplerType(dopplerType), mUsePerSampleProcessing(false),
+      mCachedIndex(0), mPriority(0)
 {
 
 	// initialize the position history to be VERY FAR AWAY so that we don't deafen ourselves...
@@ -64,6 +133,62 @@ SoundSource::SoundSource(double nearClip, double farClip, AttenuationLaw law, Do
 	presenceFilter.set(2700);
 }
 
+SoundSource::~SoundSource(){
+	releaseDelay();
+}
+
+void SoundSource::releaseDelay(){
+	if(mDelayPool){
+		mDelayPool->deallocate(mPoolDelay, mDelaySize);
+		mDelayPool = NULL;
+		mPoolDelay = NULL;
+	}
+	std::vector<float>().swap(mSound);
+}
+
+void SoundSource::delayLine(
+	DelayPool& pool, double maxDistance,
+	double sampleRate, double speedOfSound, int numFrames
+){
+	// Add room for one block and the interpolation taps
+	int size = bufferSize(sampleRate, speedOfSound, maxDistance) + numFrames + 3;
+	releaseDelay();
+	mPoolDelay = pool.allocate(size);
+	mDelayPool = &pool;
+	mDelaySize = size;
+	mDelayPos = size-1;
+}
+
+void SoundSource::readSamples(float * dst, double index, int numFrames, float gain) const {
+	if(index > maxIndex()) index = maxIndex();
+	int index0 = index;
+	float frac = index - index0;
+
+	// dst[i] is interpolated from the samples at pos+1, pos, pos-1 and
+	// pos-2 of the delay-line memory, where pos increases with i. Runs that
+	// do not wrap around are read directly; wrapping samples one at a time.
+	const float * data = delayData();
+	int i = 0;
+	while(i < numFrames){
+		int pos = (mDelayPos - index0 + i) % mDelaySize;
+		if(pos < 0) pos += mDelaySize;
+
+		int run = mDelaySize - 1 - pos;
+		if(run > numFrames - i) run = numFrames - i;
+		if(pos >= 2 && run > 0){
+			ipl::cubic(dst+i, data+pos+1, data+pos, data+pos-1, data+pos-2, run, frac);
+			i += run;
+		}
+		else{
+			int k = index0 - i;
+			dst[i] = ipl::cubic(frac, read(k-1), read(k), read(k+1), read(k+2));
+			++i;
+		}
+	}
+
+	for(int j=0; j<numFrames; ++j) dst[j] *= gain;
+}
+
 /*static*/
 int SoundSource::bufferSize(double samplerate, double speedOfSound, double distance){
 	return (int)ceil(samplerate * distance / speedOfSound);
@@ -71,13 +196,221 @@ int SoundSource::bufferSize(double samplerate, double speedOfSound, double dista
 
 
 
-AudioScene::AudioScene(int numFrames_)
-	:   mNumFrames(0), mSpeedOfSound(340), mPerSampleProcessing(false)
+// Pool of worker threads each rendering a partition of the sources into its
+// own output accumulator
+class AudioScene::RenderPool{
+public:
+
+	struct Accumulator : public AudioIOData{
+		Accumulator(int numFrames, int numChannels)
+		:	AudioIOData(NULL)
+		{
+			mFramesPerBuffer = numFrames;
+			mNumO = numChannels;
+			resize(mBufO, numFrames * numChannels);
+			resize(mBufT, numFrames);
+		}
+
+		void framesPerSecond(double v){ mFramesPerSecond = v; }
+	};
+
+	// State of a partition rendered by a worker
+	enum{
+		IDLE,		// no block posted
+		POSTED,		// posted, but not yet claimed
+		CLAIMED,	// being rendered by a worker or the audio thread
+		DONE		// rendered into the worker's accumulator
+	};
+
+	struct Worker : public ThreadFunction{
+		Worker(RenderPool& p, int index_, int numFrames, int numChannels)
+		:	pool(p), io(numFrames, numChannels), buffer(numFrames), index(index_)
+		{
+			state.store(IDLE);
+		}
+
+		// Render partition if no other thread has claimed it
+		bool claim(){
+			int expected = POSTED;
+			if(!state.compare_exchange_strong(expected, CLAIMED, std::memory_order_acquire)){
+				return false;
+			}
+			io.zeroOut();
+			int beg, end;
+			pool.partition(beg, end, index);
+			pool.mScene.renderSources(
+				io, *pool.mListener, pool.mListenerIndex, beg, end, &buffer[0]
+			);
+			state.store(DONE, std::memory_order_release);
+			return true;
+		}
+
+		void operator()(){
+			unsigned done = 0;
+			while(true){
+				{
+					std::unique_lock<std::mutex> lock(pool.mMutex);
+					pool.mCond.wait(lock, [&]{
+						return !pool.mRunning || pool.mGeneration != done;
+					});
+					if(!pool.mRunning) return;
+					done = pool.mGeneration;
+				}
+				claim();
+			}
+		}
+
+		RenderPool& pool;
+		Thread thread;
+		Accumulator io;
+		std::vector<float> buffer;
+		std::atomic<int> state;
+		int index;
+	};
+
+
+	RenderPool(AudioScene& scene, int num, int numFrames, int numChannels, int priority)
+	:	mScene(scene), mNumFrames(numFrames), mNumChannels(numChannels),
+		mPriority(priority), mListener(NULL), mListenerIndex(0), mGeneration(0), mRunning(true)
+	{
+		// Partition 0 is rendered by the caller of AudioScene::render
+		for(int i=1; i<num; ++i){
+			mWorkers.push_back(new Worker(*this, i, numFrames, numChannels));
+		}
+		for(unsigned i=0; i<mWorkers.size(); ++i){
+			Thread& t = mWorkers[i]->thread;
+			// Fall back to normal priority if real-time is not permitted
+			if(!t.priority(priority).start(*mWorkers[i])){
+				t.priority(0).start(*mWorkers[i]);
+			}
+		}
+	}
+
+	~RenderPool(){
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mRunning = false;
+		}
+		mCond.notify_all();
+		for(unsigned i=0; i<mWorkers.size(); ++i){
+			mWorkers[i]->thread.join();
+			delete mWorkers[i];
+		}
+	}
+
+	int size() const { return mWorkers.size() + 1; }
+	int numChannels() const { return mNumChannels; }
+	int priority() const { return mPriority; }
+
+	bool compatible(const AudioIOData& io) const {
+		return io.framesPerBuffer() == mNumFrames && io.channelsOut() == mNumChannels;
+	}
+
+	// Get contiguous range of sources [beg, end) of partition i
+	void partition(int& beg, int& end, int i) const {
+		beg = mNumSources * i / size();
+		end = mNumSources * (i+1) / size();
+	}
+
+	void render(AudioIOData& io, Listener& l, int listenerIndex, float * buffer){
+		mNumSources = mScene.mVoices.size();
+		mListener = &l;
+		mListenerIndex = listenerIndex;
+		for(unsigned i=0; i<mWorkers.size(); ++i){
+			mWorkers[i]->io.framesPerSecond(io.framesPerSecond());
+		}
+		for(unsigned i=0; i<mWorkers.size(); ++i){
+			mWorkers[i]->state.store(POSTED, std::memory_order_release);
+		}
+
+		// The lock is only held by workers while checking the generation, so
+		// this does not block the audio thread for any significant time.
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			++mGeneration;
+		}
+		mCond.notify_all();
+
+		int beg, end;
+		partition(beg, end, 0);
+		mScene.renderSources(io, l, listenerIndex, beg, end, buffer);
+
+		// Render partitions of workers that have not woken up in time, so
+		// the audio thread only waits on partitions already being rendered.
+		for(unsigned i=0; i<mWorkers.size(); ++i){
+			mWorkers[i]->claim();
+		}
+		for(unsigned i=0; i<mWorkers.size(); ++i){
+			while(mWorkers[i]->state.load(std::memory_order_acquire) != DONE){}
+		}
+
+		// Reduce accumulators in fixed order
+		const int numSamples = mNumFrames * mNumChannels;
+		float * out = io.outBuffer();
+		for(unsigned i=0; i<mWorkers.size(); ++i){
+			const float * acc = mWorkers[i]->io.outBuffer();
+			for(int k=0; k<numSamples; ++k) out[k] += acc[k];
+		}
+	}
+
+private:
+	AudioScene& mScene;
+	std::vector<Worker *> mWorkers;
+	int mNumFrames, mNumChannels;
+	int mPriority;
+	int mNumSources;
+	Listener * mListener;
+	int mListenerIndex;
+	std::mutex mMutex;
+	std::condition_variable mCond;
+	unsigned mGeneration;
+	bool mRunning;
+};
+
+
+
+// Message from a control thread to the audio thread
+struct AudioScene::Command{
+	enum Type{
+		ADD_SOURCE,
+		REMOVE_SOURCE,
+		POSE,
+		PARAM
+	};
+
+	Type type;
+	AudioSceneObject * object;
+	SourceParam param;
+	double value;
+	Pose pose;
+};
+
+// Cell of the command queue
+struct AudioScene::CommandCell{
+	std::atomic<size_t> seq;	// write position when free, plus one when full
+	Command command;
+};
+
+
+AudioScene::AudioScene(int numFrames_, int maxCommands)
+	:   mNumFrames(0), mSpeedOfSound(340), mPerSampleProcessing(false),
+		mCullGain(0), mLODDistance(HUGE_VAL), mMaxSources(0),
+		mNumCulled(0), mNumDropped(0), mNumDowngraded(0),
+		mRenderPool(NULL), mCommandWrite(0), mCommandRead(0)
 {
+	size_t numCells = 1;
+	while(numCells < size_t(maxCommands)) numCells <<= 1;
+	mCommands = new CommandCell[numCells];
+	mCommandMask = numCells - 1;
+	for(size_t i=0; i<numCells; ++i){
+		mCommands[i].seq.store(i, std::memory_order_relaxed);
+	}
 	numFrames(numFrames_);
 }
 
 AudioScene::~AudioScene(){
+	delete mRenderPool;
+	delete[] mCommands;
 	for(
 		Listeners::iterator it = mListeners.begin();
 		it != mListeners.end();
@@ -88,17 +421,141 @@ AudioScene::~AudioScene(){
 }
 
 void AudioScene::addSource(SoundSource& src){
+	size_t capacity = mSources.capacity();
 	mSources.push_back(&src);
+	if(mSources.capacity() != capacity) numSourcesChanged();
 }
 
 void AudioScene::removeSource(SoundSource& src){
-	mSources.remove(&src);
+	Sources::iterator it = std::find(mSources.begin(), mSources.end(), &src);
+	if(it != mSources.end()){
+		int index = it - mSources.begin();
+		mSources.erase(it);
+		for(unsigned il=0; il<mListeners.size(); ++il){
+			mListeners[il]->mSpatializer->removeSource(index);
+		}
+	}
+}
+
+void AudioScene::reserveSources(int num){
+	mSources.reserve(num);
+	numSourcesChanged();
+}
+
+void AudioScene::numSourcesChanged(){
+	mVoices.reserve(mSources.capacity());
+	for(unsigned il=0; il<mListeners.size(); ++il){
+		mListeners[il]->mSpatializer->numSources(mSources.capacity());
+	}
+}
+
+bool AudioScene::sendCommand(const Command& c){
+	// claim a cell; its sequence equals the write position when it is free
+	size_t pos = mCommandWrite.load(std::memory_order_relaxed);
+	CommandCell * cell;
+	while(true){
+		cell = &mCommands[pos & mCommandMask];
+		size_t seq = cell->seq.load(std::memory_order_acquire);
+		intptr_t dif = intptr_t(seq) - intptr_t(pos);
+		if(dif == 0){
+			if(mCommandWrite.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) break;
+		}
+		else if(dif < 0){
+			return false; // full
+		}
+		else{
+			pos = mCommandWrite.load(std::memory_order_relaxed);
+		}
+	}
+
+	cell->command = c;
+
+	// publish to the audio thread
+	cell->seq.store(pos+1, std::memory_order_release);
+	return true;
+}
+
+bool AudioScene::sendAddSource(SoundSource& src){
+	Command c;
+	c.type = Command::ADD_SOURCE;
+	c.object = &src;
+	return sendCommand(c);
+}
+
+bool AudioScene::sendRemoveSource(SoundSource& src){
+	Command c;
+	c.type = Command::REMOVE_SOURCE;
+	c.object = &src;
+	return sendCommand(c);
+}
+
+bool AudioScene::sendPose(AudioSceneObject& obj, const Pose& pose){
+	Command c;
+	c.type = Command::POSE;
+	c.object = &obj;
+	c.pose = pose;
+	return sendCommand(c);
+}
+
+bool AudioScene::sendParam(SoundSource& src, SourceParam param, double value){
+	Command c;
+	c.type = Command::PARAM;
+	c.object = &src;
+	c.param = param;
+	c.value = value;
+	return sendCommand(c);
+}
+
+void AudioScene::applyCommands(){
+	while(true){
+		CommandCell& cell = mCommands[mCommandRead & mCommandMask];
+		if(cell.seq.load(std::memory_order_acquire) != mCommandRead+1) return;
+		const Command& c = cell.command;
+
+		switch(c.type){
+		case Command::ADD_SOURCE:
+			addSource(static_cast<SoundSource&>(*c.object));
+			break;
+
+		case Command::REMOVE_SOURCE:
+			removeSource(static_cast<SoundSource&>(*c.object));
+			break;
+
+		case Command::POSE:
+			c.object->pose(c.pose);
+			break;
+
+		case Command::PARAM:{
+			SoundSource& src = static_cast<SoundSource&>(*c.object);
+			switch(c.param){
+			case NEAR_CLIP:		src.nearClip(c.value); break;
+			case FAR_CLIP:		src.farClip(c.value); break;
+			case FAR_BIAS:		src.farBias(c.value); break;
+			case ATTEN_LAW:		src.law(AttenuationLaw(int(c.value))); break;
+			case USE_ATTEN:		src.useAttenuation(c.value != 0.); break;
+			case DOPPLER_TYPE:	src.dopplerType(DopplerType(int(c.value))); break;
+			}
+		}	break;
+		}
+
+		// free the cell for the sender one lap ahead
+		cell.seq.store(mCommandRead + mCommandMask + 1, std::memory_order_release);
+		++mCommandRead;
+	}
 }
 
 void AudioScene::numFrames(int v){
 	if(mNumFrames != v){
 		mBuffer.resize(v);
 
+		if(mRenderPool){
+			int num = mRenderPool->size();
+			int numChannels = mRenderPool->numChannels();
+			int priority = mRenderPool->priority();
+			delete mRenderPool;
+			mRenderPool = new RenderPool(*this, num, v, numChannels, priority);
+		}
+
 		Listeners::iterator it = mListeners.begin();
 		while(it != mListeners.end()){
 			(*it)->numFrames(v);
@@ -108,9 +565,22 @@ void AudioScene::numFrames(int v){
 	}
 }
 
+void AudioScene::numThreads(int num, int numChannels, int priority){
+	delete mRenderPool;
+	mRenderPool = NULL;
+	if(num > 1){
+		mRenderPool = new RenderPool(*this, num, mNumFrames, numChannels, priority);
+	}
+}
+
+int AudioScene::numThreads() const {
+	return mRenderPool ? mRenderPool->size() : 1;
+}
+
 Listener * AudioScene::createListener(Spatializer* spatializer){
 	Listener * l = new Listener(mNumFrames, spatializer);
 	l->compile();
+	spatializer->numSources(mSources.capacity());
 	mListeners.push_back(l);
 	return l;
 }
@@ -124,124 +594,227 @@ Listener * AudioScene::createListener(Spatializer* spatializer){
 */
 
 
-void AudioScene::render(AudioIOData& io) {
-	const int numFrames = io.framesPerBuffer();
-	double sampleRate = io.framesPerSecond();
-	io.zeroOut();
+void AudioScene::cull(
+	const AudioIOData& io, Listener& l,
+	int& numCulled, int& numDropped, int& numDowngraded
+){
+	const double sampleRate = io.framesPerSecond();
+	mVoices.clear();
 
-	// iterate through all listeners adding contribution from all sources
-	for(unsigned il=0; il<mListeners.size(); ++il){
-		Listener& l = *mListeners[il];
+	for(unsigned is=0; is<mSources.size(); ++is){
+		SoundSource& src = *mSources[is];
 
-		Spatializer* spatializer = l.mSpatializer;
-		spatializer->prepare();
+		Voice voice;
+		voice.src = &src;
+		voice.index = is;
+		voice.perSample = mPerSampleProcessing;
 
-		// update listener history data:
-		l.updateHistory(numFrames);
+		//if our src is using per sample processing we will update this in the frame loop instead
+		if(src.usePerSampleProcessing()){
+			voice.gain = src.attenuation((src.pos() - l.pos()).mag());
+			mVoices.push_back(voice);
+			continue;
+		}
 
-		// iterate through all sound sources
-		for(Sources::iterator it = mSources.begin(); it != mSources.end(); ++it){
-			SoundSource& src = *(*it);
+		src.updateHistory();
 
-			// scalar factor to convert distances into delayline indices
-			double distanceToSample = 0;
-			if(src.dopplerType() == DOPPLER_SYMMETRICAL)
-				distanceToSample = sampleRate / mSpeedOfSound;
+		// The position rendered at any frame of the block lies within the
+		// bounding sphere of the last four relative positions
+		Vec3d rel[4];
+		Vec3d center(0);
+		for(int k=0; k<4; ++k){
+			rel[k] = src.posHistory()[k] - l.posHistory()[k];
+			center += rel[k];
+		}
+		center *= 0.25;
+		double radius = 0;
+		for(int k=0; k<4; ++k){
+			double d = (rel[k] - center).mag();
+			if(d > radius) radius = d;
+		}
+		double nearest = center.mag() - radius;
+		if(nearest < 0) nearest = 0;
 
-			if(!src.usePerSampleProcessing()) //if our src is using per sample processing we will update this in the frame loop instead
-				src.updateHistory();
+		voice.gain = src.attenuation(nearest);
 
-			if(mPerSampleProcessing) //audioscene per sample processing
-			{
-				// iterate time samples
-				for(int i=0; i < numFrames; ++i){
+		bool downgrade = voice.perSample && nearest > mLODDistance;
+		if(downgrade) voice.perSample = false;
 
-					Vec3d relpos;
+		// Per sample processing skips frames beyond the delay-line
+		bool outOfRange = voice.perSample
+			&& src.dopplerType() == DOPPLER_SYMMETRICAL
+			&& nearest * sampleRate / mSpeedOfSound + 1 > src.maxIndex();
 
-					if(src.usePerSampleProcessing() && il == 0) //if src is using per sample processing, we can only do this for the first listener (TODO: better design for this)
-					{
-						src.updateHistory();
-						src.onProcessSample(i);
+		if(voice.gain <= mCullGain || outOfRange){
+			++numCulled;
+			continue;
+		}
 
-						relpos = src.posHistory()[0] - l.posHistory()[0];
+		if(downgrade) ++numDowngraded;
+		mVoices.push_back(voice);
+	}
 
-						if(src.dopplerType() == DOPPLER_PHYSICAL)
-						{
-							double currentDist = relpos.mag();
-							double prevDistance = (src.posHistory()[1] - l.posHistory()[0]).mag();
-							double sourceVel = (currentDist - prevDistance)*sampleRate; //positive when moving away, negative moving toward
+	if(mMaxSources > 0 && int(mVoices.size()) > mMaxSources){
+		numDropped += mVoices.size() - mMaxSources;
 
-							if(sourceVel == -mSpeedOfSound) sourceVel -= 0.001; //prevent divide by 0 / inf freq
+		// Keep the voices with highest priority, then gain
+		std::nth_element(
+			mVoices.begin(), mVoices.begin() + mMaxSources, mVoices.end(),
+			[](const Voice& a, const Voice& b){
+				if(a.src->priority() != b.src->priority()){
+					return a.src->priority() > b.src->priority();
+				}
+				return a.gain > b.gain;
+			}
+		);
+		mVoices.resize(mMaxSources);
 
-							distanceToSample = fabs(sampleRate / (mSpeedOfSound + sourceVel));
-						}
-					}
-					else
-					{
-						// compute interpolated source position relative to listener
-						// TODO: this tends to warble when moving fast
-						double alpha = double(i)/numFrames;
-
-						// moving average:
-						// cheaper & slightly less warbly than cubic,
-						// less glitchy than linear
-						relpos = (
-									(src.posHistory()[3]-l.posHistory()[3])*(1.-alpha) +
-								(src.posHistory()[2]-l.posHistory()[2]) +
-								(src.posHistory()[1]-l.posHistory()[1]) +
-								(src.posHistory()[0]-l.posHistory()[0])*(alpha)
-								)/3.0;
-					}
+		// Render in the order of the sources
+		std::sort(mVoices.begin(), mVoices.end(),
+			[](const Voice& a, const Voice& b){ return a.index < b.index; }
+		);
+	}
+}
 
-					//Compute distance in world-space units
-					double dist = relpos.mag();
+void AudioScene::renderSources(
+	AudioIOData& io, Listener& l, int listenerIndex,
+	int beg, int end, float * buffer
+){
+	const int numFrames = io.framesPerBuffer();
+	double sampleRate = io.framesPerSecond();
+	Spatializer* spatializer = l.mSpatializer;
 
-					// Compute how many samples ago to read from buffer
-					// Start with time delay due to speed of sound
-					double samplesAgo = dist * distanceToSample;
+	// iterate through sound sources
+	for(int is=beg; is<end; ++is){
+		const Voice& voice = mVoices[is];
+		SoundSource& src = *voice.src;
 
-					// Add on time delay (in samples) - only needed if the source is rendered per buffer
-					if(!src.usePerSampleProcessing())
-						samplesAgo += (numFrames-i);
+		// scalar factor to convert distances into delayline indices
+		double distanceToSample = 0;
+		if(src.dopplerType() == DOPPLER_SYMMETRICAL)
+			distanceToSample = sampleRate / mSpeedOfSound;
 
-					// Is our delay line big enough?
-					if(samplesAgo <= src.maxIndex()){
-						double gain = src.attenuation(dist);
+		if(voice.perSample) //audioscene per sample processing
+		{
+			// iterate time samples
+			for(int i=0; i < numFrames; ++i){
 
-						//This seemed to get the same sample per block
-						//   float s = src.readSample(samplesAgo) * gain;
+				Vec3d relpos;
 
-						//reading samplesAgo-i causes a discontinuity
-						float s = src.readSample(samplesAgo-i-1) * gain;
+				if(src.usePerSampleProcessing() && listenerIndex == 0) //if src is using per sample processing, we can only do this for the first listener (TODO: better design for this)
+				{
+					src.updateHistory();
+					src.onProcessSample(i);
 
-						// s = src.presenceFilter(s); //TODO: causing stopband ripple here, why?
-						spatializer->perform(io, src,relpos, numFrames, i, s);
-					}
+					relpos = src.posHistory()[0] - l.posHistory()[0];
 
-				} //end for each frame
-			} //end per sample processing
+					if(src.dopplerType() == DOPPLER_PHYSICAL)
+					{
+						double currentDist = relpos.mag();
+						double prevDistance = (src.posHistory()[1] - l.posHistory()[0]).mag();
+						double sourceVel = (currentDist - prevDistance)*sampleRate; //positive when moving away, negative moving toward
 
-			else //more efficient, per buffer processing for audioscene (does not work well with doppler)
-			{
-				Vec3d relpos = src.pose().pos() - l.pose().pos();
-				double distance = relpos.mag();
-				double gain = src.attenuation(distance);
+						if(sourceVel == -mSpeedOfSound) sourceVel -= 0.001; //prevent divide by 0 / inf freq
 
-				for(int i = 0; i < numFrames; i++)
+						distanceToSample = fabs(sampleRate / (mSpeedOfSound + sourceVel));
+					}
+				}
+				else
 				{
-					double readIndex = distance * distanceToSample;
-					readIndex += (numFrames - i - 1);
-					mBuffer[i] = gain * src.readSample(readIndex);
+					// compute interpolated source position relative to listener
+					// TODO: this tends to warble when moving fast
+					double alpha = double(i)/numFrames;
+
+					// moving average:
+					// cheaper & slightly less warbly than cubic,
+					// less glitchy than linear
+					relpos = (
+								(src.posHistory()[3]-l.posHistory()[3])*(1.-alpha) +
+							(src.posHistory()[2]-l.posHistory()[2]) +
+							(src.posHistory()[1]-l.posHistory()[1]) +
+							(src.posHistory()[0]-l.posHistory()[0])*(alpha)
+							)/3.0;
 				}
 
-				spatializer->perform(io, src, relpos, numFrames, &mBuffer[0]);
-			}
+				//Compute distance in world-space units
+				double dist = relpos.mag();
+
+				// Compute how many samples ago to read from buffer
+				// Start with time delay due to speed of sound
+				double samplesAgo = dist * distanceToSample;
+
+				// Add on time delay (in samples) - only needed if the source is rendered per buffer
+				if(!src.usePerSampleProcessing())
+					samplesAgo += (numFrames-i);
+
+				// Is our delay line big enough?
+				if(samplesAgo <= src.maxIndex()){
+					double gain = src.attenuation(dist);
+
+					//This seemed to get the same sample per block
+					//   float s = src.readSample(samplesAgo) * gain;
+
+					//reading samplesAgo-i causes a discontinuity
+					float s = src.readSample(samplesAgo-i-1) * gain;
+
+					// s = src.presenceFilter(s); //TODO: causing stopband ripple here, why?
+					spatializer->perform(io, src, voice.index, relpos, numFrames, i, s);
+				}
+
+			} //end for each frame
+		} //end per sample processing
 
-		} //end for each source
+		else //more efficient, per buffer processing for audioscene (does not work well with doppler)
+		{
+			Vec3d relpos = src.pose().pos() - l.pose().pos();
+			double distance = relpos.mag();
+			double gain = src.attenuation(distance);
+
+			double readIndex = distance * distanceToSample + (numFrames - 1);
+			src.readSamples(buffer, readIndex, numFrames, gain);
+
+			spatializer->perform(io, src, voice.index, relpos, numFrames, buffer);
+		}
+	} //end for each source
+}
+
+bool AudioScene::renderParallel(AudioIOData& io, Listener& l, int listenerIndex){
+	if(!mRenderPool || !l.mSpatializer->reentrant() || !mRenderPool->compatible(io)){
+		return false;
+	}
+	mRenderPool->render(io, l, listenerIndex, &mBuffer[0]);
+	return true;
+}
+
+void AudioScene::render(AudioIOData& io) {
+	io.zeroOut();
+
+	applyCommands();
+	int numCulled = 0, numDropped = 0, numDowngraded = 0;
+
+	// iterate through all listeners adding contribution from all sources
+	for(unsigned il=0; il<mListeners.size(); ++il){
+		Listener& l = *mListeners[il];
+
+		Spatializer* spatializer = l.mSpatializer;
+		spatializer->prepare();
+
+		// update listener history data:
+		l.updateHistory(io.framesPerBuffer());
+
+		cull(io, l, numCulled, numDropped, numDowngraded);
+
+		if(!renderParallel(io, l, il)){
+			renderSources(io, l, il, 0, mVoices.size(), &mBuffer[0]);
+		}
 
 		spatializer->finalize(io);
 
 	} // end for each listener
+
+	mNumCulled.store(numCulled, std::memory_order_relaxed);
+	mNumDropped.store(numDropped, std::memory_order_relaxed);
+	mNumDowngraded.store(numDowngraded, std::memory_order_relaxed);
 }
 
 } // al::
@@ -1,9 +1,10 @@
 #include "allocore/sound/al_Dbap.hpp"
+#include <algorithm>
 
 namespace al{
 
 Dbap::Dbap(const SpeakerLayout &sl, float focus)
-	:	Spatializer(sl), mListener(NULL), mNumSpeakers(0), mFocus(focus)
+	:	Spatializer(sl), mListener(NULL), mNumSpeakers(0), mFocus(focus), mNumSources(0)
 {}
 
 void Dbap::compile(Listener& listener){
@@ -14,43 +15,91 @@ void Dbap::compile(Listener& listener){
 	for(int i = 0; i < mNumSpeakers; i++)
 	{
 		mSpeakerVecs[i] = mSpeakers[i].vec();
+		mSpeakerX[i] = mSpeakerVecs[i][0];
+		mSpeakerY[i] = mSpeakerVecs[i][1];
+		mSpeakerZ[i] = mSpeakerVecs[i][2];
 		mDeviceChannels[i] = mSpeakers[i].deviceChannel;
 	}
+
+	mPrevGains.assign(mNumSources * mNumSpeakers, -1.f);
+}
+
+void Dbap::numSources(int num){
+	mNumSources = num;
+	mPrevGains.resize(mNumSources * mNumSpeakers, -1.f);
+}
+
+void Dbap::removeSource(int index){
+	if(index >= mNumSources) return;
+	std::vector<float>::iterator it = mPrevGains.begin();
+	std::copy(it + (index+1) * mNumSpeakers, mPrevGains.end(), it + index * mNumSpeakers);
+	std::fill(mPrevGains.end() - mNumSpeakers, mPrevGains.end(), -1.f);
+}
+
+void Dbap::computeGains(float * gains, const Vec3d& relpos) const {
+	if(!mEnabled){
+		for(int k = 0; k < mNumSpeakers; ++k) gains[k] = 1.f;
+		return;
+	}
+
+	// These loops run over contiguous arrays with no dependencies between
+	// speakers so that the compiler can vectorize them.
+	const float x = relpos[0], y = relpos[1], z = relpos[2];
+	for(int k = 0; k < mNumSpeakers; ++k){
+		float dx = x - mSpeakerX[k];
+		float dy = y - mSpeakerY[k];
+		float dz = z - mSpeakerZ[k];
+		gains[k] = 1.f / (1.f + sqrtf(dx*dx + dy*dy + dz*dz));
+	}
+
+	if(mFocus != 1.f){
+		for(int k = 0; k < mNumSpeakers; ++k) gains[k] = powf(gains[k], mFocus);
+	}
 }
 
-void Dbap::perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, float *samples){
+void Dbap::perform(AudioIOData& io, SoundSource& src, int index, Vec3d& relpos, const int& numFrames, float *samples){
+	if(mNumSpeakers == 0) return;
+
+	float gains[DBAP_MAX_NUM_SPEAKERS];
+	computeGains(gains, relpos);
+
+	// Interpolate from the gains of the previous block to avoid zipper noise.
+	// Sources without state (index beyond numSources()) are not interpolated.
+	float * prevGains = gains;
+	if(index >= 0 && index < mNumSources){
+		prevGains = &mPrevGains[index * mNumSpeakers];
+		if(prevGains[0] < 0.f) std::copy(gains, gains + mNumSpeakers, prevGains);
+	}
+
+	const float invFrames = 1.f / numFrames;
 	for (int k = 0; k < mNumSpeakers; ++k)
 	{
-		float gain = 1.f;
-		if(mEnabled)
-		{
-			Vec3d vec = relpos - mSpeakerVecs[k];
-			float dist = vec.mag();
-			gain = 1.f / (1.f + dist);
-			gain = powf(gain, mFocus);
-		}
-
 		float * out = io.outBuffer(mDeviceChannels[k]);
-		for(int i = 0; i < numFrames; ++i){
-			out[i] += gain * samples[i];
+		float gain = prevGains[k];
+		float gainInc = (gains[k] - gain) * invFrames;
+
+		if(gainInc == 0.f){
+			for(int i = 0; i < numFrames; ++i){
+				out[i] += gain * samples[i];
+			}
+		}
+		else{
+			for(int i = 0; i < numFrames; ++i){
+				out[i] += (gain + gainInc*(i+1)) * samples[i];
+			}
 		}
+		prevGains[k] = gains[k];
 	}
 }
 
-void Dbap::perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample)
+void Dbap::perform(AudioIOData& io, SoundSource& src, int index, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample)
 {
+	float gains[DBAP_MAX_NUM_SPEAKERS];
+	computeGains(gains, relpos);
+
 	for (int i = 0; i < mNumSpeakers; ++i)
 	{
-		float gain = 1.f;
-		if(mEnabled)
-		{
-			Vec3d vec = relpos - mSpeakerVecs[i];
-			float dist = vec.mag();
-			gain = 1.f / (1.f + dist);
-			gain = powf(gain, mFocus);
-		}
-
-		io.out(mDeviceChannels[i], frameIndex) += gain*sample;
+		io.out(mDeviceChannels[i], frameIndex) += gains[i]*sample;
 	}
 }
 
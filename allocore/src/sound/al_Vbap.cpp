@@ -59,9 +59,10 @@ Vbap::Vbap(const SpeakerLayout &sl)
 void Vbap::addTriple(const SpeakerTriple& st) {
 	mTriplets.push_back(st);
 	++mNumTriplets;
+	mBinStart.clear(); // lookup table is rebuilt by compile()
 }
 
-Vec3d Vbap::computeGains(const Vec3d& vecA, const SpeakerTriple& speak) {
+Vec3d Vbap::computeGains(const Vec3d& vecA, const SpeakerTriple& speak) const {
 	const Mat3d& mat = speak.mat;
 	unsigned dimensions = mIs3D ? 3 : 2;
 	Vec3d vec(0., 0., 0.);
@@ -76,6 +77,189 @@ Vec3d Vbap::computeGains(const Vec3d& vecA, const SpeakerTriple& speak) {
 }
 
 
+
+// Number of bins per cube face edge (3D) and around the circle (2D)
+static const int cubeBins = 8;
+static const int ringBins = 90;
+
+// Tolerance, in radians, when assigning triplets to bins
+static const double binMargin = 1e-3;
+
+static bool inside(const Vec3d& gains, bool is3D){
+	return (gains[0] >= 0) && (gains[1] >= 0) && (!is3D || (gains[2] >= 0));
+}
+
+bool Vbap::findTriplet(const Vec3d& vec, unsigned& index, Vec3d& gains) const {
+
+	// Sources usually stay within the same triplet across blocks
+	Vec3d gainsTemp = computeGains(vec, mTriplets[index]);
+	if(inside(gainsTemp, mIs3D)){
+		gains = gainsTemp;
+		return true;
+	}
+
+	// No lookup table: search thru the triplets array
+	if(mBinStart.empty()){
+		unsigned i = index;
+		for(unsigned count = 1; count < mNumTriplets; ++count){
+			if(++i >= mNumTriplets) i = 0;
+			gainsTemp = computeGains(vec, mTriplets[i]);
+			if(inside(gainsTemp, mIs3D)){
+				index = i;
+				gains = gainsTemp;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Test the candidates of the bin, keeping the first match in cyclic order
+	// from index so ties on shared edges resolve like a linear search.
+	int b = bin(vec);
+	unsigned best = index;
+	unsigned bestOffset = mNumTriplets;
+	for(unsigned k = mBinStart[b]; k < mBinStart[b+1]; ++k){
+		unsigned i = mBinTriplets[k];
+		unsigned offset = (i + mNumTriplets - index) % mNumTriplets;
+		if(offset == 0 || offset >= bestOffset) continue;
+		gainsTemp = computeGains(vec, mTriplets[i]);
+		if(inside(gainsTemp, mIs3D)){
+			best = i;
+			bestOffset = offset;
+			gains = gainsTemp;
+		}
+	}
+
+	if(bestOffset == mNumTriplets) return false;
+	index = best;
+	return true;
+}
+
+int Vbap::numBins() const {
+	return mIs3D ? 6*cubeBins*cubeBins : ringBins;
+}
+
+int Vbap::bin(const Vec3d& vec) const {
+	if(!mIs3D){
+		double a = (atan2(vec[1], vec[0]) + M_PI) / (2*M_PI);
+		int i = a * ringBins;
+		return i < 0 ? 0 : (i >= ringBins ? ringBins-1 : i);
+	}
+
+	// Project onto face of cube along the major axis
+	int axis = 0;
+	if(fabs(vec[1]) > fabs(vec[axis])) axis = 1;
+	if(fabs(vec[2]) > fabs(vec[axis])) axis = 2;
+	double major = fabs(vec[axis]);
+	if(major == 0) return 0;
+	int face = axis*2 + (vec[axis] < 0);
+	double u = vec[(axis+1)%3] / major;
+	double v = vec[(axis+2)%3] / major;
+	int iu = (u + 1) * 0.5 * cubeBins;
+	int iv = (v + 1) * 0.5 * cubeBins;
+	if(iu >= cubeBins) iu = cubeBins-1;
+	if(iv >= cubeBins) iv = cubeBins-1;
+	return (face*cubeBins + iv)*cubeBins + iu;
+}
+
+// Get a spherical cap (center direction and angular radius) enclosing a bin
+void Vbap::binCap(int b, Vec3d& center, double& radius) const {
+	if(!mIs3D){
+		double az = (b + 0.5) / ringBins * 2*M_PI - M_PI;
+		center.set(cos(az), sin(az), 0);
+		radius = M_PI / ringBins;
+		return;
+	}
+
+	int iu = b % cubeBins;
+	int iv = (b / cubeBins) % cubeBins;
+	int face = b / (cubeBins*cubeBins);
+	int axis = face/2;
+	double sign = (face & 1) ? -1 : 1;
+
+	struct{
+		int axis; double sign;
+		Vec3d operator()(double u, double v) const {
+			Vec3d r;
+			r[axis] = sign;
+			r[(axis+1)%3] = u;
+			r[(axis+2)%3] = v;
+			return r.normalize();
+		}
+	} facePoint = {axis, sign};
+
+	double u0 = double(iu)/cubeBins*2 - 1, u1 = double(iu+1)/cubeBins*2 - 1;
+	double v0 = double(iv)/cubeBins*2 - 1, v1 = double(iv+1)/cubeBins*2 - 1;
+	center = facePoint((u0+u1)*0.5, (v0+v1)*0.5);
+
+	// Bins are bounded by great circles, so the corners are farthest away
+	radius = 0;
+	Vec3d corners[4] = {
+		facePoint(u0,v0), facePoint(u1,v0), facePoint(u0,v1), facePoint(u1,v1)
+	};
+	for(int i=0; i<4; ++i){
+		double a = angle(center, corners[i]);
+		if(a > radius) radius = a;
+	}
+}
+
+// Get angle from a direction to the region covered by a triplet
+double Vbap::angleToTriple(const Vec3d& dir, const SpeakerTriple& triple) const {
+	if(inside(computeGains(dir, triple), mIs3D)) return 0;
+
+	int numVerts = mIs3D ? 3 : 2;
+	Vec3d verts[3];
+	for(int i=0; i<numVerts; ++i){
+		verts[i] = triple.vec[i];
+		if(!mIs3D) verts[i][2] = 0;
+		verts[i].normalize();
+	}
+
+	double minAngle = M_PI;
+	for(int i=0; i<numVerts; ++i){
+		double a = angle(dir, verts[i]);
+		if(a < minAngle) minAngle = a;
+	}
+
+	if(mIs3D){
+		// Check distance to interior of edge arcs
+		for(int i=0; i<3; ++i){
+			const Vec3d& a = verts[i];
+			const Vec3d& b = verts[(i+1)%3];
+			Vec3d n = cross(a, b);
+			if(n.mag() == 0) continue;
+			n.normalize();
+			double s = dir.dot(n);
+			Vec3d p = dir - n*s;
+			if(p.mag() == 0) continue;
+			p.normalize();
+			if(cross(a, p).dot(n) >= 0 && cross(p, b).dot(n) >= 0){
+				double d = asin(fabs(s) < 1 ? fabs(s) : 1.);
+				if(d < minAngle) minAngle = d;
+			}
+		}
+	}
+	return minAngle;
+}
+
+void Vbap::buildLookup(){
+	int nb = numBins();
+	mBinStart.resize(nb + 1);
+	mBinTriplets.clear();
+	for(int b=0; b<nb; ++b){
+		Vec3d center;
+		double radius;
+		binCap(b, center, radius);
+		mBinStart[b] = mBinTriplets.size();
+		for(unsigned i=0; i<mTriplets.size(); ++i){
+			if(angleToTriple(center, mTriplets[i]) <= radius + binMargin){
+				mBinTriplets.push_back(i);
+			}
+		}
+	}
+	mBinStart[nb] = mBinTriplets.size();
+}
+
 // 2D VBAP, find pairs of speakers.
 void Vbap::findSpeakerPairs(const std::vector<Speaker>& spkrs){
 
@@ -398,12 +582,26 @@ void Vbap::compile(Listener& listener){
 		printf("No SpeakerSets found. Check mode setting or speaker layout.\n");
 		throw -1;
 	}
+
+	buildLookup();
+	mSourceTriplets.assign(mSourceTriplets.size(), 0);
+}
+
+void Vbap::numSources(int num){
+	mSourceTriplets.resize(num, 0);
+}
+
+void Vbap::removeSource(int index){
+	if(index >= int(mSourceTriplets.size())) return;
+	mSourceTriplets.erase(mSourceTriplets.begin() + index);
+	mSourceTriplets.push_back(0);
 }
 
 //Per buffer
-void Vbap::perform(AudioIOData& io,SoundSource& src,Vec3d& relpos,const int& numFrames,float *samples){
+void Vbap::perform(AudioIOData& io,SoundSource& src,int index,Vec3d& relpos,const int& numFrames,float *samples){
 
-	unsigned currentTripletIndex = src.cachedIndex();
+	bool cached = index >= 0 && index < int(mSourceTriplets.size());
+	unsigned currentTripletIndex = cached ? mSourceTriplets[index] : 0;
 	// unsigned currentTripletIndex = mCachedTripletIndex; // Cached source placement, so it starts searching from there.
 
 	Vec3d vec = Vec3d(relpos);
@@ -416,77 +614,69 @@ void Vbap::perform(AudioIOData& io,SoundSource& src,Vec3d& relpos,const int& num
 	Vec3d gains;
 	Vec3d gainsTemp;
 
-	// Search thru the triplets array in search of a match for the source position.
-	for (unsigned count = 0; count < mNumTriplets; ++count) {
-		gainsTemp = computeGains(vec, mTriplets[currentTripletIndex]);
-		if ((gainsTemp[0] >= 0) && (gainsTemp[1] >= 0) && (!mIs3D || (gainsTemp[2] >= 0)) ){
-			gainsTemp.normalize();
-			gains  = gainsTemp/relpos.mag();
-
-			SpeakerTriple triple = mTriplets[currentTripletIndex];
+	// Find the triplet containing the source position
+	if (findTriplet(vec, currentTripletIndex, gainsTemp)) {
+		gainsTemp.normalize();
+		gains  = gainsTemp/relpos.mag();
 
-			float * outBuff1 = io.outBuffer(triple.s1Chan);
-			float * outBuff2 = io.outBuffer(triple.s2Chan);
-			float * outBuff3 = nullptr;
-			if(mIs3D) {
-				outBuff3 = io.outBuffer(triple.s3Chan);
-			}
+		SpeakerTriple triple = mTriplets[currentTripletIndex];
 
-			// Check if any of the triplets are phantom channels and
-			// reassign signal
-			auto it1 = mPhantomChannels.find(triple.s1Chan);
-			auto it2 = mPhantomChannels.find(triple.s2Chan);
-			auto it3 = mPhantomChannels.find(triple.s3Chan);
+		float * outBuff1 = io.outBuffer(triple.s1Chan);
+		float * outBuff2 = io.outBuffer(triple.s2Chan);
+		float * outBuff3 = nullptr;
+		if(mIs3D) {
+			outBuff3 = io.outBuffer(triple.s3Chan);
+		}
 
-			for(int i = 0; i < numFrames; ++i){
-				if (it1 != mPhantomChannels.end()) { // vertex 1 is phantom
-					float splitGain = gains[0] /mPhantomChannels.size();
-					float splitGainSQ = splitGain * splitGain;
-					for(auto const &element : it1->second) { // iterate across all assigned speakers
-						io.out(element, i) += samples[i]*splitGainSQ;
-					}
-				} else {
-					outBuff1[i] += samples[i]*gains[0];
+		// Check if any of the triplets are phantom channels and
+		// reassign signal
+		auto it1 = mPhantomChannels.find(triple.s1Chan);
+		auto it2 = mPhantomChannels.find(triple.s2Chan);
+		auto it3 = mPhantomChannels.find(triple.s3Chan);
+
+		for(int i = 0; i < numFrames; ++i){
+			if (it1 != mPhantomChannels.end()) { // vertex 1 is phantom
+				float splitGain = gains[0] /mPhantomChannels.size();
+				float splitGainSQ = splitGain * splitGain;
+				for(auto const &element : it1->second) { // iterate across all assigned speakers
+					io.out(element, i) += samples[i]*splitGainSQ;
+				}
+			} else {
+				outBuff1[i] += samples[i]*gains[0];
+			}
+			if (it2 != mPhantomChannels.end()) { // vertex 2 is phantom
+				float splitGain = gains[1] /mPhantomChannels.size();
+				float splitGainSQ = splitGain * splitGain;
+				for(auto const &element : it2->second) {
+					io.out(element, i) += samples[i]*splitGainSQ;
 				}
-				if (it2 != mPhantomChannels.end()) { // vertex 2 is phantom
-					float splitGain = gains[1] /mPhantomChannels.size();
+			} else {
+				outBuff2[i] += samples[i]*gains[1];
+			}
+			if(mIs3D){
+				if (it3 != mPhantomChannels.end()) {
+					float splitGain = gains[2] /mPhantomChannels.size();
 					float splitGainSQ = splitGain * splitGain;
-					for(auto const &element : it2->second) {
+					for(auto const &element : it3->second) {
 						io.out(element, i) += samples[i]*splitGainSQ;
 					}
 				} else {
-					outBuff2[i] += samples[i]*gains[1];
+					outBuff3[i] += samples[i]*gains[2];
 				}
-				if(mIs3D){
-					if (it3 != mPhantomChannels.end()) {
-						float splitGain = gains[2] /mPhantomChannels.size();
-						float splitGainSQ = splitGain * splitGain;
-						for(auto const &element : it3->second) {
-							io.out(element, i) += samples[i]*splitGainSQ;
-						}
-					} else {
-						outBuff3[i] += samples[i]*gains[2];
-					}
-				}
-
 			}
-			break;
-		}
 
-		++currentTripletIndex;
-		if (currentTripletIndex >= mNumTriplets){
-			currentTripletIndex = 0;
 		}
 	}
 
-	src.cachedIndex(currentTripletIndex);
+	if(cached) mSourceTriplets[index] = currentTripletIndex;
 	//mCachedTripletIndex = currentTripletIndex; // Store the new index
 }
 
 //per sample
-void Vbap::perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample){
+void Vbap::perform(AudioIOData& io, SoundSource& src, int index, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample){
 
-	unsigned currentTripletIndex = src.cachedIndex();
+	bool cached = index >= 0 && index < int(mSourceTriplets.size());
+	unsigned currentTripletIndex = cached ? mSourceTriplets[index] : 0;
 	//unsigned currentTripletIndex = mCachedTripletIndex; // Cached source placement, so it starts searching from there.
 
 	Vec3d vec = Vec3d(relpos);
@@ -499,26 +689,17 @@ void Vbap::perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int&
 	Vec3d gains;
 	Vec3d gainsTemp;
 
-	// Search thru the triplets array in search of a match for the source position.
-	for (unsigned count = 0; count < mNumTriplets; ++count) {
-		gainsTemp = computeGains(vec, mTriplets[currentTripletIndex]);
-		if ((gainsTemp[0] >= 0) && (gainsTemp[1] >= 0) && (!mIs3D || (gainsTemp[2] >= 0)) ){
-			gainsTemp.normalize();
-			gains = gainsTemp*sample/relpos.mag();
-			break;
-		}
-
-		++currentTripletIndex;
-		if (currentTripletIndex >= mNumTriplets){
-			currentTripletIndex = 0;
-		}
+	// Find the triplet containing the source position
+	if (findTriplet(vec, currentTripletIndex, gainsTemp)) {
+		gainsTemp.normalize();
+		gains = gainsTemp*sample/relpos.mag();
 	}
 
 	SpeakerTriple triple = mTriplets[currentTripletIndex];
 
 	//mCachedTripletIndex = currentTripletIndex; // Store the new index
 
-	src.cachedIndex(currentTripletIndex);
+	if(cached) mSourceTriplets[index] = currentTripletIndex;
 
 	// Check if any of the triplets are phantom channels and
 	// reassign signal
@@ -1,5 +1,7 @@
+#include <algorithm>
 #include "allocore/spatial/al_HashSpace.hpp"
 #include "allocore/math/al_Functions.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
 
 using namespace al;
 
@@ -14,7 +16,8 @@ HashSpace :: HashSpace(uint32_t resolution, uint32_t numObjects)
 	mDim3(mDim2*mDim),
 	mDimHalf(mDim/2),
 	mWrap(mDim-1),
-	mWrap3(mDim3-1)
+	mWrap3(mDim3-1),
+	mPacked(false)
 {
 	//printf("shift %d shift2 %d dim %d dim3 %d wrap %d wrap3 %d\n",
 //		mShift, mShift2, mDim, mDim3, mWrap, mWrap3);
@@ -99,3 +102,270 @@ HashSpace :: HashSpace(uint32_t resolution, uint32_t numObjects)
 
 HashSpace :: ~HashSpace() {}
 
+// Sorts a range of objects by voxel. In the first pass, the objects' hashes
+// are computed and counted per voxel. In the second, after the counts of
+// all ranges have been turned into offsets, the objects are scattered into
+// the packed arrays.
+struct HashSpace::Packer {
+	HashSpace * space;
+	uint32_t range[2];		// range of objects
+	uint32_t * counts;		// per voxel counts, then offsets
+
+	void count() {
+		HashSpace& s = *space;
+		memset(counts, 0, s.mDim3*sizeof(uint32_t));
+		for (uint32_t i=range[0]; i<range[1]; i++) {
+			Object& o = s.mObjects[i];
+			o.pos.set(s.wrap(o.pos));
+			o.hash = s.hash(o.pos);
+			o.next = o.prev = NULL;
+			counts[o.hash]++;
+		}
+	}
+
+	void scatter() {
+		HashSpace& s = *space;
+		for (uint32_t i=range[0]; i<range[1]; i++) {
+			const Object& o = s.mObjects[i];
+			uint32_t k = counts[o.hash]++;
+			s.mPackedX[k] = o.pos.x;
+			s.mPackedY[k] = o.pos.y;
+			s.mPackedZ[k] = o.pos.z;
+			s.mPackedIds[k] = i;
+		}
+	}
+};
+
+HashSpace& HashSpace :: rebuild(int numThreads) {
+	const uint32_t numObjects = mObjects.size();
+	if (numThreads < 1) numThreads = 1;
+
+	mPackedStart.resize(mDim3+1);
+	mPackedX.resize(numObjects);
+	mPackedY.resize(numObjects);
+	mPackedZ.resize(numObjects);
+	mPackedIds.resize(numObjects);
+	mPackCounts.resize(mDim3 * numThreads);
+
+	// the per voxel lists are replaced by the packed arrays:
+	if (!mPacked) {
+		for (unsigned i=0; i<mVoxels.size(); i++) {
+			mVoxels[i].mObjects = NULL;
+		}
+	}
+
+	std::vector<Packer> packers(numThreads);
+	for (int t=0; t<numThreads; t++) {
+		Packer& p = packers[t];
+		p.space = this;
+		p.range[0] = uint64_t(numObjects) * t / numThreads;
+		p.range[1] = uint64_t(numObjects) * (t+1) / numThreads;
+		p.counts = &mPackCounts[t * mDim3];
+	}
+	ThreadPool& pool = ThreadPool::global();
+	pool.parallelFor(0, numThreads, [&packers](int t){ packers[t].count(); }, 1);
+
+	// turn counts into offsets; each thread's objects in a voxel follow
+	// those of the previous threads, so the sort is stable
+	uint32_t offset = 0;
+	for (uint32_t v=0; v<mDim3; v++) {
+		mPackedStart[v] = offset;
+		for (int t=0; t<numThreads; t++) {
+			uint32_t& c = mPackCounts[t * mDim3 + v];
+			uint32_t count = c;
+			c = offset;
+			offset += count;
+		}
+	}
+	mPackedStart[mDim3] = offset;
+
+	pool.parallelFor(0, numThreads, [&packers](int t){ packers[t].scatter(); }, 1);
+
+	mPacked = true;
+	return *this;
+}
+
+void HashSpace :: unpack() {
+	for (uint32_t k=0; k<mPackedIds.size(); k++) {
+		Object& o = mObjects[mPackedIds[k]];
+		mVoxels[o.hash].add(&o);
+	}
+	mPacked = false;
+}
+
+
+// Finds the k nearest objects to a range of points. Candidates are kept in
+// a max-heap of (distance squared, object index) pairs, so the furthest of
+// the current k best is at the top and is replaced by any closer object.
+struct HashSpace::Searcher {
+	typedef std::pair<double, uint32_t> Candidate;
+
+	const HashSpace * space;
+	const Vec3d * centers;	// NULL to search around all objects
+	uint32_t range[2];		// range of points
+	uint32_t k;
+	double maxRadius;
+	uint32_t * ids;
+	double * distancesSquared;
+	uint32_t found;
+	std::vector<Candidate> heap;
+
+	void run() {
+		found = 0;
+		heap.reserve(k);
+		const HashSpace& s = *space;
+		for (uint32_t i=range[0]; i<range[1]; i++) {
+			if (centers) {
+				found += search(s.wrap(centers[i]), invalidHash(), i);
+			} else if (s.mPacked) {
+				// visit objects in voxel order, so that neighboring
+				// searches find each other's voxels in the cache
+				uint32_t id = s.mPackedIds[i];
+				found += search(Vec3d(s.mPackedX[i], s.mPackedY[i], s.mPackedZ[i]), id, id);
+			} else {
+				found += search(s.mObjects[i].pos, i, i);
+			}
+		}
+	}
+
+	// same as wrapRelative(), for positions in [0, dim]
+	double relative(double x) const {
+		double t = x + space->mDimHalf;
+		if (t > space->mDim) t -= space->mDim;
+		else if (t < 0.) t += space->mDim;
+		return t - space->mDimHalf;
+	}
+
+	// lower bound of the distance along an axis from a center at fraction f
+	// of its voxel to the voxel at signed offset o
+	double gap(int o, double f) const {
+		if (o > 0) return o - f;
+		if (o == -space->mDimHalf) return -o - 1;	// either side may wrap
+		if (o < 0) return f - (o + 1);
+		return 0.;
+	}
+
+	void consider(double x, double y, double z, uint32_t id, const Vec3d& center, double maxr2) {
+		x = relative(x - center.x);
+		y = relative(y - center.y);
+		z = relative(z - center.z);
+		double d2 = x*x + y*y + z*z;
+		if (d2 > maxr2) return;
+		Candidate c(d2, id);
+		if (heap.size() < k) {
+			heap.push_back(c);
+			std::push_heap(heap.begin(), heap.end());
+		} else if (c < heap.front()) {
+			std::pop_heap(heap.begin(), heap.end());
+			heap.back() = c;
+			std::push_heap(heap.begin(), heap.end());
+		}
+	}
+
+	uint32_t search(const Vec3d& center, uint32_t self, uint32_t point) {
+		const HashSpace& s = *space;
+		const double maxr2 = maxRadius*maxRadius;
+		// an object in a voxel at integer offset distance d from the
+		// center's voxel is more than d - sqrt(3) away from the center
+		const double slack = 1.7320508075688772;
+		const double fx = center.x - floor(center.x);
+		const double fy = center.y - floor(center.y);
+		const double fz = center.z - floor(center.z);
+		heap.clear();
+
+		for (uint32_t i=0; i<s.mVoxelIndices.size(); i++) {
+			if (s.mVoxelIndicesToDistance[i]) {
+				// start of a new shell; stop once nothing closer can be found
+				double shell = sqrt(double(s.mVoxelIndicesToDistance[i])) - slack;
+				if (shell > 0) {
+					double bound2 = shell*shell;
+					if (bound2 > maxr2) break;
+					if (heap.size() == k && bound2 > heap.front().first) break;
+				}
+			}
+
+			// skip voxels that are too far to hold a better candidate
+			uint32_t offset = s.mVoxelIndices[i];
+			int ox = s.unhashx(offset), oy = s.unhashy(offset), oz = s.unhashz(offset);
+			if (ox >= s.mDimHalf) ox -= s.mDim;
+			if (oy >= s.mDimHalf) oy -= s.mDim;
+			if (oz >= s.mDimHalf) oz -= s.mDim;
+			double gx = gap(ox, fx), gy = gap(oy, fy), gz = gap(oz, fz);
+			double gap2 = gx*gx + gy*gy + gz*gz;
+			if (gap2 > maxr2) continue;
+			if (heap.size() == k && gap2 > heap.front().first) continue;
+
+			uint32_t index = s.hash(center, offset);
+			if (s.mPacked) {
+				uint32_t end = s.mPackedStart[index+1];
+				for (uint32_t j = s.mPackedStart[index]; j < end; j++) {
+					uint32_t id = s.mPackedIds[j];
+					if (id != self) {
+						consider(s.mPackedX[j], s.mPackedY[j], s.mPackedZ[j], id, center, maxr2);
+					}
+				}
+			} else if (const Object * head = s.mVoxels[index].mObjects) {
+				const Object * o = head;
+				do {
+					uint32_t id = o - &s.mObjects[0];
+					if (id != self) consider(o->pos.x, o->pos.y, o->pos.z, id, center, maxr2);
+					o = o->next;
+				} while (o != head);
+			}
+		}
+
+		// write out in increasing order of distance
+		std::sort_heap(heap.begin(), heap.end());
+		uint32_t * pids = ids + uint64_t(point)*k;
+		double * pd2 = distancesSquared ? distancesSquared + uint64_t(point)*k : NULL;
+		for (uint32_t j=0; j<k; j++) {
+			bool valid = j < heap.size();
+			pids[j] = valid ? heap[j].second : invalidHash();
+			if (pd2) pd2[j] = valid ? heap[j].first : 0.;
+		}
+		return heap.size();
+	}
+};
+
+uint32_t HashSpace :: search(
+	const Vec3d * centers, uint32_t n, uint32_t k, double maxRadius,
+	uint32_t * ids, double * distancesSquared, int numThreads
+) const {
+	if (0 == k || 0 == n) return 0;
+	if (numThreads < 1) numThreads = 1;
+	if (uint32_t(numThreads) > n) numThreads = n;
+
+	std::vector<Searcher> searchers(numThreads);
+	for (int t=0; t<numThreads; t++) {
+		Searcher& w = searchers[t];
+		w.space = this;
+		w.centers = centers;
+		w.range[0] = uint64_t(n) * t / numThreads;
+		w.range[1] = uint64_t(n) * (t+1) / numThreads;
+		w.k = k;
+		w.maxRadius = al::min(maxRadius, double(mDimHalf));
+		w.ids = ids;
+		w.distancesSquared = distancesSquared;
+	}
+	ThreadPool::global().parallelFor(0, numThreads, [&searchers](int t){
+		searchers[t].run();
+	}, 1);
+
+	uint32_t found = 0;
+	for (int t=0; t<numThreads; t++) found += searchers[t].found;
+	return found;
+}
+
+uint32_t HashSpace :: nearest(
+	const Vec3d * centers, uint32_t n, uint32_t k, double maxRadius,
+	uint32_t * ids, double * distancesSquared, int numThreads
+) const {
+	return search(centers, n, k, maxRadius, ids, distancesSquared, numThreads);
+}
+
+uint32_t HashSpace :: nearestAll(
+	uint32_t k, double maxRadius,
+	uint32_t * ids, double * distancesSquared, int numThreads
+) const {
+	return search(NULL, numObjects(), k, maxRadius, ids, distancesSquared, numThreads);
+}
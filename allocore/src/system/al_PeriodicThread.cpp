@@ -1,12 +1,24 @@
 #include <algorithm>
+#include "allocore/system/al_Config.h"
 #include "allocore/system/al_PeriodicThread.hpp"
+#include "allocore/system/al_Printing.hpp"
+
+#ifdef AL_LINUX
+	#include <errno.h>
+	#include <pthread.h>
+	#include <sched.h>
+	#include <time.h>
+#endif
 
 namespace al{
 
 PeriodicThread::PeriodicThread(double periodSec)
-:	mAutocorrect(0.1)
+:	mAutocorrect(0.1),
+	mPrecise(false), mCatchUp(SKIP), mSpin(100000), mRealtime(0), mCPU(-1),
+	mTiming(new Timing)
 {
 	period(periodSec);
+	resetStats();
 }
 
 PeriodicThread::PeriodicThread(const PeriodicThread& o)
@@ -14,8 +26,17 @@ PeriodicThread::PeriodicThread(const PeriodicThread& o)
 	mTimePrev(o.mTimePrev), mWait(o.mWait), mTimeBehind(o.mTimeBehind),
 	mAutocorrect(o.mAutocorrect),
 	mUserFunc(o.mUserFunc),
-	mRun(o.mRun)
-{}
+	mRun(o.mRun),
+	mPrecise(o.mPrecise), mCatchUp(o.mCatchUp), mSpin(o.mSpin),
+	mRealtime(o.mRealtime), mCPU(o.mCPU),
+	mTiming(new Timing)
+{
+	resetStats();
+}
+
+PeriodicThread::~PeriodicThread(){
+	delete mTiming;
+}
 
 
 
@@ -38,6 +59,57 @@ double PeriodicThread::period() const {
 	return mPeriod * 1e-9;
 }
 
+PeriodicThread& PeriodicThread::spin(double sec){
+	mSpin = sec * 1e9;
+	return *this;
+}
+
+PeriodicThread::Stats PeriodicThread::stats() const {
+	const Timing& T = *mTiming;
+	Stats s;
+	s.periods = T.periods.load();
+	s.missed = T.missed.load();
+	s.min = s.mean = s.p99 = s.max = 0;
+	if(s.periods){
+		s.min = T.min.load() * 1e-9;
+		s.max = T.max.load() * 1e-9;
+		s.mean = T.sum.load() * 1e-9 / s.periods;
+
+		// find bin holding the 99th percentile; the last bin has no upper
+		// edge, so use the maximum
+		unsigned long long rank = (s.periods * 99 + 99) / 100, count = 0;
+		int i = 0;
+		for(; i<NUM_BINS-1; ++i){
+			count += T.bins[i].load();
+			if(count >= rank) break;
+		}
+		s.p99 = i < NUM_BINS-1 ? std::min((i+1) * 1e-6, s.max) : s.max;
+	}
+	return s;
+}
+
+void PeriodicThread::resetStats(){
+	Timing& T = *mTiming;
+	for(int i=0; i<NUM_BINS; ++i) T.bins[i] = 0;
+	T.periods = 0;
+	T.missed = 0;
+	T.sum = 0;
+	T.min = 0;
+	T.max = 0;
+}
+
+void PeriodicThread::record(al_nsec late){
+	Timing& T = *mTiming;
+	if(late < 0) late = 0;
+	int bin = std::min(late / 1000, al_nsec(NUM_BINS-1));
+	T.bins[bin].fetch_add(1, std::memory_order_relaxed);
+	if(0 == T.periods.fetch_add(1, std::memory_order_relaxed) || late < T.min.load()){
+		T.min = late;
+	}
+	if(late > T.max.load()) T.max = late;
+	T.sum.fetch_add(late, std::memory_order_relaxed);
+}
+
 void PeriodicThread::start(ThreadFunction& func){
 	mUserFunc = &func;
 	mRun = true;
@@ -59,6 +131,12 @@ void swap(PeriodicThread& a, PeriodicThread& b){
 	SWAP_(mWait);
 	SWAP_(mUserFunc);
 	SWAP_(mRun);
+	SWAP_(mPrecise);
+	SWAP_(mCatchUp);
+	SWAP_(mSpin);
+	SWAP_(mRealtime);
+	SWAP_(mCPU);
+	SWAP_(mTiming);
 	#undef SWAP_
 }
 
@@ -67,12 +145,90 @@ PeriodicThread& PeriodicThread::operator= (PeriodicThread other){
 	return *this;
 }
 
+void PeriodicThread::setScheduling(){
+#ifdef AL_LINUX
+	if(mRealtime > 0){
+		struct sched_param param;
+		param.sched_priority = std::min(mRealtime, 99);
+		if(0 != pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)){
+			AL_WARN("PeriodicThread: could not set SCHED_FIFO priority %d", mRealtime);
+		}
+	}
+	if(mCPU >= 0){
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(mCPU, &cpus);
+		if(0 != pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)){
+			AL_WARN("PeriodicThread: could not pin thread to CPU %d", mCPU);
+		}
+	}
+#endif
+}
+
+void PeriodicThread::sleepUntil(al_nsec deadline){
+	al_nsec wake = deadline - mSpin;
+	al_nsec now = al_steady_time_nsec();
+	if(wake > now){
+	#ifdef AL_LINUX
+		// absolute deadline, so time spent getting here does not add up
+		struct timespec ts;
+		ts.tv_sec = wake / 1000000000;
+		ts.tv_nsec = wake % 1000000000;
+		while(EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)){}
+	#else
+		al_sleep_nsec(wake - now);
+	#endif
+	}
+	while(al_steady_time_nsec() < deadline){}
+}
+
+void PeriodicThread::goPrecise(){
+	al_nsec deadline = al_steady_time_nsec();
+	al_nsec lastMissed = deadline - mPeriod;	// last deadline counted as missed
+	while(mRun){
+		sleepUntil(deadline);
+		record(al_steady_time_nsec() - deadline);
+
+		(*mUserFunc)();
+
+		deadline += mPeriod;
+		al_nsec end = al_steady_time_nsec();
+		if(end > deadline){
+			// count deadlines passed during the call, but not those passed
+			// during earlier calls of a burst
+			al_nsec last = deadline + (end - deadline) / mPeriod * mPeriod;
+			al_nsec first = std::max(deadline, lastMissed + mPeriod);
+			if(last >= first){
+				mTiming->missed.fetch_add((last - first) / mPeriod + 1, std::memory_order_relaxed);
+				lastMissed = last;
+			}
+			switch(mCatchUp){
+			case SKIP:		deadline = last + mPeriod; break;
+			case BURST:		break;
+			case STRETCH:	deadline = end; lastMissed = end - mPeriod; break;
+			}
+		}
+	}
+}
+
 void PeriodicThread::go(){
+	setScheduling();
+	if(mPrecise){
+		goPrecise();
+		return;
+	}
+
 	// Note: times are al_nsec (long long int)
 	mTimeCurr = al_steady_time_nsec();
 	mWait = 0;
 	mTimeBehind = 0;
+	al_nsec deadline = mTimeCurr;
 	while(mRun){
+		// the deadline of a call is one period after the previous call
+		al_nsec now = al_steady_time_nsec();
+		record(now - deadline);
+		deadline = now + mPeriod;
+
 		(*mUserFunc)();
 
 		mTimePrev = mTimeCurr + mWait;
@@ -91,6 +247,7 @@ void PeriodicThread::go(){
 		else{
 			mWait = 0;
 			mTimeBehind += dt - mPeriod;
+			mTiming->missed.fetch_add(1, std::memory_order_relaxed);
 		}
 
 		if(mTimeBehind > 0){
@@ -0,0 +1,199 @@
+#include "allocore/system/al_Info.hpp"
+#include "allocore/system/al_Printing.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
+
+namespace al{
+
+// Pool and queue index of the worker running on this thread, if any
+static thread_local ThreadPool * tPool = NULL;
+static thread_local int tIndex = -1;
+
+ThreadPool::ThreadPool(int numThreads)
+:	mQueued(0), mSleeping(0), mNext(0), mStop(false), mRTRunning(false)
+{
+	if(numThreads < 1) numThreads = numProcessors();
+	if(numThreads < 1) numThreads = 1;
+
+	// workers are referenced by their threads, so must not move
+	mWorkers.resize(numThreads);
+	for(int i=0; i<numThreads; ++i){
+		mQueues.push_back(new Queue);
+		mWorkers[i].pool = this;
+		mWorkers[i].index = i;
+	}
+	for(int i=0; i<numThreads; ++i){
+		mThreads.push_back(new Thread(mWorkers[i]));
+	}
+}
+
+ThreadPool::~ThreadPool(){
+	{
+		std::lock_guard<std::mutex> lk(mSleepLock);
+		mStop = true;
+	}
+	mWake.notify_all();
+	for(unsigned i=0; i<mThreads.size(); ++i){
+		mThreads[i]->join();
+		delete mThreads[i];
+	}
+
+	if(mRTRunning){
+		{
+			std::lock_guard<std::mutex> lk(mRTQueue.lock);
+			mRTRunning = false;
+		}
+		mRTWake.notify_all();
+		mRTThread.join();
+	}
+
+	for(unsigned i=0; i<mQueues.size(); ++i) delete mQueues[i];
+}
+
+ThreadPool& ThreadPool::global(){
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::submit(const Task& task){
+	// workers keep their own tasks; others are dealt out in turn
+	int i = tPool == this ? tIndex : int(mNext++ % mQueues.size());
+	{
+		std::lock_guard<std::mutex> lk(mQueues[i]->lock);
+		mQueues[i]->tasks.push_back(task);
+	}
+	++mQueued;
+
+	// a worker about to sleep either sees the task or is counted here
+	if(mSleeping.load() > 0){
+		std::lock_guard<std::mutex> lk(mSleepLock);
+		mWake.notify_one();
+	}
+}
+
+bool ThreadPool::pop(int index, Task& task){
+	if(mQueued.load() == 0) return false;
+	const int N = mQueues.size();
+
+	// newest task from own queue
+	if(index >= 0){
+		Queue& q = *mQueues[index];
+		std::lock_guard<std::mutex> lk(q.lock);
+		if(!q.tasks.empty()){
+			task.swap(q.tasks.back());
+			q.tasks.pop_back();
+			--mQueued;
+			return true;
+		}
+	}
+
+	// oldest task from another queue
+	for(int k=1; k<=N; ++k){
+		int i = (index + k) % N;
+		if(i < 0) i += N;
+		if(i == index) continue;
+		Queue& q = *mQueues[i];
+		std::lock_guard<std::mutex> lk(q.lock);
+		if(!q.tasks.empty()){
+			task.swap(q.tasks.front());
+			q.tasks.pop_front();
+			--mQueued;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ThreadPool::runPending(){
+	Task task;
+	if(!pop(tPool == this ? tIndex : -1, task)) return false;
+	task();
+	return true;
+}
+
+void ThreadPool::work(int index){
+	tPool = this;
+	tIndex = index;
+	Task task;
+	for(;;){
+		if(pop(index, task)){
+			task();
+			task = nullptr;
+			continue;
+		}
+		std::unique_lock<std::mutex> lk(mSleepLock);
+		if(mStop) break;
+		++mSleeping;
+		if(mQueued.load() == 0) mWake.wait(lk);
+		--mSleeping;
+	}
+}
+
+ThreadPool& ThreadPool::realtime(int priority){
+	std::lock_guard<std::mutex> lk(mRTQueue.lock);
+	if(!mRTRunning){
+		mRTRunning = true;
+		mRTWorker.pool = this;
+		mRTThread.priority(priority);
+		if(!mRTThread.start(mRTWorker)){
+			// e.g., no permission for real-time scheduling
+			AL_WARN("ThreadPool: could not start real-time lane");
+			mRTRunning = false;
+		}
+	}
+	return *this;
+}
+
+void ThreadPool::submitRealtime(const Task& task){
+	{
+		std::lock_guard<std::mutex> lk(mRTQueue.lock);
+		if(mRTRunning){
+			mRTQueue.tasks.push_back(task);
+			mRTWake.notify_one();
+			return;
+		}
+	}
+	submit(task);
+}
+
+void ThreadPool::workRealtime(){
+	Task task;
+	for(;;){
+		{
+			std::unique_lock<std::mutex> lk(mRTQueue.lock);
+			while(mRTRunning && mRTQueue.tasks.empty()) mRTWake.wait(lk);
+			if(mRTQueue.tasks.empty()) break;
+			task.swap(mRTQueue.tasks.front());
+			mRTQueue.tasks.pop_front();
+		}
+		task();
+		task = nullptr;
+	}
+}
+
+
+void TaskGroup::finish(){
+	// Under the lock, so a waiter cannot return and destroy the group before
+	// we are done with it
+	std::lock_guard<std::mutex> lk(mLock);
+	--mPending;
+	if(mWaiting) mFinished.notify_all();
+}
+
+void TaskGroup::wait(){
+	std::unique_lock<std::mutex> lk(mLock);
+	while(mPending.load() > 0){
+		lk.unlock();
+		bool ran = mPool.runPending();
+		lk.lock();
+
+		// Remaining tasks are running elsewhere; they may still queue more,
+		// so look again each time one finishes
+		if(!ran && mPending.load() > 0){
+			++mWaiting;
+			mFinished.wait(lk);
+			--mWaiting;
+		}
+	}
+}
+
+} // al::
@@ -1,9 +1,18 @@
 #include <stdio.h>
 #include "allocore/types/al_Array.hpp"
+#include "allocore/system/al_Config.h"
+#ifndef AL_WINDOWS
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
 
 namespace al{
 
-Array::Array(){
+Array::Array()
+:	mMapBase(NULL), mMapSize(0)
+{
 	data.ptr = NULL;
 	header.type= 0;
 	header.components = 1;
@@ -11,30 +20,42 @@ Array::Array(){
 	for(int i=0; i<ALLO_ARRAY_MAX_DIMS; ++i) header.dim[i]=0;
 }
 
-Array::Array(const AlloArray& cpy){
+Array::Array(const AlloArray& cpy)
+:	mMapBase(NULL), mMapSize(0)
+{
 	data.ptr = 0;
     (*this) = cpy;
 }
-Array::Array(const Array& cpy) {
+Array::Array(const Array& cpy)
+:	mMapBase(NULL), mMapSize(0)
+{
 	data.ptr = 0;
     (*this) = cpy;
 }
-Array::Array(const AlloArrayHeader& h2){
+Array::Array(const AlloArrayHeader& h2)
+:	mMapBase(NULL), mMapSize(0)
+{
 	allo_array_clear(this);
 	format(h2);
 }
 
-Array::Array(int comps, AlloTy ty, uint32_t dimx){
+Array::Array(int comps, AlloTy ty, uint32_t dimx)
+:	mMapBase(NULL), mMapSize(0)
+{
 	allo_array_clear(this);
 	format(comps, ty, dimx);
 }
 
-Array::Array(int comps, AlloTy ty, uint32_t dimx, uint32_t dimy){
+Array::Array(int comps, AlloTy ty, uint32_t dimx, uint32_t dimy)
+:	mMapBase(NULL), mMapSize(0)
+{
 	allo_array_clear(this);
 	format(comps, ty, dimx, dimy);
 }
 
-Array::Array(int comps, AlloTy ty, uint32_t dimx, uint32_t dimy, uint32_t dimz){
+Array::Array(int comps, AlloTy ty, uint32_t dimx, uint32_t dimy, uint32_t dimz)
+:	mMapBase(NULL), mMapSize(0)
+{
 	allo_array_clear(this);
 	format(comps, ty, dimx, dimy, dimz);
 }
@@ -79,7 +100,72 @@ void Array::configure(const AlloArrayHeader& h2) {
 
 void Array::dataCalloc() { allo_array_allocate(this); }
 
-void Array::dataFree() { allo_array_free(this); }
+void Array::dataFree() {
+	if(mapped()){
+		#ifndef AL_WINDOWS
+		munmap(mMapBase, mMapSize);
+		#endif
+		mMapBase = NULL;
+		mMapSize = 0;
+		data.ptr = NULL;
+	}
+	else{
+		allo_array_free(this);
+	}
+}
+
+bool Array::dataMap(const std::string& path, size_t offset, const AlloArrayHeader& h2) {
+	dataFree();
+	configure(h2);
+	const size_t bytes = size();
+
+#ifdef AL_WINDOWS
+	FILE * fp = fopen(path.c_str(), "rb");
+	if(NULL == fp){
+		printf("Array::dataMap: cannot open %s\n", path.c_str());
+		return false;
+	}
+	dataCalloc();
+	bool ok = 0 == _fseeki64(fp, offset, SEEK_SET) && 1 == fread(data.ptr, bytes, 1, fp);
+	fclose(fp);
+	if(!ok){
+		printf("Array::dataMap: cannot read %s\n", path.c_str());
+		dataFree();
+	}
+	return ok;
+
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0){
+		printf("Array::dataMap: cannot open %s\n", path.c_str());
+		return false;
+	}
+
+	struct stat st;
+	if(0 != fstat(fd, &st) || size_t(st.st_size) < offset + bytes){
+		printf("Array::dataMap: %s is too small for array\n", path.c_str());
+		close(fd);
+		return false;
+	}
+
+	// Mapping must start on a page boundary
+	const size_t page = sysconf(_SC_PAGESIZE);
+	const size_t start = offset - offset % page;
+	const size_t len = offset + bytes - start;
+
+	void * m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, start);
+	close(fd);
+	if(MAP_FAILED == m){
+		printf("Array::dataMap: cannot map %s\n", path.c_str());
+		return false;
+	}
+
+	mMapBase = (char *)m;
+	mMapSize = len;
+	data.ptr = mMapBase + (offset - start);
+	return true;
+#endif
+}
 
 void Array::deriveStride(AlloArrayHeader& h, size_t alignSize) {
 	allo_array_setstride(&h, alignSize);
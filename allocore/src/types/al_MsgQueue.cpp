@@ -1,4 +1,4 @@
-#include <algorithm> // std::max
+#include <algorithm> // std::max, std::push_heap, std::pop_heap
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,25 +9,31 @@
 namespace al{
 
 MsgQueue :: MsgQueue(int size, malloc_func mfunc, free_func ffunc)
-:	mHead(NULL), mTail(NULL), mPool(NULL),
-	mLen(0), mChunkSize(0), mNow(0),
+:	mNextID(0), mPool(NULL), mSlabs(NULL),
+	mLen(0), mChunkSize(size), mNow(0),
 	mMalloc(mfunc ? mfunc : malloc), mFree(ffunc ? ffunc : free)
 {
+	for (int i=0; i<NUM_BLOCK_SIZES; i++) mBlocks[i] = NULL;
+	resetStats();
+	mHeap.reserve(size);
 	growPool(size);
 }
 
 MsgQueue :: ~MsgQueue() {
+	for (unsigned i=0; i<mHeap.size(); i++) recycle(mHeap[i].msg);
+	mHeap.clear();
 	Msg * m;
-	while (mHead) {
-		m = mHead->next;
-		recycle(mHead);
-		mHead = m;
-	}
 	while (mPool) {
 		m = mPool->next;
 		mFree(mPool);
 		mPool = m;
 	}
+	Block * b;
+	while (mSlabs) {
+		b = mSlabs->next;
+		mFree(mSlabs);
+		mSlabs = b;
+	}
 }
 
 void MsgQueue :: growPool(int size) {
@@ -41,6 +47,56 @@ void MsgQueue :: growPool(int size) {
 	m->next = NULL;
 }
 
+void MsgQueue :: resetStats() {
+	mStats.scheduled = 0;
+	mStats.dispatched = 0;
+	mStats.late = 0;
+	mStats.maxLen = mLen;
+	mStats.totalLatency = 0;
+	mStats.maxLatency = 0;
+}
+
+/* get storage for arguments of a big message */
+char * MsgQueue :: allocArgs(size_t size) {
+	int i = 0;
+	while (i < NUM_BLOCK_SIZES && (size_t(256) << i) < size) i++;
+
+	// too big for any block
+	if (i == NUM_BLOCK_SIZES) return (char *)mMalloc(size);
+
+	if (!mBlocks[i]) {
+		// carve a new slab into blocks; its first 16 bytes link the slabs
+		const size_t blockSize = size_t(256) << i;
+		char * slab = (char *)mMalloc(16 + BLOCKS_PER_SLAB * blockSize);
+		((Block *)slab)->next = mSlabs;
+		mSlabs = (Block *)slab;
+		for (int k=0; k<BLOCKS_PER_SLAB; k++) {
+			Block * b = (Block *)(slab + 16 + k * blockSize);
+			b->next = mBlocks[i];
+			mBlocks[i] = b;
+		}
+	}
+
+	Block * b = mBlocks[i];
+	mBlocks[i] = b->next;
+	return (char *)b;
+}
+
+/* return storage for arguments of a big message */
+void MsgQueue :: freeArgs(char * args, size_t size) {
+	int i = 0;
+	while (i < NUM_BLOCK_SIZES && (size_t(256) << i) < size) i++;
+
+	if (i == NUM_BLOCK_SIZES) {
+		mFree(args);
+		return;
+	}
+
+	Block * b = (Block *)args;
+	b->next = mBlocks[i];
+	mBlocks[i] = b;
+}
+
 /* push a message back into the pool */
 void MsgQueue :: recycle(Msg * m) {
 	assert(mLen); // LJP
@@ -48,14 +104,15 @@ void MsgQueue :: recycle(Msg * m) {
 	mPool = m;
 	if (m->isBigMessage()) {
 		char * args = *(char **)(m->mArgs);
-		mFree(args);
+		freeArgs(args, m->size);
 	}
 	mLen--;
 }
 
 /* schedule a new message */
 void MsgQueue :: sched(al_sec at, msg_func func, char * data, size_t size) {
-	assert(mPool);
+	if (!mPool) growPool(mChunkSize);
+
 	// get a message-holder from the pool:
 	Msg * m = mPool;
 	mPool= m->next;
@@ -67,7 +124,7 @@ void MsgQueue :: sched(al_sec at, msg_func func, char * data, size_t size) {
 	m->size = size;
 	if (m->isBigMessage()) {
 		// too big to fit in the Msg.
-		char * args = (char *)mMalloc(size);
+		char * args = allocArgs(size);
 		memcpy(args, data, size);
 		*(char **)(m->mArgs) = args;
 	} else {
@@ -75,78 +132,44 @@ void MsgQueue :: sched(al_sec at, msg_func func, char * data, size_t size) {
 	}
 
 	// insert into queue
-
-	// empty queue? set as new head and tail:
-	if (mHead == NULL) {
-		mHead = m;
-		mTail = m;
-		mLen = 1;
-		return;
-	}
-
-	// prepend case? insert as new head:
-	if (at < mHead->t) {
-		m->next = mHead;
-		mHead = m;
-		mLen++;
-		return;
-	}
-
-	// append case? add as new tail:
-	if (at >= mTail->t) {
-		mTail->next = m;
-		mTail = m;
-		mLen++;
-		return;
-	}
-
-	// else: insert somewhere between head and tail:
-	Msg * p = mHead;
-	Msg * n = p->next;
-	// compare with <= so that events with same timestamp will be in order of insertion
-	while (n && n->t <= at) {
-		p = n;
-		n = n->next;
-	}
-	m->next = n;
-	p->next = m;
+	// ids keep events with same timestamp in order of insertion
+	Entry e = { at, mNextID++, m };
+	mHeap.push_back(e);
+	std::push_heap(mHeap.begin(), mHeap.end());
 	mLen++;
+
+	mStats.scheduled++;
+	mStats.maxLen = std::max(mStats.maxLen, mLen);
 }
 
-void MsgQueue :: update(al_sec until, bool defer) {
-	Msg * m = mHead;
-	while (m && m->t <= until) {
-		mHead = m->next;
+void MsgQueue :: update(al_sec until) {
+	while (!mHeap.empty() && mHeap.front().t <= until) {
+		std::pop_heap(mHeap.begin(), mHeap.end());
+		Msg * m = mHeap.back().msg;
+		mHeap.pop_back();
 
-//		if (defer && m->retry > 0.) {
-//			m->msg.t = x->now + m->retry;
-//			al_pq_sched_msg(x, m);
-//		} else {
+		if (mNow > m->t) {
+			al_sec late = mNow - m->t;
+			mStats.late++;
+			mStats.totalLatency += late;
+			mStats.maxLatency = std::max(mStats.maxLatency, late);
+		}
+		mStats.dispatched++;
 
-		// only call if it has data associated:
-		//if (m->args) {
-			mNow = std::max(mNow, m->t);
-			(m->func)(mNow, m->args());
-		//}
+		mNow = std::max(mNow, m->t);
+		(m->func)(mNow, m->args());
 
 		recycle(m);
-		m = mHead;
 	}
 	mNow = until;
 }
 
 void MsgQueue :: clear() {
 	// recycle everything:
-	Msg * m = mHead;
-	while (m) {
-		mHead = m->next;
-		recycle(m);
-		m = mHead;
-	}
+	for (unsigned i=0; i<mHeap.size(); i++) recycle(mHeap[i].msg);
+	mHeap.clear();
 	// reset clock:
 	mNow = 0;
-	mHead = NULL;
-	mTail = NULL;
 }
 
 } // al::
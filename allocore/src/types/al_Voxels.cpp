@@ -1,5 +1,6 @@
 //#include <cassert>
 #include <algorithm> // min,max
+#include <cstring>
 #include "allocore/types/al_Voxels.hpp"
 #include "allocore/io/al_File.hpp"
 #include "allocore/system/al_Printing.hpp"
@@ -7,9 +8,7 @@
 
 namespace al {
 
-MRCHeader& Voxels::parseMRC(const char * mrcData) {
-  MRCHeader& mrcHeader = *(MRCHeader *)mrcData;
-
+bool Voxels::parseMRCHeader(MRCHeader& mrcHeader, AlloTy& ty) {
   // check for byte swap:
   bool swapped =
     (mrcHeader.nx <= 0 || mrcHeader.ny <= 0 || mrcHeader.nz <= 0 ||
@@ -41,7 +40,7 @@ MRCHeader& Voxels::parseMRC(const char * mrcData) {
   printf("NX %d NY %d NZ %d\n", mrcHeader.nx, mrcHeader.ny, mrcHeader.nz);
   printf("mode ");
 
-  AlloTy ty;
+  ty = 0;
 
   // set type:
   switch (mrcHeader.mode) {
@@ -78,6 +77,16 @@ MRCHeader& Voxels::parseMRC(const char * mrcData) {
     //printf("\t%02d: %s\n", i, mrcHeader.labels[i]);
   }
 
+  return swapped;
+}
+
+MRCHeader& Voxels::parseMRC(const char * mrcData) {
+  MRCHeader& mrcHeader = *(MRCHeader *)mrcData;
+
+  AlloTy ty;
+  bool swapped = parseMRCHeader(mrcHeader, ty);
+  m_swapped = false;
+
   const char * start = mrcData + 1024;
 
   formatAligned(1, ty, mrcHeader.nx, mrcHeader.ny, mrcHeader.nz, 0);
@@ -166,6 +175,71 @@ bool Voxels::loadFromMRC(std::string filename, UnitsTy ty, float voxWidthX, floa
   return true;
 }
 
+bool Voxels::mapFromMRC(std::string filename) {
+  MRCHeader header;
+
+  File data_file(filename, "rb", true);
+
+  printf("Mapping Data File: %s\n", data_file.path().c_str());
+
+  if(!data_file.opened() || 1 != data_file.read(&header, sizeof(MRCHeader), 1)) {
+    AL_WARN("Cannot open MRC file");
+    return false;
+  }
+  data_file.close();
+
+  AlloTy ty;
+  m_swapped = parseMRCHeader(header, ty);
+  if(0 == ty) return false;
+
+  AlloArrayHeader h2;
+  h2.type = ty;
+  h2.components = 1;
+  h2.dimcount = 3;
+  for(int i=0; i<ALLO_ARRAY_MAX_DIMS; ++i) h2.dim[i] = 0;
+  h2.dim[0] = header.nx;
+  h2.dim[1] = header.ny;
+  h2.dim[2] = header.nz;
+  deriveStride(h2, 1);
+
+  // data follows header and any extended header
+  if(!dataMap(data_file.path(), 1024 + header.next, h2)) return false;
+
+  // 8-bit data never needs swapping
+  if(allo_type_size(ty) == 1) m_swapped = false;
+  m_sliceReady.assign(m_swapped ? header.nz : 0, 0);
+
+  m_units = VOX_NANOMETERS; // default to nanometers
+  m_voxWidth[0] = header.xlen * 0.1f;
+  m_voxWidth[1] = header.ylen * 0.1f;
+  m_voxWidth[2] = header.zlen * 0.1f;
+
+  m_min = header.amin;
+  m_max = header.amax;
+  m_mean = header.amean;
+  m_rms = header.rms;
+
+  return true;
+}
+
+void Voxels::prepareSlices(uint32_t z0, uint32_t z1) {
+  if (!m_swapped) return;
+
+  z1 = std::min(z1, dim(2));
+  const unsigned n = dim(0) * dim(1);
+
+  for (uint32_t z=z0; z<z1; ++z) {
+    if (m_sliceReady[z]) continue;
+    char * slice = data.ptr + size_t(z) * stride(2);
+    switch (allo_type_size(type())) {
+      case 2: swapBytes((int16_t *)slice, n); break;
+      case 4: swapBytes((int32_t *)slice, n); break;
+      default: break;
+    }
+    m_sliceReady[z] = 1;
+  }
+}
+
 bool Voxels::writeToMRC(std::string filename, MRCHeader& header) {
   File mrc_file(filename, "wb", true);
   printf("Writing MRC File: %s\n", mrc_file.path().c_str());
@@ -212,6 +286,46 @@ bool Voxels::loadFromFile(std::string filename) {
 
   data_file.close();
 
+  m_swapped = false;
+
+  return true;
+}
+
+bool Voxels::mapFromFile(std::string filename) {
+  File data_file(filename, "rb", true);
+
+  printf("Mapping Data File: %s\n", data_file.path().c_str());
+
+  if(!data_file.opened()) {
+    AL_WARN("Cannot open data file");
+    return false;
+  }
+  char validHeader[12];
+  AlloArrayHeader h2;
+  UnitsTy units;
+  float voxWidth[3];
+  bool ok = data_file.read(validHeader, sizeof(char), 12) == 12
+    && data_file.read(&h2, sizeof(AlloArrayHeader), 1) == 1
+    && data_file.read(&units, sizeof(UnitsTy), 1) == 1
+    && data_file.read(voxWidth, sizeof(float), 3) == 3;
+
+  data_file.close();
+
+  if(!ok || memcmp(validHeader, "Allo Voxels", 12) != 0
+     || h2.dimcount > ALLO_ARRAY_MAX_DIMS || allo_type_size(h2.type) == 0) {
+    AL_WARN("Not a voxel file: %s", data_file.path().c_str());
+    return false;
+  }
+
+  // same layout as written by writeToFile
+  size_t offset = 12 + sizeof(AlloArrayHeader) + sizeof(UnitsTy) + 3*sizeof(float);
+
+  if(!dataMap(data_file.path(), offset, h2)) return false;
+  m_units = units;
+  m_voxWidth[0] = voxWidth[0];
+  m_voxWidth[1] = voxWidth[1];
+  m_voxWidth[2] = voxWidth[2];
+  m_swapped = false;
   return true;
 }
 
@@ -221,25 +335,23 @@ bool Voxels::writeToFile(std::string filename) {
 
   if(!voxel_file.opened()) {
     AL_WARN("Cannot open voxel file");
-    exit(EXIT_FAILURE);
+    return false;
   }
 
   char validHeader[12] = "Allo Voxels";
 
-  voxel_file.write(validHeader, sizeof(char), 12);
-  
-  voxel_file.write(&header, sizeof(AlloArrayHeader), 1);
-
-  voxel_file.write(&m_units, sizeof(UnitsTy), 1);
-  voxel_file.write(&m_voxWidth[0], sizeof(float), 1);
-  voxel_file.write(&m_voxWidth[1], sizeof(float), 1);
-  voxel_file.write(&m_voxWidth[2], sizeof(float), 1);
+  bool ok = voxel_file.write(validHeader, sizeof(char), 12) == 12
+    && voxel_file.write(&header, sizeof(AlloArrayHeader), 1) == 1
+    && voxel_file.write(&m_units, sizeof(UnitsTy), 1) == 1
+    && voxel_file.write(&m_voxWidth[0], sizeof(float), 1) == 1
+    && voxel_file.write(&m_voxWidth[1], sizeof(float), 1) == 1
+    && voxel_file.write(&m_voxWidth[2], sizeof(float), 1) == 1
+    && voxel_file.write(data.ptr, size(), 1) == 1;
 
-  voxel_file.write(data.ptr, size(), 1);
-  
   voxel_file.close();
-  
-  return true;
+
+  if(!ok) AL_WARN("Cannot write voxel file");
+  return ok;
 }
   
 void Voxels::print(FILE * fp) {
@@ -370,6 +482,7 @@ bool Voxels::loadFromDirectory(std::string dir) {
     // For now assume 8-bit with 1 nm cube voxels
     format(1, AlloUInt8Ty, nx, ny, nz);
     init(vx,vy,vz,type);
+    m_swapped = false;
 
 
     // Iterate through entire directory
@@ -413,6 +526,20 @@ bool Voxels::loadFromDirectory(std::string dir) {
     return true;
   }
 
+bool Voxels::loadFromDirectory(std::string dir, std::string cacheFile) {
+  if (File::exists(cacheFile) && mapFromFile(cacheFile)) {
+    return true;
+  }
+
+  if (!loadFromDirectory(dir)) {
+    return false;
+  }
+
+  // Replace assembled volume with mapping of cache so that only
+  // slices being accessed stay in memory
+  return writeToFile(cacheFile) && mapFromFile(cacheFile);
+}
+
 /*  //BACK-UP
 bool Voxels::linePlaneIntersection(const Vec3f &P0, const Vec3f &P1, const Vec3f &planeCenter, const Vec3f &planeNormal, Vec3f* intersection)
 {
@@ -1,7 +1,12 @@
 
+#include <algorithm>
+#include <cmath>
+#include <deque>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
 
 #include "allocore/ui/al_Parameter.hpp"
 #include "allocore/io/al_File.hpp"
@@ -14,14 +19,16 @@ Parameter::Parameter(std::string parameterName, std::string Group,
                      std::string prefix,
                      float min,
                      float max) :
-    ParameterWrapper<float>(parameterName, Group, defaultValue, prefix, min, max)
+    ParameterWrapper<float>(parameterName, Group, defaultValue, prefix, min, max),
+    mSmoothing(NONE), mSmoothTime(0.02f),
+    mSmoothed(defaultValue), mRampTarget(defaultValue), mRampStep(0), mRampFrames(0)
 {
 	mFloatValue = defaultValue;
 }
 
 float Parameter::get()
 {
-	return mFloatValue;
+	return mFloatValue.load(std::memory_order_relaxed);
 }
 
 void Parameter::setNoCalls(float value, void *blockReceiver)
@@ -50,11 +57,59 @@ void Parameter::set(float value)
 		value = mProcessCallback(value, mProcessUdata);
 	}
 	mFloatValue = value;
-	for(int i = 0; i < mCallbacks.size(); ++i) {
-		if (mCallbacks[i]) {
-			mCallbacks[i](value, this, mCallbackUdata[i], NULL);
+	changed(value);
+}
+
+void Parameter::smoothing(Smoothing type, float timeSec)
+{
+	mSmoothing = type;
+	mSmoothTime = timeSec;
+}
+
+const float *Parameter::block(int frames, double framesPerSecond)
+{
+	if (frames > (int) mBlock.size()) {
+		mBlock.resize(frames);
+	}
+	float *out = mBlock.data();
+	float target = get();
+
+	switch (mSmoothing) {
+	case NONE:
+		mSmoothed = target;
+		std::fill(out, out + frames, target);
+		break;
+
+	case RAMP:
+		if (target != mRampTarget) {
+			mRampTarget = target;
+			mRampFrames = std::max(1, int(mSmoothTime * framesPerSecond));
+			mRampStep = (target - mSmoothed) / mRampFrames;
+		}
+		for (int i = 0; i < frames; i++) {
+			if (mRampFrames > 0) {
+				// land exactly on the target at the end of the ramp
+				mSmoothed = --mRampFrames ? mSmoothed + mRampStep : mRampTarget;
+			}
+			out[i] = mSmoothed;
 		}
+		break;
+
+	case ONE_POLE: {
+		float a = mSmoothTime > 0 ? 1.f - std::exp(-1. / (mSmoothTime * framesPerSecond)) : 1.f;
+		for (int i = 0; i < frames; i++) {
+			mSmoothed += a * (target - mSmoothed);
+			out[i] = mSmoothed;
+		}
+		// avoid denormals as the value settles
+		if (std::fabs(target - mSmoothed) < 1e-6f * (std::fabs(target) + 1e-6f)) {
+			mSmoothed = target;
+		}
+		break;
+	}
 	}
+	mRampTarget = target;
+	return out;
 }
 
 // ParameterBool ------------------------------------------------------------------
@@ -70,7 +125,7 @@ ParameterBool::ParameterBool(std::string parameterName, std::string Group,
 
 float ParameterBool::get()
 {
-	return mFloatValue;
+	return mFloatValue.load(std::memory_order_relaxed);
 }
 
 void ParameterBool::setNoCalls(float value, void *blockReceiver)
@@ -99,18 +154,114 @@ void ParameterBool::set(float value)
 		value = mProcessCallback(value, mProcessUdata);
 	}
 	mFloatValue = value;
-	for(int i = 0; i < mCallbacks.size(); ++i) {
-		if (mCallbacks[i]) {
-			mCallbacks[i](value, this, mCallbackUdata[i], NULL);
-		}
-	}
+	changed(value);
 }
 
 // ParameterServer ------------------------------------------------------------
 
+struct ParameterServer::AddressIndex {
+	// One path segment of the registered addresses
+	struct Node {
+		std::vector<std::pair<std::string, Node *> > children;
+		std::vector<Parameter *> parameters;
+	};
+
+	std::deque<Node> nodes; // nodes[0] is the root
+	std::unordered_map<std::string, std::vector<Parameter *> > addresses;
+	std::vector<osc::PacketHandler *> handlers;
+
+	AddressIndex(const std::vector<Parameter *> &parameters,
+	             const std::vector<osc::PacketHandler *> &packetHandlers)
+	    : nodes(1), handlers(packetHandlers)
+	{
+		for (Parameter *p: parameters) {
+			const std::string &address = p->getFullAddress();
+			addresses[address].push_back(p);
+
+			Node *node = &nodes[0];
+			size_t begin = address.size() && address[0] == '/' ? 1 : 0;
+			while (begin <= address.size()) {
+				size_t end = address.find('/', begin);
+				if (end == std::string::npos) end = address.size();
+				std::string segment = address.substr(begin, end - begin);
+				Node *child = nullptr;
+				for (auto &c: node->children) {
+					if (c.first == segment) { child = c.second; break; }
+				}
+				if (!child) {
+					nodes.push_back(Node());
+					child = &nodes.back();
+					node->children.push_back(std::make_pair(segment, child));
+				}
+				node = child;
+				begin = end + 1;
+			}
+			node->parameters.push_back(p);
+		}
+	}
+
+	int set(const std::string &address, float value) const {
+		if (!osc::isPattern(address)) {
+			auto it = addresses.find(address);
+			if (it == addresses.end()) return 0;
+			for (Parameter *p: it->second) p->set(value);
+			return it->second.size();
+		}
+		size_t begin = address.size() && address[0] == '/' ? 1 : 0;
+		return set(nodes[0], address, begin, value);
+	}
+
+	// Match the pattern from segment starting at begin against the subtree
+	int set(const Node &node, const std::string &pattern, size_t begin, float value) const {
+		size_t end = pattern.find('/', begin);
+		bool last = end == std::string::npos;
+		std::string segment = pattern.substr(begin, last ? std::string::npos : end - begin);
+		int count = 0;
+		for (auto &c: node.children) {
+			if (osc::matchPattern(segment.c_str(), c.first.c_str())) {
+				if (last) {
+					for (Parameter *p: c.second->parameters) p->set(value);
+					count += c.second->parameters.size();
+				} else {
+					count += set(*c.second, pattern, end + 1, value);
+				}
+			}
+		}
+		return count;
+	}
+};
+
+struct ParameterServer::Dispatch {
+	Dispatch(ParameterServer &s) : server(s), outer(current) {
+		++server.mReaders;
+		current = this;
+	}
+
+	~Dispatch() {
+		current = outer;
+		--server.mReaders;
+	}
+
+	// Number of dispatches of a server in progress on the calling thread
+	static int depth(const ParameterServer *s) {
+		int count = 0;
+		for (Dispatch *d = current; d; d = d->outer) {
+			if (&d->server == s) ++count;
+		}
+		return count;
+	}
+
+	ParameterServer &server;
+	Dispatch *outer;
+	static thread_local Dispatch *current; // innermost dispatch of thread
+};
+
+thread_local ParameterServer::Dispatch *ParameterServer::Dispatch::current = nullptr;
+
 ParameterServer::ParameterServer(std::string oscAddress, int oscPort)
-    : mServer(nullptr)
+    : mServer(nullptr), mIndexDirty(false), mReaders(0)
 {
+	mIndex = new AddressIndex(mParameters, mPacketHandlers);
 	mServer = new osc::Recv(oscPort, oscAddress.c_str(), 0.001); // Is 1ms wait OK?
 	if (mServer) {
 		mServer->handler(*this);
@@ -128,12 +279,15 @@ ParameterServer::~ParameterServer()
 		delete mServer;
 		mServer = nullptr;
 	}
+	delete mIndex.load();
+	for (AddressIndex *index: mRetired) delete index;
 }
 
 ParameterServer &ParameterServer::registerParameter(Parameter &param)
 {
 	mParameterLock.lock();
 	mParameters.push_back(&param);
+	mIndexDirty = true;
 	mParameterLock.unlock();
 	mListenerLock.lock();
 	param.registerChangeCallback(ParameterServer::changeCallback,
@@ -145,13 +299,43 @@ ParameterServer &ParameterServer::registerParameter(Parameter &param)
 void ParameterServer::unregisterParameter(Parameter &param)
 {
 	mParameterLock.lock();
-	std::vector<Parameter *>::iterator it = mParameters.begin();
-	for(it = mParameters.begin(); it != mParameters.end(); it++) {
-		if (*it == &param) {
-			mParameters.erase(it);
-		}
-	}
+	mParameters.erase(std::remove(mParameters.begin(), mParameters.end(), &param),
+	                  mParameters.end());
+	mIndexDirty = true;
 	mParameterLock.unlock();
+	// Make sure no message being dispatched on another thread can still
+	// reach the parameter. Dispatches on this thread cannot finish while we
+	// wait, so for them the removal is deferred to later messages.
+	updateIndex();
+	int depth = Dispatch::depth(this);
+	while (mReaders.load() > depth) {
+		std::this_thread::yield();
+	}
+}
+
+void ParameterServer::updateIndex()
+{
+	std::lock_guard<std::mutex> lk(mParameterLock);
+	if (!mIndexDirty) {
+		return;
+	}
+	AddressIndex *old = mIndex.exchange(new AddressIndex(mParameters, mPacketHandlers));
+	mIndexDirty = false;
+	mRetired.push_back(old);
+	// Readers that started after the exchange use the new index
+	if (mReaders.load() == 0) {
+		for (AddressIndex *index: mRetired) delete index;
+		mRetired.clear();
+	}
+}
+
+int ParameterServer::setParameters(const std::string &address, float value)
+{
+	if (mIndexDirty.load()) {
+		updateIndex();
+	}
+	Dispatch dispatch(*this);
+	return mIndex.load()->set(address, value);
 }
 
 void ParameterServer::onMessage(osc::Message &m)
@@ -164,19 +348,18 @@ void ParameterServer::onMessage(osc::Message &m)
 	}
 	float val;
 	m >> val;
-	mParameterLock.lock();
-	for (Parameter *p:mParameters) {
-		if(m.addressPattern() == p->getFullAddress() && m.typeTags() == "f"){
-			// Extract the data out of the packet
-			p->set(val);
-//			std::cout << "ParameterServer::onMessage" << val << std::endl;
-		}
+	if (mIndexDirty.load()) {
+		updateIndex();
+	}
+	Dispatch dispatch(*this);
+	const AddressIndex &index = *mIndex.load();
+	if (m.typeTags() == "f") {
+		index.set(m.addressPattern(), val);
 	}
-	for (osc::PacketHandler *handler: mPacketHandlers) {
+	for (osc::PacketHandler *handler: index.handlers) {
 		m.resetStream();
 		handler->onMessage(m);
 	}
-	mParameterLock.unlock();
 }
 
 void ParameterServer::print()
@@ -201,6 +384,7 @@ void ParameterServer::registerOSCListener(osc::PacketHandler *handler)
 {
 	mParameterLock.lock();
 	mPacketHandlers.push_back(handler);
+	mIndexDirty = true;
 	mParameterLock.unlock();
 }
 
@@ -3,19 +3,63 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
 
 #include "allocore/ui/al_Preset.hpp"
 #include "allocore/io/al_File.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
 
 using namespace al;
 
+// Preset bank layout, in native byte order:
+//   8 byte identifier
+//   uint32 number of parameters, number of presets, offset of values
+//   per parameter: uint32 length, address
+//   per preset: int32 index, uint32 length, name
+//   float values[presets][parameters], starting at the values offset
+static const char bankIdentifier[8] = {'a','l','P','r','e','s','e','t'};
+
+static void writeBankInt(std::ofstream &f, uint32_t v){
+	f.write((const char *)&v, sizeof(v));
+}
+
+static void writeBankString(std::ofstream &f, const std::string &s){
+	writeBankInt(f, s.size());
+	f.write(s.data(), s.size());
+}
+
+static uint32_t readBankInt(std::ifstream &f){
+	uint32_t v = 0;
+	f.read((char *)&v, sizeof(v));
+	return v;
+}
+
+static std::string readBankString(std::ifstream &f){
+	uint32_t size = readBankInt(f);
+	if (!f || size > 4096) {
+		f.setstate(std::ios::failbit);
+		return "";
+	}
+	std::string s(size, '\0');
+	f.read(&s[0], size);
+	return s;
+}
+
 
 // PresetHandler --------------------------------------------------------------
 
 PresetHandler::PresetHandler(std::string rootDirectory, bool verbose) :
     mRootDir(rootDirectory), mVerbose(verbose),
-    mRunning(true), mMorphRemainingSteps(-1),
-    mMorphInterval(0.05), mMorphTime("morphTime", "", 0.0, "", 0.0, 20.0), mMorphingThread(PresetHandler::morphingFunction, this)
+    mRunning(true),
+    mMorphInterval(0.05), mMorphTime("morphTime", "", 0.0, "", 0.0, 20.0),
+    mMorphing(false), mMorphDuration(0), mMorphElapsed(0), mMorphPending(0),
+    mMorphProgress(1), mMorphCurve(LINEAR), mExternalClock(false),
+    mMorphingThread(PresetHandler::morphingFunction, this),
+    mCacheGeneration(0), mPrefetch(0), mPrefetching(0)
 {
 	if (!File::exists(rootDirectory)) {
 		if (!Dir::make(rootDirectory, true)) {
@@ -27,15 +71,25 @@ PresetHandler::PresetHandler(std::string rootDirectory, bool verbose) :
 
 PresetHandler::~PresetHandler()
 {
-	mRunning = false;
-//	std::lock_guard<std::mutex> lk(mTargetLock);
+	{
+		std::lock_guard<std::mutex> lk(mTargetLock);
+		mRunning = false;
+	}
 	mMorphConditionVar.notify_one();
 	mMorphingThread.join();
+	while (mPrefetching.load() > 0) {
+		std::this_thread::yield();
+	}
 }
 
 PresetHandler &PresetHandler::registerParameter(Parameter &parameter)
 {
 	mParameters.push_back(&parameter);
+	// Cached values are aligned with mParameters
+	std::lock_guard<std::mutex> lk(mCacheLock);
+	mCache.clear();
+	++mCacheGeneration;
+	mapBankColumns();
 	return *this;
 }
 
@@ -48,6 +102,15 @@ void PresetHandler::setSubDirectory(std::string directory)
 			std::cout << "Error creating directory: " << mRootDir << std::endl;
 		}
 	}
+	{
+		std::lock_guard<std::mutex> lk(mCacheLock);
+		mCache.clear();
+		++mCacheGeneration;
+		mBank.dataFree();
+		mBankRows.clear();
+		mBankAddresses.clear();
+		mapBankColumns();
+	}
 	loadPresetMap();
 }
 
@@ -140,33 +203,32 @@ void PresetHandler::storePreset(int index, std::string name, bool overwrite)
 	f.close();
 	mPresetsMap[index] = name;
 	storePresetMap();
+
+	std::shared_ptr<std::vector<float> > values = std::make_shared<std::vector<float> >(mParameters.size());
+	for (size_t i = 0; i < mParameters.size(); ++i) {
+		(*values)[i] = mParameters[i]->get();
+	}
+	std::lock_guard<std::mutex> lk(mCacheLock);
+	mCache[index] = values;
+	mBankRows.erase(index);
 }
 
 void PresetHandler::recallPreset(std::string name)
 {
-	{
-		if (mMorphRemainingSteps.load() >= 0) {
-			mMorphRemainingSteps.store(-1);
-			std::lock_guard<std::mutex> lk(mTargetLock);
-		}
-		mTargetValues = loadPresetValues(name);
-		mMorphRemainingSteps.store(1 + mMorphTime.get() / mMorphInterval);
-	}
-	mMorphConditionVar.notify_one();
+	int index = presetIndex(name);
+	Values values = index >= 0 ? presetValues(index, name) : loadPresetValues(name);
+	std::vector<float> target(*values);
+	startMorph(target, mMorphTime.get());
 
-	int index = -1;
-	for (auto preset: mPresetsMap) {
-		if (preset.second == name) {
-			index = preset.first;
-			break;
-		}
-	}
 	mCurrentPresetName = name;
 	for(int i = 0; i < mCallbacks.size(); ++i) {
 		if (mCallbacks[i]) {
 			mCallbacks[i](index, this, mCallbackUdata[i]);
 		}
 	}
+	if (index >= 0) {
+		prefetchNeighbours(index);
+	}
 }
 
 void PresetHandler::setInterpolatedPreset(int index1, int index2, double factor)
@@ -176,21 +238,20 @@ void PresetHandler::setInterpolatedPreset(int index1, int index2, double factor)
 	if (presetNameIt1 != mPresetsMap.end()
 	        && presetNameIt2 != mPresetsMap.end()) {
 
-		std::map<std::string, float> values1 = loadPresetValues(presetNameIt1->second);
-		std::map<std::string, float> values2 = loadPresetValues(presetNameIt2->second);
-		{
-			if (mMorphRemainingSteps.load() >= 0) {
-				mMorphRemainingSteps.store(-1);
-				std::lock_guard<std::mutex> lk(mTargetLock);
-			}
-			mTargetValues.clear();
-			for(auto value: values1) {
-				if (values2.count(value.first) > 0) {
-					mTargetValues[value.first] = value.second + ((values2[value.first] - value.second)* factor);
-				}
-			}
+		Values values1 = presetValues(index1, presetNameIt1->second);
+		Values values2 = presetValues(index2, presetNameIt2->second);
+		size_t size = std::min(values1->size(), values2->size());
+		const float *v1 = values1->data();
+		const float *v2 = values2->data();
+		float f = factor;
+		std::vector<float> target(size);
+		// Values missing from either preset stay NaN and are skipped
+		for (size_t i = 0; i < size; ++i) {
+			target[i] = v1[i] + (v2[i] - v1[i]) * f;
 		}
-		mMorphConditionVar.notify_one();
+		startMorph(target, 0);
+		prefetchNeighbours(index1);
+		prefetchNeighbours(index2);
 	} else {
 		std::cout << "Invalid indeces for preset interpolation: " << index1 << "," << index2 << std::endl;
 	}
@@ -229,16 +290,222 @@ void PresetHandler::setMorphTime(float time)
 }
 
 void PresetHandler::stopMorph()
+{
+	std::lock_guard<std::mutex> lk(mTargetLock);
+	mMorphing = false;
+}
+
+void PresetHandler::setExternalMorphClock(bool external)
+{
+	{
+		std::lock_guard<std::mutex> lk(mTargetLock);
+		mExternalClock = external;
+	}
+	mMorphConditionVar.notify_one();
+}
+
+void PresetHandler::stepMorph(double seconds)
+{
+	std::unique_lock<std::mutex> lk(mTargetLock, std::try_to_lock);
+	if (!lk.owns_lock()) {
+		mMorphPending += seconds;
+		return;
+	}
+	advanceMorph(seconds + mMorphPending);
+	mMorphPending = 0;
+}
+
+void PresetHandler::startMorph(std::vector<float> &target, float duration)
 {
 	{
-		if (mMorphRemainingSteps.load() >= 0) {
-			mMorphRemainingSteps.store(-1);
-			std::lock_guard<std::mutex> lk(mTargetLock);
+		std::lock_guard<std::mutex> lk(mTargetLock);
+		size_t size = std::min(target.size(), mParameters.size());
+		target.resize(size);
+		mTargetValues.swap(target);
+		mMorphStart.resize(size);
+		mMorphValues.resize(size);
+		for (size_t i = 0; i < size; ++i) {
+			mMorphStart[i] = mParameters[i]->get();
 		}
+		mMorphDuration = duration;
+		mMorphElapsed = 0;
+		mMorphing = true;
+		mMorphProgress.store(0);
 	}
 	mMorphConditionVar.notify_one();
 }
 
+// Called with mTargetLock held
+void PresetHandler::advanceMorph(double seconds)
+{
+	if (!mMorphing) {
+		return;
+	}
+	mMorphElapsed += seconds;
+	float progress = 1;
+	if (mMorphElapsed < mMorphDuration) {
+		progress = mMorphElapsed / mMorphDuration;
+	}
+
+	float weight = progress;
+	switch (mMorphCurve.load()) {
+	case EXPONENTIAL:
+		weight = (std::exp(5.f * progress) - 1.f) / (std::exp(5.f) - 1.f);
+		break;
+	case S_CURVE:
+		weight = progress * progress * (3.f - 2.f * progress);
+		break;
+	default:;
+	}
+
+	// One pass over contiguous arrays that the compiler can vectorize
+	const size_t size = mMorphValues.size();
+	const float *start = mMorphStart.data();
+	const float *target = mTargetValues.data();
+	float *values = mMorphValues.data();
+	if (progress < 1) {
+		for (size_t i = 0; i < size; ++i) {
+			values[i] = start[i] + (target[i] - start[i]) * weight;
+		}
+	} else {
+		std::copy(target, target + size, values);
+		mMorphing = false;
+	}
+
+	for (size_t i = 0; i < size; ++i) {
+		if (values[i] == values[i]) { // NaN if not in preset
+			mParameters[i]->set(values[i]);
+		}
+	}
+	mMorphProgress.store(progress);
+}
+
+void PresetHandler::clearCache()
+{
+	std::lock_guard<std::mutex> lk(mCacheLock);
+	mCache.clear();
+	++mCacheGeneration;
+}
+
+bool PresetHandler::storeBank(std::string fileName)
+{
+	std::string path = getCurrentPath();
+	if (path.back() != '/') {
+		path += "/";
+	}
+	std::vector<std::pair<int, std::string> > presets(mPresetsMap.begin(), mPresetsMap.end());
+	std::vector<Values> rows;
+	for (auto const &preset: presets) {
+		rows.push_back(presetValues(preset.first, preset.second));
+	}
+
+	uint32_t valuesOffset = sizeof(bankIdentifier) + 3 * sizeof(uint32_t);
+	for (Parameter *param: mParameters) {
+		valuesOffset += sizeof(uint32_t) + param->getFullAddress().size();
+	}
+	for (auto const &preset: presets) {
+		valuesOffset += 2 * sizeof(uint32_t) + preset.second.size();
+	}
+	valuesOffset = (valuesOffset + 15) & ~15;
+
+	std::ofstream f(path + fileName, std::ios::binary);
+	if (!f.is_open()) {
+		std::cout << "Error while opening preset bank: " << path + fileName << std::endl;
+		return false;
+	}
+	f.write(bankIdentifier, sizeof(bankIdentifier));
+	writeBankInt(f, mParameters.size());
+	writeBankInt(f, presets.size());
+	writeBankInt(f, valuesOffset);
+	for (Parameter *param: mParameters) {
+		writeBankString(f, param->getFullAddress());
+	}
+	for (auto const &preset: presets) {
+		writeBankInt(f, preset.first);
+		writeBankString(f, preset.second);
+	}
+	while (std::streamoff(f.tellp()) < valuesOffset) {
+		f.put(0);
+	}
+	const float missing = std::numeric_limits<float>::quiet_NaN();
+	for (Values const &row: rows) {
+		for (size_t i = 0; i < mParameters.size(); ++i) {
+			float value = i < row->size() ? (*row)[i] : missing;
+			f.write((const char *)&value, sizeof(value));
+		}
+	}
+	f.close();
+	if (f.fail()) {
+		std::cout << "Error while writing preset bank: " << path + fileName << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool PresetHandler::loadBank(std::string fileName)
+{
+	std::string path = getCurrentPath();
+	if (path.back() != '/') {
+		path += "/";
+	}
+	path += fileName;
+	std::ifstream f(path, std::ios::binary);
+	if (!f.is_open()) {
+		std::cout << "Error while opening preset bank: " << path << std::endl;
+		return false;
+	}
+	char identifier[sizeof(bankIdentifier)];
+	f.read(identifier, sizeof(identifier));
+	uint32_t numParameters = readBankInt(f);
+	uint32_t numPresets = readBankInt(f);
+	uint32_t valuesOffset = readBankInt(f);
+	if (!f || memcmp(identifier, bankIdentifier, sizeof(identifier)) != 0) {
+		std::cout << "Not a preset bank: " << path << std::endl;
+		return false;
+	}
+	std::vector<std::string> addresses;
+	for (uint32_t i = 0; i < numParameters && f; ++i) {
+		addresses.push_back(readBankString(f));
+	}
+	std::vector<std::pair<int, std::string> > presets;
+	for (uint32_t i = 0; i < numPresets && f; ++i) {
+		int index = int(readBankInt(f));
+		presets.push_back(std::make_pair(index, readBankString(f)));
+	}
+	if (!f || std::streamoff(f.tellg()) > valuesOffset) {
+		std::cout << "Error while reading preset bank: " << path << std::endl;
+		return false;
+	}
+	f.close();
+
+	{
+		std::lock_guard<std::mutex> lk(mCacheLock);
+		mBank.dataFree();
+		mBankRows.clear();
+		if (numParameters > 0 && numPresets > 0) {
+			AlloArrayHeader header;
+			header.type = AlloFloat32Ty;
+			header.components = 1;
+			allo_array_setdim2d(&header, numParameters, numPresets);
+			allo_array_setstride(&header, 1);
+			if (!mBank.dataMap(path, valuesOffset, header)) {
+				return false;
+			}
+		}
+		for (size_t i = 0; i < presets.size(); ++i) {
+			mBankRows[presets[i].first] = i;
+		}
+		mBankAddresses = addresses;
+		mapBankColumns();
+		mCache.clear();
+		++mCacheGeneration;
+	}
+	for (auto const &preset: presets) {
+		mPresetsMap[preset.first] = preset.second;
+	}
+	return true;
+}
+
 std::string PresetHandler::getCurrentPath()
 {
 	std::string relPath = mRootDir;
@@ -346,93 +613,200 @@ void PresetHandler::storePresetMap()
 }
 
 void PresetHandler::morphingFunction(al::PresetHandler *handler) {
+	std::unique_lock<std::mutex> lk(handler->mTargetLock);
 	while(handler->mRunning) {
-		std::unique_lock<std::mutex> lk(handler->mTargetLock);
-		handler->mMorphConditionVar.wait(lk);
-		while (std::atomic_fetch_sub(&(handler->mMorphRemainingSteps), 1) > 0) {
-			for (Parameter *param: handler->mParameters) {
-				float paramValue = param->get();
-				if (handler->mTargetValues.find(param->getFullAddress()) != handler->mTargetValues.end()) {
-					float difference =  handler->mTargetValues[param->getFullAddress()] - paramValue;
-					int steps = handler->mMorphRemainingSteps.load();
-					if (steps > 0) {
-						difference = difference/(steps + 1);
-					}
-					float newVal = paramValue + difference;
-					param->set(newVal);
-				}
+		handler->mMorphConditionVar.wait(lk, [handler]() {
+			return !handler->mRunning
+			        || (handler->mMorphing && !handler->mExternalClock.load());
+		});
+		double last = al::timeNow();
+		while (handler->mRunning && handler->mMorphing
+		       && !handler->mExternalClock.load()) {
+			double now = al::timeNow();
+			handler->advanceMorph(now - last);
+			last = now;
+			if (!handler->mMorphing) {
+				break;
 			}
+			// Let a new target be set while waiting
+			lk.unlock();
 			al::wait(handler->mMorphInterval);
+			lk.lock();
 		}
-//		// Set final values
-//		for (Parameter param: mParameters) {
-//			if (preset.find(param.getName()) != preset.end()) {
-//				param.set(preset[param.getName()]);
-//			}
-//		}
 	}
 }
 
-std::map<std::string, float> PresetHandler::loadPresetValues(std::string name)
+PresetHandler::Values PresetHandler::readPresetFile(const std::string &fileName,
+                                                   const std::vector<std::string> &addresses,
+                                                   bool verbose)
 {
-	std::map<std::string, float> preset;
-	std::lock_guard<std::mutex> lock(mFileLock);
-	std::string path = getCurrentPath();
-	if (path.back() != '/') {
-		path += "/";
+	std::shared_ptr<std::vector<float> > preset = std::make_shared<std::vector<float> >(
+	            addresses.size(), std::numeric_limits<float>::quiet_NaN());
+	std::unordered_map<std::string, int> indices;
+	for (size_t i = 0; i < addresses.size(); ++i) {
+		indices[addresses[i]] = i;
 	}
 	std::string line;
-	std::ifstream f(path + name + ".preset");
+	std::ifstream f(fileName);
 	if (!f.is_open()) {
-		if (mVerbose) {
-			std::cout << "Error while opening preset file: " << mFileName << std::endl;
+		if (verbose) {
+			std::cout << "Error while opening preset file: " << fileName << std::endl;
 		}
 	}
 	while(getline(f, line)) {
 		if (line.substr(0, 2) == "::") {
-			if (mVerbose) {
+			if (verbose) {
 				std::cout << "Found preset : " << line << std::endl;
 			}
 			while (getline(f, line)) {
 				if (line.substr(0, 2) == "::") {
-					if (mVerbose) {
+					if (verbose) {
 						std::cout << "End preset."<< std::endl;
 					}
 					break;
 				}
-				bool parameterFound = false;
 				std::stringstream ss(line);
 				std::string address, type, value;
 				std::getline(ss, address, ' ');
 				std::getline(ss, type, ' ');
 				std::getline(ss, value, ' ');
-				for(Parameter *param: mParameters) {
-					if (mVerbose) {
-						std::cout << "Checking for parameter match: " << param->getFullAddress() << std::endl;
-					}
-					if (param->getFullAddress() == address) {
-						if (type == "f") {
-							preset.insert(std::pair<std::string,float>(address,std::stof(value)));
-							parameterFound = true;
-							break;
-						}
-					}
-				}
-				if (!parameterFound && mVerbose) {
+				auto param = indices.find(address);
+				if (param != indices.end() && type == "f") {
+					(*preset)[param->second] = std::stof(value);
+				} else if (verbose) {
 					std::cout << "Preset in parameter not present: " << address << std::endl;
 				}
 			}
 		}
 	}
 	if (f.bad()) {
-		if (mVerbose) {
-			std::cout << "Error while writing preset file: " << mFileName << std::endl;
+		if (verbose) {
+			std::cout << "Error while reading preset file: " << fileName << std::endl;
 		}
 	}
 	f.close();
 	return preset;
 }
 
+std::string PresetHandler::presetFileName(const std::string &name)
+{
+	std::string path = getCurrentPath();
+	if (path.back() != '/') {
+		path += "/";
+	}
+	return path + name + ".preset";
+}
+
+std::vector<std::string> PresetHandler::parameterAddresses()
+{
+	std::vector<std::string> addresses;
+	for (Parameter *param: mParameters) {
+		addresses.push_back(param->getFullAddress());
+	}
+	return addresses;
+}
+
+PresetHandler::Values PresetHandler::loadPresetValues(const std::string &name)
+{
+	std::lock_guard<std::mutex> lock(mFileLock);
+	return readPresetFile(presetFileName(name), parameterAddresses(), mVerbose);
+}
+
+PresetHandler::Values PresetHandler::presetValues(int index, const std::string &name)
+{
+	unsigned generation;
+	Values values = cachedPresetValues(index, generation);
+	if (values) {
+		return values;
+	}
+	// Read the file without holding the cache lock
+	return cachePresetValues(index, generation, loadPresetValues(name));
+}
+
+PresetHandler::Values PresetHandler::cachedPresetValues(int index, unsigned &generation)
+{
+	std::lock_guard<std::mutex> lk(mCacheLock);
+	generation = mCacheGeneration;
+	auto cached = mCache.find(index);
+	if (cached != mCache.end()) {
+		return cached->second;
+	}
+	auto row = mBankRows.find(index);
+	if (row != mBankRows.end()) {
+		const float *bankValues = (const float *)(mBank.data.ptr + row->second * mBank.header.stride[1]);
+		std::shared_ptr<std::vector<float> > values = std::make_shared<std::vector<float> >(mBankColumns.size());
+		for (size_t i = 0; i < mBankColumns.size(); ++i) {
+			int column = mBankColumns[i];
+			(*values)[i] = column >= 0 ? bankValues[column] : std::numeric_limits<float>::quiet_NaN();
+		}
+		mCache[index] = values;
+		return values;
+	}
+	return Values();
+}
+
+PresetHandler::Values PresetHandler::cachePresetValues(int index, unsigned generation, Values values)
+{
+	std::lock_guard<std::mutex> lk(mCacheLock);
+	if (generation != mCacheGeneration) {
+		return values;
+	}
+	// Keep an entry stored or loaded in the meantime
+	return mCache.insert(std::make_pair(index, values)).first->second;
+}
+
+int PresetHandler::presetIndex(const std::string &name)
+{
+	for (auto preset: mPresetsMap) {
+		if (preset.second == name) {
+			return preset.first;
+		}
+	}
+	return -1;
+}
+
+void PresetHandler::prefetchNeighbours(int index)
+{
+	std::vector<std::string> addresses;
+	for (int offset = -mPrefetch; offset <= mPrefetch; ++offset) {
+		auto preset = mPresetsMap.find(index + offset);
+		if (offset == 0 || preset == mPresetsMap.end()) {
+			continue;
+		}
+		int presetIndex = preset->first;
+		unsigned generation;
+		if (cachedPresetValues(presetIndex, generation)) {
+			continue;
+		}
+		// The task works on copies; it only touches the cache under its lock
+		std::string fileName = presetFileName(preset->second);
+		if (addresses.empty()) {
+			addresses = parameterAddresses();
+		}
+		bool verbose = mVerbose;
+		++mPrefetching;
+		ThreadPool::global().submit([this, presetIndex, generation, fileName, addresses, verbose]() {
+			cachePresetValues(presetIndex, generation, readPresetFile(fileName, addresses, verbose));
+			--mPrefetching;
+		});
+	}
+}
+
+void PresetHandler::mapBankColumns()
+{
+	std::unordered_map<std::string, int> columns;
+	for (size_t i = 0; i < mBankAddresses.size(); ++i) {
+		columns[mBankAddresses[i]] = i;
+	}
+	mBankColumns.assign(mParameters.size(), -1);
+	for (size_t i = 0; i < mParameters.size(); ++i) {
+		auto column = columns.find(mParameters[i]->getFullAddress());
+		if (column != columns.end()) {
+			mBankColumns[i] = column->second;
+		}
+	}
+}
+
 
 // PresetServer ----------------------------------------------------------------
 
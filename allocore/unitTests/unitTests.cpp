@@ -33,11 +33,14 @@ int main (int argc, char * const argv[]) {
 	RUNTEST(System);
 	RUNTEST(ProtocolOSC);
 	RUNTEST(ProtocolSerialize);
+	RUNTEST(UIParameter);
+	RUNTEST(UIPreset);
 
 	RUNTEST(IOSocket);
 	RUNTEST(File);
 	RUNTEST(Thread);
 
+	RUNTEST(Field3D);
 	RUNTEST(GraphicsMesh);
 
 #ifndef ALLOCORE_TESTS_NO_AUDIO
@@ -59,6 +62,7 @@ int main (int argc, char * const argv[]) {
 
 //	utAsset();
 //	utGraphicsDraw();
+//	utBenchmarks();
 
 	return 0;
 }
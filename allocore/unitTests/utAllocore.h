@@ -26,14 +26,18 @@ int utGraphicsDraw();
 int utGraphicsMesh();
 int utProtocolOSC();
 int utProtocolSerialize();
+int utUIParameter();
+int utUIPreset();
 int utSpatial();
 int utSystem();
 int utTypes();
 int utTypesConversion();
 int utThread();
+int utField3D();
 int utFile();
 int utAsset();
 int utAmbisonics();
+int utBenchmarks();
 
 SearchPaths& getSearchPaths();
 
@@ -40,8 +40,95 @@ void testFirstOrder2D() {
 	}
 }
 
+// Compare blocked decode against a direct evaluation of the decode matrix
+void testDecode(int dim, int order) {
+	const int bufferSize = 100; // not a multiple of the decode block size
+	const int numSpeakers = 12;
+
+	SpeakerLayout speakerLayout;
+	for (int s = 0; s < numSpeakers; s++) {
+		// reversed device channels; one silent speaker
+		speakerLayout.addSpeaker(Speaker(numSpeakers-1-s, 30.*s, dim==3 ? 10.*(s%5)-20. : 0., 1., s==3 ? 0. : 1.));
+	}
+
+	AmbiDecode decoder(dim, order, numSpeakers, 1);
+	decoder.setSpeakers(&(speakerLayout.speakers()));
+	const int numChannels = decoder.channels();
+
+	std::vector<float> ambiBuffer(bufferSize * numChannels);
+	rnd::Random<> rng;
+	for (unsigned i = 0; i < ambiBuffer.size(); i++) {
+		ambiBuffer[i] = rng.uniformS();
+	}
+
+	std::vector<float> speakerSignals(bufferSize * numSpeakers, 0.5f);
+	decoder.decode(&speakerSignals[0], &ambiBuffer[0], bufferSize);
+
+	for (int s = 0; s < numSpeakers; s++) {
+		const Speaker& spkr = speakerLayout.speakers()[s];
+		for (int i = 0; i < bufferSize; i++) {
+			float expected = 0.5f;
+			if (spkr.gain != 0.) {
+				for (int c = 0; c < numChannels; c++) {
+					expected += decoder.decodeWeight(s, c) * ambiBuffer[c * bufferSize + i];
+				}
+			}
+			assert(almostEqual(speakerSignals[spkr.deviceChannel * bufferSize + i], expected));
+		}
+	}
+}
+
+// Compare batch encoding of many sources against per sample encoding
+void testBatchEncode(int dim, int order) {
+	const int bufferSize = 100; // not a multiple of the encode block size
+	const int numSources = 5;
+
+	AmbiEncode encoder(dim, order);
+	const int numChannels = encoder.channels();
+
+	rnd::Random<> rng;
+	std::vector<float> dirBuffers(numSources * bufferSize * 3);
+	std::vector<float> inputBuffers(numSources * bufferSize);
+	std::vector<const float *> dirs, inputs;
+	for (int s = 0; s < numSources; s++) {
+		float * x = &dirBuffers[s * bufferSize * 3];
+		float * y = x + bufferSize;
+		float * z = y + bufferSize;
+		float * in = &inputBuffers[s * bufferSize];
+		for (int i = 0; i < bufferSize; i++) {
+			Vec3f dir(rng.uniformS(), rng.uniformS(), rng.uniformS());
+			dir.normalize();
+			x[i] = dir[0]; y[i] = dir[1]; z[i] = dir[2];
+			in[i] = rng.uniformS();
+		}
+		dirs.push_back(x);
+		inputs.push_back(in);
+	}
+
+	std::vector<float> expected(bufferSize * numChannels, 0.25f);
+	for (int s = 0; s < numSources; s++) {
+		for (int i = 0; i < bufferSize; i++) {
+			encoder.direction(dirs[s][i], dirs[s][i + bufferSize], dirs[s][i + 2*bufferSize]);
+			encoder.encode(&expected[0], bufferSize, i, inputs[s][i]);
+		}
+	}
+
+	std::vector<float> ambiBuffer(bufferSize * numChannels, 0.25f);
+	encoder.encode(&ambiBuffer[0], bufferSize, numSources, &dirs[0], &inputs[0]);
+
+	for (unsigned i = 0; i < ambiBuffer.size(); i++) {
+		assert(almostEqual(ambiBuffer[i], expected[i]));
+	}
+}
+
 int utAmbisonics() {
 	testFirstOrder2D();
+	for (int order = 1; order <= 3; order++) {
+		testDecode(2, order);
+		testDecode(3, order);
+		testBatchEncode(2, order);
+		testBatchEncode(3, order);
+	}
 
 	return 0;
 }
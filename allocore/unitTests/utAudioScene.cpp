@@ -274,6 +274,390 @@ void testAmbisonicsFirstOrder2D(int bufferSize) {
 	delete panner;
 }
 
+void testDbapInterpolation(int bufferSize) {
+	SpeakerLayout speakerLayout = OctalSpeakerLayout();
+	Dbap *panner = new Dbap(speakerLayout, 2.f);
+	AudioScene scene(bufferSize);
+	SoundSource src;
+	scene.createListener(panner);
+	AudioIO audioIO(bufferSize, 44100, NULL, NULL, speakerLayout.numSpeakers(), 0, AudioIOData::DUMMY);
+	src.dopplerType(DOPPLER_NONE);
+	src.useAttenuation(false);
+	scene.addSource(src);
+
+	for (int i = 0; i < bufferSize*2 + 4; i++) {
+		src.writeSample(1.0);
+	}
+
+	float gainsA[8], gainsB[8];
+	Vec3d posA(1, 0, 0), posB(0, -1, 0.5);
+	panner->computeGains(gainsA, posA);
+	panner->computeGains(gainsB, posB);
+
+	// First block is not interpolated
+	src.pos(posA[0], posA[1], posA[2]);
+	scene.render(audioIO);
+	for (int k = 0; k < 8; k++) {
+		for (int i = 0; i < bufferSize; i++) {
+			assert(almostEqual(audioIO.out(k, i), gainsA[k]));
+		}
+	}
+
+	// Moving the source ramps linearly to the new gains
+	src.pos(posB[0], posB[1], posB[2]);
+	scene.render(audioIO);
+	for (int k = 0; k < 8; k++) {
+		float step = (gainsB[k] - gainsA[k]) / bufferSize;
+		assert(almostEqual(audioIO.out(k, 0), gainsA[k] + step));
+		assert(almostEqual(audioIO.out(k, bufferSize/2), gainsA[k] + step*(bufferSize/2+1)));
+		assert(almostEqual(audioIO.out(k, bufferSize-1), gainsB[k]));
+	}
+
+	delete panner;
+}
+
+void testVbapLookup(bool is3D) {
+	// Dome of rings with speakers at different azimuth offsets
+	int rings[][2] = {{-30, 6}, {0, 12}, {30, 8}, {60, 4}, {90, 1}};
+	SpeakerLayout speakerLayout;
+	int chan = 0;
+	for (auto& ring : rings) {
+		if (!is3D && ring[0] != 0) continue;
+		for (int i = 0; i < ring[1]; i++) {
+			speakerLayout.addSpeaker(Speaker(chan++, 360.f/ring[1]*i + ring[0]*0.1f, ring[0]));
+		}
+	}
+	Vbap *panner = new Vbap(speakerLayout);
+	panner->setIs3D(is3D);
+	AudioScene scene(8);
+	scene.createListener(panner);
+
+	std::vector<SpeakerTriple> triplets = panner->triplets();
+	unsigned numTriplets = triplets.size();
+	rnd::Random<> rng(1);
+
+	for (int k = 0; k < 10000; k++) {
+		Vec3d dir(rng.uniformS(), rng.uniformS(), rng.uniformS());
+		// Include directions exactly on speakers and on shared edges
+		if (k % 10 == 0) dir = triplets[k % numTriplets].vec[k % (is3D ? 3 : 2)];
+		if (k % 10 == 1) dir = triplets[k % numTriplets].vec[0] + triplets[k % numTriplets].vec[1];
+		unsigned start = rng.uniform(numTriplets);
+
+		// Reference linear search
+		unsigned expected = start;
+		Vec3d expectedGains;
+		bool expectedFound = false;
+		for (unsigned count = 0; count < numTriplets; count++) {
+			Vec3d g = panner->computeGains(dir, triplets[expected]);
+			if (g[0] >= 0 && g[1] >= 0 && (!is3D || g[2] >= 0)) {
+				expectedGains = g;
+				expectedFound = true;
+				break;
+			}
+			if (++expected >= numTriplets) expected = 0;
+		}
+
+		unsigned index = start;
+		Vec3d gains;
+		bool found = panner->findTriplet(dir, index, gains);
+		assert(found == expectedFound);
+		assert(index == expected);
+		if (found) assert(gains == expectedGains);
+	}
+
+	delete panner;
+}
+
+void testParallelRender(int bufferSize) {
+	SpeakerLayout speakerLayout = OctalSpeakerLayout();
+	Dbap *panner = new Dbap(speakerLayout);
+	AudioScene scene(bufferSize);
+	const int numSources = 37;
+	SoundSource src[numSources];
+	scene.createListener(panner);
+	AudioIO audioIO(bufferSize, 44100, NULL, NULL, speakerLayout.numSpeakers(), 0, AudioIOData::DUMMY);
+
+	for (int j = 0; j < numSources; j++) {
+		src[j].dopplerType(DOPPLER_NONE);
+		src[j].pos(cos(j), sin(j*0.3), 0.1*j);
+		scene.addSource(src[j]);
+		for (int i = 0; i < bufferSize; i++) {
+			src[j].writeSample(sin(0.1*i + j));
+		}
+	}
+
+	scene.render(audioIO);
+	std::vector<float> serial(audioIO.outBuffer(), audioIO.outBuffer() + bufferSize*speakerLayout.numSpeakers());
+
+	for (int numThreads = 2; numThreads <= 5; numThreads++) {
+		scene.numThreads(numThreads, speakerLayout.numSpeakers());
+		assert(scene.numThreads() == numThreads);
+		// Render twice to check the workers pick up subsequent blocks
+		for (int k = 0; k < 2; k++) {
+			scene.render(audioIO);
+			for (unsigned i = 0; i < serial.size(); i++) {
+				assert(almostEqual(audioIO.outBuffer()[i], serial[i]));
+			}
+		}
+	}
+
+	scene.numThreads(1, 0);
+	assert(scene.numThreads() == 1);
+
+	delete panner;
+}
+
+struct PoseSender {
+	AudioScene *scene;
+	SoundSource *src;
+	std::atomic<bool> done;
+};
+const int poseSends = 2000;
+
+void *poseSender(void *user) {
+	PoseSender& sender = *(PoseSender *)user;
+	for (int i = 0; i < poseSends; i++) {
+		Pose pose(Vec3d(i, 0, 0));
+		while (!sender.scene->sendPose(*sender.src, pose)) {} // retry when full
+	}
+	sender.done = true;
+	return NULL;
+}
+
+void testCommandQueue() {
+	const int bufferSize = 64;
+	SpeakerLayout speakerLayout = OctalSpeakerLayout();
+	Dbap *panner = new Dbap(speakerLayout);
+	AudioScene scene(bufferSize, 4);
+	SoundSource src[3];
+	Listener *listener = scene.createListener(panner);
+	AudioIO audioIO(bufferSize, 44100, NULL, NULL, speakerLayout.numSpeakers(), 0, AudioIOData::DUMMY);
+
+	for (int j = 0; j < 3; j++) {
+		assert(scene.sendAddSource(src[j]));
+	}
+	Pose pose(Vec3d(1, 2, 3));
+	assert(scene.sendPose(src[1], pose));
+
+	// Fill queue; it holds at least 4 commands
+	int numSent = 4;
+	while (scene.sendPose(src[1], pose)) numSent++;
+	assert(numSent < 100);
+
+	// Commands are applied at the start of the next block
+	assert(scene.sources().size() == 0);
+	scene.render(audioIO);
+	assert(scene.sources().size() == 3);
+	assert(scene.sources()[1] == &src[1]);
+	assert(src[1].pos() == Vec3d(1, 2, 3));
+
+	assert(scene.sendParam(src[1], AudioScene::FAR_CLIP, 40));
+	assert(scene.sendParam(src[1], AudioScene::DOPPLER_TYPE, DOPPLER_NONE));
+	assert(scene.sendRemoveSource(src[0]));
+	assert(scene.sendPose(*listener, pose));
+	scene.render(audioIO);
+	assert(src[1].farClip() == 40);
+	assert(src[1].dopplerType() == DOPPLER_NONE);
+	assert(scene.sources().size() == 2);
+	assert(scene.sources()[0] == &src[1]);
+	assert(scene.sources()[1] == &src[2]);
+	assert(listener->pos() == Vec3d(1, 2, 3));
+
+	// Concurrent senders; each sender's commands are applied in order
+	{
+		Thread threads[3];
+		PoseSender senders[3];
+		for (int j = 0; j < 3; j++) {
+			senders[j].scene = &scene;
+			senders[j].src = &src[j];
+			senders[j].done = false;
+			threads[j].start(poseSender, &senders[j]);
+		}
+		int numDone = 0;
+		while (numDone < 3) {
+			scene.render(audioIO);
+			numDone = 0;
+			for (int j = 0; j < 3; j++) numDone += senders[j].done;
+		}
+		for (int j = 0; j < 3; j++) threads[j].join();
+		scene.render(audioIO);
+		for (int j = 0; j < 3; j++) {
+			assert(src[j].pos() == Vec3d(poseSends-1, 0, 0));
+		}
+	}
+
+	delete panner;
+}
+
+void testDelayPool() {
+	DelayPool pool(4096);
+	int size = 1000;
+	float * a = pool.allocate(size);
+	assert(size == 1024);
+	int size2 = 3000;
+	float * b = pool.allocate(size2);
+	assert(size2 == 4096);
+	assert(pool.reserved() == 2*4096);
+	pool.deallocate(a, size);
+	int size3 = 1024;
+	assert(pool.allocate(size3) == a); // reused
+	pool.deallocate(b, size2);
+
+	// Free blocks are linked through their samples, yet come back zeroed
+	int size4 = 1;
+	float * c = pool.allocate(size4);
+	assert(size4 * sizeof(float) >= sizeof(float *));
+	float * d = pool.allocate(size4);
+	pool.deallocate(c, size4);
+	pool.deallocate(d, size4);
+	assert(pool.allocate(size4) == d);
+	assert(pool.allocate(size4) == c);
+	for (int i = 0; i < size4; i++) assert(c[i] == 0);
+
+	// Pooled delay-line sized for distance; block reads match sample reads
+	const double sampleRate = 44100;
+	const int bufferSize = 64;
+	SoundSource owned(0.1, 20, ATTEN_INVERSE, DOPPLER_SYMMETRICAL, 0, 3000);
+	SoundSource pooled(0.1, 20, ATTEN_INVERSE, DOPPLER_SYMMETRICAL, 0, 0);
+	pooled.delayLine(pool, 20, sampleRate, 340, bufferSize);
+	assert(pooled.delaySize() >= SoundSource::bufferSize(sampleRate, 340, 20) + bufferSize);
+	assert(pooled.delaySize() < owned.delaySize() * 2);
+
+	rnd::Random<> rng;
+	float block[bufferSize];
+	for (int k = 0; k < 200; k++) { // wraps around both delay-lines
+		for (int i = 0; i < bufferSize; i++) {
+			float v = rng.uniformS();
+			owned.writeSample(v);
+			pooled.writeSample(v);
+		}
+		double index = rng.uniform() * (owned.maxIndex() - bufferSize) + bufferSize;
+		owned.readSamples(block, index, bufferSize, 0.5);
+		for (int i = 0; i < bufferSize; i++) {
+			assert(almostEqual(block[i], 0.5f * owned.readSample(index - i)));
+		}
+		pooled.readSamples(block, index, bufferSize, 0.5);
+		for (int i = 0; i < bufferSize; i++) {
+			assert(almostEqual(block[i], 0.5f * owned.readSample(index - i)));
+		}
+	}
+}
+
+void testCulling() {
+	const int bufferSize = 64;
+	SpeakerLayout speakerLayout = OctalSpeakerLayout();
+	// Each scene has its own spatializer, as spatializers keep per source state
+	Dbap *referencePanner = new Dbap(speakerLayout);
+	Dbap *panner = new Dbap(speakerLayout);
+	AudioIO audioIO(bufferSize, 44100, NULL, NULL, speakerLayout.numSpeakers(), 0, AudioIOData::DUMMY);
+	const int numSamples = bufferSize * speakerLayout.numSpeakers();
+
+	// Near source, source beyond far clip and a source in front of the listener
+	SoundSource src[3];
+	double dists[3] = {5, 50, 3};
+	for (int j = 0; j < 3; j++) {
+		src[j].law(ATTEN_LINEAR);
+		src[j].dopplerType(DOPPLER_NONE);
+		src[j].pos(dists[j], 0.5, 0);
+		for (int i = 0; i < bufferSize; i++) {
+			src[j].writeSample(sin(0.1*i + j));
+		}
+	}
+
+	AudioScene reference(bufferSize);
+	reference.createListener(referencePanner);
+	reference.addSource(src[0]);
+	reference.addSource(src[2]);
+	// Render a few blocks so position histories are settled
+	for (int k = 0; k < 4; k++) reference.render(audioIO);
+	std::vector<float> expected(audioIO.outBuffer(), audioIO.outBuffer() + numSamples);
+
+	AudioScene scene(bufferSize);
+	scene.createListener(panner);
+	for (int j = 0; j < 3; j++) scene.addSource(src[j]);
+	for (int k = 0; k < 4; k++) scene.render(audioIO);
+	assert(scene.numCulled() == 1);
+	assert(scene.numDropped() == 0);
+	for (int i = 0; i < numSamples; i++) {
+		assert(almostEqual(audioIO.outBuffer()[i], expected[i]));
+	}
+
+	// Cap voices; higher priority wins over louder
+	scene.maxSources(1);
+	src[0].priority(1);
+	scene.render(audioIO);
+	assert(scene.numCulled() == 1);
+	assert(scene.numDropped() == 1);
+	reference.removeSource(src[2]);
+	reference.render(audioIO);
+	expected.assign(audioIO.outBuffer(), audioIO.outBuffer() + numSamples);
+	scene.render(audioIO);
+	for (int i = 0; i < numSamples; i++) {
+		assert(almostEqual(audioIO.outBuffer()[i], expected[i]));
+	}
+	scene.maxSources(0);
+
+	// Distant sources are downgraded to per buffer processing
+	scene.usePerSampleProcessing(true);
+	scene.lodDistance(4);
+	scene.render(audioIO);
+	assert(scene.numDowngraded() == 1);
+	assert(scene.numCulled() == 1);
+
+	// Raising cull gain culls the quieter near source
+	scene.cullGain(src[0].attenuation(dists[0]) * 1.01);
+	scene.render(audioIO);
+	assert(scene.numCulled() == 2);
+	assert(scene.numDowngraded() == 0);
+
+	delete referencePanner;
+	delete panner;
+}
+
+// Spatializer written against the perform() overloads without source index
+struct MonoSpatializer : public Spatializer {
+	MonoSpatializer(const SpeakerLayout& sl) : Spatializer(sl) {}
+
+	using Spatializer::perform;
+
+	void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos,
+		const int& numFrames, int& frameIndex, float& sample){
+		io.out(0, frameIndex) += sample;
+	}
+
+	void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos,
+		const int& numFrames, float *samples){
+		for (int i = 0; i < numFrames; i++) io.out(0, i) += samples[i];
+	}
+};
+
+void testDeprecatedPerform(bool perSample) {
+	const int bufferSize = 8;
+	SpeakerLayout speakerLayout = HeadsetSpeakerLayout();
+	MonoSpatializer panner(speakerLayout);
+	AudioScene scene(bufferSize);
+	SoundSource src;
+	scene.createListener(&panner);
+	scene.usePerSampleProcessing(perSample);
+	AudioIO audioIO(bufferSize, 44100, NULL, NULL, speakerLayout.numSpeakers(), 0, AudioIOData::DUMMY);
+	src.dopplerType(DOPPLER_NONE);
+	src.useAttenuation(false);
+	scene.addSource(src);
+
+	for (int k = 0; k < 2; k++) {
+		for (int i = 0; i < bufferSize; i++) src.writeSample(0.5);
+		src.pos(1, 0, 0);
+		scene.render(audioIO);
+	}
+	// rendered through the overloads of MonoSpatializer
+	float sum = 0;
+	for (int i = 0; i < bufferSize; i++) {
+		sum += audioIO.out(0, i);
+		assert(audioIO.out(1, i) == 0);
+	}
+	assert(sum > 0);
+}
+
 int utAudioScene() {
 	testStereo(8);
 	testStereo(4096);
@@ -284,5 +668,23 @@ int utAudioScene() {
 
 	testAmbisonicsFirstOrder2D(8);
 
+	testDbapInterpolation(8);
+	testDbapInterpolation(256);
+
+	testVbapLookup(true);
+	testVbapLookup(false);
+
+	testParallelRender(8);
+	testParallelRender(256);
+
+	testCommandQueue();
+
+	testDelayPool();
+
+	testCulling();
+
+	testDeprecatedPerform(false);
+	testDeprecatedPerform(true);
+
 	return 0;
 }
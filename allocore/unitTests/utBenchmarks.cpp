@@ -0,0 +1,741 @@
+#include "utAllocore.h"
+#include "allocore/spatial/al_HashSpace.hpp"
+#include "allocore/types/al_MsgQueue.hpp"
+#include "allocore/types/al_MsgTube.hpp"
+#include "allocore/ui/al_Parameter.hpp"
+#include "allocore/ui/al_Preset.hpp"
+#include "alloutil/al_Field3D.hpp"
+#include <deque>
+#include <mutex>
+
+// Benchmarks print timing results to the console, so they are not run with
+// the logical tests.
+
+static void benchAudioSceneThreads(){
+	const int bufferSize = 256;
+	const int numBlocks = 100;
+	SpeakerRingLayout<54> speakerLayout;
+	Dbap panner(speakerLayout);
+	AudioIO audioIO(bufferSize, 44100, NULL, NULL, speakerLayout.numSpeakers(), 0, AudioIOData::DUMMY);
+	double deadline = audioIO.secondsPerBuffer();
+
+	printf("AudioScene::render, DBAP, %d speakers, %d frames/block (deadline %g ms)\n",
+		speakerLayout.numSpeakers(), bufferSize, deadline*1000);
+	printf("%8s %8s %12s %8s\n", "sources", "threads", "ms/block", "load");
+
+	int sourceCounts[] = {64, 256, 1024};
+	int threadCounts[] = {1, 2, 4, 8};
+
+	for(int numSources : sourceCounts){
+		AudioScene scene(bufferSize);
+		scene.createListener(&panner);
+		std::vector<SoundSource *> sources;
+		for(int j=0; j<numSources; ++j){
+			sources.push_back(new SoundSource(0.1, 20, ATTEN_INVERSE, DOPPLER_NONE, 0, 4*bufferSize));
+			sources[j]->pos(cos(j), sin(j), 0.01*j);
+			scene.addSource(*sources[j]);
+		}
+
+		for(int numThreads : threadCounts){
+			scene.numThreads(numThreads, speakerLayout.numSpeakers());
+			Timer timer;
+			for(int k=0; k<numBlocks; ++k){
+				scene.render(audioIO);
+			}
+			timer.stop();
+			double secPerBlock = timer.elapsedSec() / numBlocks;
+			printf("%8d %8d %12.3f %7.1f%%\n",
+				numSources, numThreads, secPerBlock*1000, secPerBlock/deadline*100);
+		}
+		scene.numThreads(1, 0);
+		for(int j=0; j<numSources; ++j) delete sources[j];
+	}
+}
+
+static void benchVbapLookup(){
+	const int numLookups = 100000;
+	printf("Vbap triplet search, random source directions\n");
+	printf("%8s %8s %14s %14s\n", "speakers", "triplets", "linear ns", "lookup ns");
+
+	// Domes of increasing density
+	for(int ringSize = 4; ringSize <= 12; ringSize += 4){
+		SpeakerLayout speakerLayout;
+		int chan = 0;
+		for(int el = -30; el < 90; el += 30){
+			for(int i = 0; i < ringSize; ++i){
+				speakerLayout.addSpeaker(Speaker(chan++, 360.f/ringSize*i + el*0.1f, el));
+			}
+		}
+		speakerLayout.addSpeaker(Speaker(chan++, 0, 90));
+
+		Vbap panner(speakerLayout);
+		AudioScene scene(256);
+		scene.createListener(&panner);
+		std::vector<SpeakerTriple> triplets = panner.triplets();
+		unsigned numTriplets = triplets.size();
+
+		rnd::Random<> rng;
+		std::vector<Vec3d> dirs(numLookups);
+		for(auto& d : dirs) d.set(rng.uniformS(), rng.uniformS(), rng.uniformS());
+
+		unsigned index = 0, found = 0;
+		Vec3d gains;
+		Timer timer;
+		for(auto& d : dirs){
+			for(unsigned count = 0; count < numTriplets; ++count){
+				gains = panner.computeGains(d, triplets[index]);
+				if(gains[0] >= 0 && gains[1] >= 0 && gains[2] >= 0){ ++found; break; }
+				if(++index >= numTriplets) index = 0;
+			}
+		}
+		timer.stop();
+		double linear = double(timer.elapsed()) / numLookups;
+
+		timer.start();
+		for(auto& d : dirs){
+			found += panner.findTriplet(d, index, gains);
+		}
+		timer.stop();
+		double lookup = double(timer.elapsed()) / numLookups;
+
+		printf("%8d %8d %14.1f %14.1f\n", chan, numTriplets, linear, lookup);
+	}
+}
+
+static void benchAmbiDecode(){
+	const int bufferSize = 256;
+	const int numBlocks = 2000;
+	SpeakerRingLayout<54> speakerLayout;
+	printf("AmbiDecode::decode, %d speakers, %d frames/block\n",
+		speakerLayout.numSpeakers(), bufferSize);
+	printf("%4s %6s %9s %14s %14s\n", "dim", "order", "channels", "scalar us", "blocked us");
+
+	for(int dim = 2; dim <= 3; ++dim){
+		for(int order = 1; order <= 3; ++order){
+			AmbiDecode decoder(dim, order, speakerLayout.numSpeakers());
+			decoder.setSpeakers(&speakerLayout.speakers());
+			const int numChannels = decoder.channels();
+			const int numSpeakers = decoder.numSpeakers();
+
+			rnd::Random<> rng;
+			std::vector<float> ambi(numChannels * bufferSize);
+			for(auto& v : ambi) v = rng.uniformS();
+			std::vector<float> out(numSpeakers * bufferSize, 0.f);
+
+			// Per speaker and channel loop with weights computed on the fly
+			Timer timer;
+			for(int k=0; k<numBlocks; ++k){
+				for(int s=0; s<numSpeakers; ++s){
+					if(decoder.speaker(s).gain == 0.) continue;
+					float * o = &out[decoder.speaker(s).deviceChannel * bufferSize];
+					for(int c=0; c<numChannels; ++c){
+						const float * in = &ambi[c * bufferSize];
+						float w = decoder.decodeWeight(s, c);
+						for(int i=0; i<bufferSize; ++i) o[i] += in[i] * w;
+					}
+				}
+			}
+			timer.stop();
+			double scalar = double(timer.elapsed()) / numBlocks * 1e-3;
+
+			timer.start();
+			for(int k=0; k<numBlocks; ++k){
+				decoder.decode(&out[0], &ambi[0], bufferSize);
+			}
+			timer.stop();
+			double blocked = double(timer.elapsed()) / numBlocks * 1e-3;
+
+			printf("%4d %6d %9d %14.2f %14.2f\n", dim, order, numChannels, scalar, blocked);
+		}
+	}
+}
+
+static void benchAmbiEncode(){
+	const int bufferSize = 256;
+	const int numBlocks = 20;
+	const int numSources = 256;
+	printf("AmbiEncode, %d moving sources, %d frames/block\n", numSources, bufferSize);
+	printf("%4s %6s %14s %14s\n", "dim", "order", "sample ms", "batch ms");
+
+	rnd::Random<> rng;
+	std::vector<float> dirBuffers(numSources * bufferSize * 3);
+	std::vector<float> inputBuffers(numSources * bufferSize);
+	std::vector<const float *> dirs, inputs;
+	for(int s=0; s<numSources; ++s){
+		float * x = &dirBuffers[s * bufferSize * 3];
+		for(int i=0; i<bufferSize; ++i){
+			Vec3f dir(rng.uniformS(), rng.uniformS(), rng.uniformS());
+			dir.normalize();
+			x[i] = dir[0]; x[i+bufferSize] = dir[1]; x[i+2*bufferSize] = dir[2];
+			inputBuffers[s * bufferSize + i] = rng.uniformS();
+		}
+		dirs.push_back(x);
+		inputs.push_back(&inputBuffers[s * bufferSize]);
+	}
+
+	for(int dim = 2; dim <= 3; ++dim){
+		for(int order = 1; order <= 3; ++order){
+			AmbiEncode encoder(dim, order);
+			std::vector<float> ambi(encoder.channels() * bufferSize, 0.f);
+
+			// Per sample direction and encode, as previously done by
+			// AmbisonicsSpatializer::perform
+			Timer timer;
+			for(int k=0; k<numBlocks; ++k){
+				for(int s=0; s<numSources; ++s){
+					for(int i=0; i<bufferSize; ++i){
+						encoder.direction(dirs[s][i], dirs[s][i+bufferSize], dirs[s][i+2*bufferSize]);
+						encoder.encode(&ambi[0], bufferSize, i, inputs[s][i]);
+					}
+				}
+			}
+			timer.stop();
+			double sample = timer.elapsedSec() / numBlocks * 1000;
+
+			timer.start();
+			for(int k=0; k<numBlocks; ++k){
+				encoder.encode(&ambi[0], bufferSize, numSources, &dirs[0], &inputs[0]);
+			}
+			timer.stop();
+			double batch = timer.elapsedSec() / numBlocks * 1000;
+
+			printf("%4d %6d %14.3f %14.3f\n", dim, order, sample, batch);
+		}
+	}
+}
+
+static void benchDelayPool(){
+	const int bufferSize = 256;
+	const int numBlocks = 50;
+	const int numSources = 1000;
+	const double sampleRate = 44100;
+	SpeakerRingLayout<8> speakerLayout;
+	Dbap panner(speakerLayout);
+	AudioIO audioIO(bufferSize, sampleRate, NULL, NULL, speakerLayout.numSpeakers(), 0, AudioIOData::DUMMY);
+	double deadline = audioIO.secondsPerBuffer();
+
+	printf("%d moving Doppler sources, DBAP, %d speakers, %d frames/block (deadline %g ms)\n",
+		numSources, speakerLayout.numSpeakers(), bufferSize, deadline*1000);
+	printf("%8s %16s %12s %8s\n", "delay", "samples/source", "ms/block", "load");
+
+	for(int usePool = 0; usePool < 2; ++usePool){
+		DelayPool pool;
+		AudioScene scene(bufferSize);
+		scene.createListener(&panner);
+		std::vector<SoundSource *> sources;
+		for(int j=0; j<numSources; ++j){
+			SoundSource * src = usePool
+				? new SoundSource(0.1, 20, ATTEN_INVERSE, DOPPLER_SYMMETRICAL, 0, 0)
+				: new SoundSource(0.1, 20, ATTEN_INVERSE, DOPPLER_SYMMETRICAL);
+			if(usePool) src->delayLine(pool, src->farClip(), sampleRate, 340, bufferSize);
+			sources.push_back(src);
+			scene.addSource(*src);
+		}
+
+		Timer timer;
+		al_nsec elapsed = 0;
+		for(int k=0; k<numBlocks; ++k){
+			for(int j=0; j<numSources; ++j){
+				double r = 1 + 15 * (0.5 + 0.5*sin(0.01*k + j));
+				sources[j]->pos(r*cos(j), r*sin(j), 0);
+				for(int i=0; i<bufferSize; ++i) sources[j]->writeSample(0.001f*i);
+			}
+			timer.start();
+			scene.render(audioIO);
+			timer.stop();
+			elapsed += timer.elapsed();
+		}
+		double secPerBlock = al_time_ns2s * elapsed / numBlocks;
+		printf("%8s %16d %12.3f %7.1f%%\n", usePool ? "pooled" : "fixed",
+			sources[0]->delaySize(), secPerBlock*1000, secPerBlock/deadline*100);
+		for(int j=0; j<numSources; ++j) delete sources[j];
+	}
+}
+
+static void benchHashSpaceRebuild(){
+	const int numObjects = 200000;
+	const int numFrames = 20;
+	HashSpace linked(5, numObjects);
+	HashSpace packed(5, numObjects);
+	printf("HashSpace, %d objects moving every frame, 32^3 voxels\n", numObjects);
+	printf("%20s %14s %14s\n", "", "update ms", "query ms");
+
+	rnd::Random<> rng;
+	std::vector<Vec3d> positions(numObjects), velocities(numObjects);
+	for(int i=0; i<numObjects; ++i){
+		positions[i].set(rng.uniform(32.), rng.uniform(32.), rng.uniform(32.));
+		velocities[i].set(rng.uniformS(), rng.uniformS(), rng.uniformS());
+	}
+
+	// Query neighbors of every object, as done by flocking
+	HashSpace::Query query(32);
+	auto queryAll = [&](HashSpace& space){
+		int found = 0;
+		for(int i=0; i<numObjects; ++i){
+			found += query.clear()(space, &space.object(i), 2.);
+		}
+		return found;
+	};
+
+	for(int mode=0; mode<4; ++mode){
+		al_nsec update = 0, search = 0;
+		Timer timer;
+		for(int k=0; k<numFrames; ++k){
+			for(int i=0; i<numObjects; ++i) positions[i] += velocities[i];
+			timer.start();
+			if(mode == 0){
+				for(int i=0; i<numObjects; ++i) linked.move(i, positions[i]);
+			}
+			else{
+				packed.rebuild(&positions[0], mode == 1 ? 1 : mode*2-2);
+			}
+			timer.stop();
+			update += timer.elapsed();
+			timer.start();
+			queryAll(mode == 0 ? linked : packed);
+			timer.stop();
+			search += timer.elapsed();
+		}
+		char name[32];
+		if(mode == 0) snprintf(name, sizeof(name), "move()");
+		else snprintf(name, sizeof(name), "rebuild(), %d thr.", mode == 1 ? 1 : mode*2-2);
+		printf("%20s %14.3f %14.3f\n", name,
+			al_time_ns2s * update / numFrames * 1000, al_time_ns2s * search / numFrames * 1000);
+	}
+}
+
+static void benchHashSpaceNearest(){
+	const int numObjects = 50000;
+	const unsigned k = 16;
+	const double radius = 2;
+	HashSpace space(5, numObjects);
+	printf("HashSpace, %u nearest neighbors of %d objects within radius %g\n", k, numObjects, radius);
+
+	rnd::Random<> rng;
+	std::vector<Vec3d> positions(numObjects);
+	for(int i=0; i<numObjects; ++i){
+		positions[i].set(rng.uniform(32.), rng.uniform(32.), rng.uniform(32.));
+		space.move(i, positions[i]);
+	}
+	std::vector<uint32_t> ids(numObjects*k);
+	std::vector<double> d2s(numObjects*k);
+	Timer timer;
+
+	// the per object loop, sorting each object's results
+	HashSpace::Query query(numObjects);
+	timer.start();
+	for(int i=0; i<numObjects; ++i){
+		int n = query.clear()(space, &space.object(i), radius);
+		std::sort(&query.results()[0], &query.results()[0] + n, HashSpace::Query::Result::compare);
+		for(int j=0; j<n && j<int(k); ++j){
+			const HashSpace::Query::Result& r = query.results()[n-1-j];
+			ids[i*k+j] = r.object - &space.object(0);
+			d2s[i*k+j] = r.distanceSquared;
+		}
+	}
+	timer.stop();
+	printf("%24s %10.3f ms\n", "Query, sorted", timer.elapsedSec()*1000);
+
+	for(int pass=0; pass<2; ++pass){
+		if(pass) space.rebuild(&positions[0]);
+		for(int numThreads=1; numThreads<=4; numThreads*=2){
+			timer.start();
+			space.nearestAll(k, radius, &ids[0], &d2s[0], numThreads);
+			timer.stop();
+			char name[32];
+			snprintf(name, sizeof(name), "nearestAll%s, %d thr.", pass ? " packed" : "", numThreads);
+			printf("%24s %10.3f ms\n", name, timer.elapsedSec()*1000);
+		}
+	}
+}
+
+// Field3D stencils on 3 component fields
+static void benchField3DStencils(){
+	const int N = 64, numPasses = 10;
+	printf("Field3D stencils, %d^3 cells, 3 components, %d passes\n", N, numPasses);
+	printf("%16s %8s %12s\n", "", "threads", "ms/call");
+
+	int threadCounts[] = {1, 2, 4};
+	for(int numThreads : threadCounts){
+		Field3D<float> field(3, N, N, N), velocity(3, N, N, N);
+		field.threads(numThreads);
+		rnd::Random<> rng(1);
+		field.adduniformS(rng);
+		velocity.adduniformS(rng);
+		Field3D<float>::Kernel3 kernel;
+		kernel.blur3();
+
+		for(int op=0; op<4; ++op){
+			const int numCalls = 5;
+			Timer timer;
+			timer.start();
+			for(int i=0; i<numCalls; ++i){
+				switch(op){
+				case 0: field.diffuse(0.1, numPasses); break;
+				case 1: field.diffuse(kernel, 0.1, numPasses); break;
+				case 2: field.relax(0.1, numPasses); break;
+				default: field.advect(velocity.front(), 1);
+				}
+			}
+			timer.stop();
+			const char * label[] = { "diffuse", "diffuse kernel", "relax", "advect" };
+			printf("%16s %8d %12.3f\n", label[op], numThreads,
+				timer.elapsedSec() / numCalls * 1000);
+		}
+	}
+}
+
+// Fluid3D::project() by relaxation and by multigrid, on random velocities
+static double benchRMSDivergence(Field3D<float>& v){
+	Array div;
+	v.calculateGradientMagnitude(div);
+	const float * d = (const float *)div.data.ptr;
+	const size_t n = v.dimx()*v.dimy()*v.dimz();
+	double sum = 0;
+	for(size_t i=0; i<n; ++i) sum += d[i]*d[i];
+	return sqrt(sum/n);
+}
+
+static void benchFluidProjection(){
+	const int N = 64, numSteps = 10;
+	printf("Fluid3D::project, %d^3 cells, random velocities\n", N);
+	printf("%12s %8s %12s %16s\n", "mode", "threads", "ms/project", "divergence left");
+
+	int threadCounts[] = {1, 4};
+	for(int mode = 0; mode < 2; ++mode){
+		for(int numThreads : threadCounts){
+			Fluid3D<float> fluid(N, N, N);
+			fluid.threads(numThreads);
+			if(mode) fluid.projection(Fluid3D<float>::MULTIGRID);
+			rnd::Random<> rng(1);
+			double left = 0;
+			Timer timer;
+			al_nsec elapsed = 0;
+			for(int k=0; k<numSteps; ++k){
+				fluid.velocities.front().zero();
+				fluid.velocities.adduniformS(rng);
+				double before = benchRMSDivergence(fluid.velocities);
+				timer.start();
+				fluid.project();
+				timer.stop();
+				elapsed += timer.elapsed();
+				left += benchRMSDivergence(fluid.velocities) / before / numSteps;
+			}
+			printf("%12s %8d %12.3f %15.2g%%\n", mode ? "multigrid" : "relaxation",
+				numThreads, al_time_ns2s * elapsed / numSteps * 1000, 100 * left);
+		}
+	}
+}
+
+static int benchMsgCount = 0;
+static void benchMsgFunc(al_sec t, int v){ benchMsgCount += v; }
+struct BenchMsgBig { char bytes[512]; };
+static void benchMsgFuncBig(al_sec t, BenchMsgBig b){ benchMsgCount += b.bytes[0]; }
+
+static void benchMsgQueue(){
+	const int numEvents = 100000;
+	const al_sec duration = 10;
+	const al_sec block = 256./44100;
+	printf("MsgQueue, %d events at random times over %g s, updated every %.2f ms\n",
+		numEvents, duration, block*1000);
+	printf("%12s %12s %12s\n", "", "send ms", "update ms");
+
+	rnd::Random<> rng;
+	std::vector<al_sec> times(numEvents);
+	for(int i=0; i<numEvents; ++i) times[i] = rng.uniform(duration);
+	BenchMsgBig big;
+	memset(big.bytes, 1, sizeof(big.bytes));
+
+	for(int useBig=0; useBig<2; ++useBig){
+		MsgQueue q;
+		benchMsgCount = 0;
+		Timer timer;
+		timer.start();
+		for(int i=0; i<numEvents; ++i){
+			if(useBig)	q.send(times[i], benchMsgFuncBig, big);
+			else		q.send(times[i], benchMsgFunc, 1);
+		}
+		timer.stop();
+		al_nsec send = timer.elapsed();
+		timer.start();
+		while(q.len()) q.advance(block);
+		timer.stop();
+		printf("%12s %12.3f %12.3f\n", useBig ? "512 B args" : "int arg",
+			al_time_ns2s * send * 1000, timer.elapsedSec()*1000);
+		assert(benchMsgCount == numEvents);
+	}
+
+	// As a sequencer would: each block, schedule events up to 1 s ahead,
+	// then dispatch the block. Sorting cost moves between send and update,
+	// so only the total is comparable.
+	{
+		MsgQueue q;
+		benchMsgCount = 0;
+		const int perBlock = numEvents * block / duration;
+		Timer timer;
+		timer.start();
+		for(int sent=0; sent < numEvents || q.len(); ){
+			for(int i=0; i<perBlock && sent < numEvents; ++i, ++sent){
+				q.send(q.now() + times[sent]/duration, benchMsgFunc, 1);
+			}
+			q.advance(block);
+		}
+		timer.stop();
+		printf("%12s %25.3f (send + update, ~%d pending)\n", "interleaved",
+			timer.elapsedSec()*1000, int(perBlock * 0.5 / block));
+		assert(benchMsgCount == numEvents);
+	}
+}
+
+// 4 writers sending to one reader, through MsgTubeMPSC or a locked MsgTube
+static const int benchTubeMsgs = 250000;
+
+struct BenchTubeWriter{
+	MsgTubeMPSC * mpsc;
+	MsgTube * tube;
+	std::mutex * lock;
+};
+
+static void * benchTubeWriter(void * user){
+	BenchTubeWriter& w = *(BenchTubeWriter *)user;
+	for(int n=0; n<benchTubeMsgs; ){
+		if(w.mpsc){
+			if(w.mpsc->send(benchMsgFunc, 1)) ++n;
+			else al_sleep(1e-5);
+		}
+		else{
+			// back off rather than spill into the overflow cache,
+			// which is only flushed by later sends
+			std::unique_lock<std::mutex> guard(*w.lock);
+			if(w.tube->rb.writeSpace() > 256){
+				w.tube->send(benchMsgFunc, 1);
+				++n;
+			}
+			else{
+				guard.unlock();
+				al_sleep(1e-5);
+			}
+		}
+	}
+	return NULL;
+}
+
+static void benchMsgTubeMPSC(){
+	const int numWriters = 4;
+	printf("MsgTube, %d writers sending %d messages each to one reader\n",
+		numWriters, benchTubeMsgs);
+
+	for(int locked=0; locked<2; ++locked){
+		MsgTubeMPSC mpsc(12);
+		MsgTube tube;
+		std::mutex lock;
+		BenchTubeWriter w = { locked ? NULL : &mpsc, &tube, &lock };
+		benchMsgCount = 0;
+
+		Timer timer;
+		timer.start();
+		Thread threads[numWriters];
+		for(int i=0; i<numWriters; ++i) threads[i].start(benchTubeWriter, &w);
+		while(benchMsgCount < numWriters*benchTubeMsgs){
+			int prev = benchMsgCount;
+			if(locked){
+				std::lock_guard<std::mutex> guard(lock);
+				tube.executeUntil(0);
+			}
+			else{
+				mpsc.executeUntil(0);
+			}
+			if(benchMsgCount == prev) al_sleep(1e-5);
+		}
+		for(int i=0; i<numWriters; ++i) threads[i].join();
+		timer.stop();
+
+		double sec = timer.elapsedSec();
+		printf("%24s %10.3f ms %10.2f Mmsg/s\n", locked ? "MsgTube + mutex" : "MsgTubeMPSC",
+			sec*1000, numWriters*benchTubeMsgs / sec * 1e-6);
+	}
+}
+
+// OSC messages dispatched to 2000 parameters, compared to a linear scan
+static void benchParameterServer(){
+	const int numGroups = 20, perGroup = 100, numMessages = 200000;
+	printf("ParameterServer, %d parameters, %d messages\n", numGroups*perGroup, numMessages);
+
+	std::deque<Parameter> params; // parameters do not move once registered
+	ParameterServer server("127.0.0.1", 9712);
+	char name[64];
+	for(int g=0; g<numGroups; ++g){
+		for(int i=0; i<perGroup; ++i){
+			snprintf(name, sizeof(name), "param%d", i);
+			std::string group = "group" + std::to_string(g);
+			params.emplace_back(name, group, 0);
+			server << params.back();
+		}
+	}
+
+	rnd::Random<> rng;
+	std::vector<osc::Packet *> packets;
+	for(int i=0; i<1000; ++i){
+		osc::Packet * p = new osc::Packet;
+		p->addMessage(params[rng.uniform(params.size())].getFullAddress(), float(i));
+		packets.push_back(p);
+	}
+	osc::Packet pattern;
+	pattern.addMessage("/group1?/param[0-4]", 1.f);
+
+	for(int pass=0; pass<3; ++pass){
+		Timer timer;
+		timer.start();
+		// fewer messages for the slow cases
+		int n = pass == 1 ? numMessages : numMessages/100;
+		for(int i=0; i<n; ++i){
+			const osc::Packet& p = pass == 2 ? pattern : *packets[i % packets.size()];
+			osc::Message m(p.data(), p.size());
+			if(pass == 0){
+				// the dispatch used before the address index
+				float v;
+				m >> v;
+				for(Parameter& param : params){
+					if(m.addressPattern() == param.getFullAddress()) param.set(v);
+				}
+			}
+			else{
+				server.onMessage(m);
+			}
+		}
+		timer.stop();
+		const char * label[] = { "linear scan", "indexed", "indexed pattern" };
+		printf("%24s %10.3f ms %10.3f Mmsg/s\n", label[pass],
+			timer.elapsedSec()*1000, n / timer.elapsedSec() * 1e-6);
+	}
+
+	server.stopServer();
+	for(auto p : packets) delete p;
+}
+
+// Preset interpolation and morph steps across 500 parameters
+static void benchPresetHandler(){
+	const int numParams = 500, numCalls = 1000;
+	printf("PresetHandler, %d parameters\n", numParams);
+
+	std::deque<Parameter> params;
+	char name[64];
+	{
+		PresetHandler presets("utBenchPresets");
+		for(int i=0; i<numParams; ++i){
+			snprintf(name, sizeof(name), "param%d", i);
+			params.emplace_back(name, "", 0);
+			presets << params.back();
+		}
+		for(int i=0; i<numParams; ++i) params[i].set(i);
+		presets.storePreset(0, "a");
+		for(int i=0; i<numParams; ++i) params[i].set(-i);
+		presets.storePreset(1, "b");
+
+		for(int pass=0; pass<2; ++pass){
+			Timer timer;
+			timer.start();
+			int n = pass == 0 ? numCalls/10 : numCalls;
+			for(int i=0; i<n; ++i){
+				// the first pass reads both preset files every call
+				if(pass == 0) presets.clearCache();
+				presets.setInterpolatedPreset(0, 1, double(i)/n);
+			}
+			timer.stop();
+			printf("%24s %10.3f us/call\n", pass == 0 ? "from files" : "cached",
+				timer.elapsedSec() / n * 1e6);
+		}
+
+		// morph steps, compared to the lookup by address used before
+		std::map<std::string, float> targets;
+		for(auto& p : params) targets[p.getFullAddress()] = 1;
+		presets.setExternalMorphClock(true);
+		presets.setMorphTime(1000);
+		presets.recallPreset(0);
+		for(int pass=0; pass<2; ++pass){
+			Timer timer;
+			timer.start();
+			for(int i=0; i<numCalls; ++i){
+				if(pass == 0){
+					for(auto& p : params){
+						if(targets.find(p.getFullAddress()) != targets.end()){
+							float v = p.get();
+							p.set(v + (targets[p.getFullAddress()] - v) * 0.01f);
+						}
+					}
+				}
+				else{
+					presets.stepMorph(0.001);
+				}
+			}
+			timer.stop();
+			printf("%24s %10.3f us/step\n", pass == 0 ? "map lookup step" : "stepMorph",
+				timer.elapsedSec() / numCalls * 1e6);
+		}
+	}
+	remove("utBenchPresets/a.preset");
+	remove("utBenchPresets/b.preset");
+	remove("utBenchPresets/_presetMap.txt");
+	Dir::remove("utBenchPresets");
+}
+
+// One float message per datagram with osc::Send, compared to osc::BundleSend,
+// over loopback
+static void benchOSCSend(){
+	const int numAddresses = 1000, numMessages = 200000;
+	const unsigned port = 4113;
+	printf("OSC send over loopback, %d messages\n", numMessages);
+
+	std::vector<std::string> addresses;
+	for(int i=0; i<numAddresses; ++i){
+		addresses.push_back("/state/value" + std::to_string(i));
+	}
+
+	// bound but not read, so the kernel drops what does not fit
+	osc::Recv r(port, "127.0.0.1");
+
+	for(int pass=0; pass<2; ++pass){
+		unsigned long long packets = 0, bytes = 0;
+		Timer timer;
+		timer.start();
+		if(pass == 0){
+			osc::Send s(port, "127.0.0.1");
+			for(int i=0; i<numMessages; ++i){
+				bytes += s.send(addresses[i % numAddresses], float(i));
+			}
+			packets = numMessages;
+		}
+		else{
+			osc::BundleSend s(port, "127.0.0.1");
+			for(int i=0; i<numMessages; ++i){
+				s.send(addresses[i % numAddresses].c_str(), float(i));
+			}
+			s.flush();
+			packets = s.packetsSent();
+			bytes = s.bytesSent();
+		}
+		timer.stop();
+		double sec = timer.elapsedSec();
+		printf("%24s %10.3f ms %10.3f Mmsg/s %10.0f packets/s %10.1f MB/s\n",
+			pass == 0 ? "Send" : "BundleSend", sec*1000,
+			numMessages / sec * 1e-6, packets / sec, bytes / sec * 1e-6);
+	}
+}
+
+int utBenchmarks(){
+	benchAudioSceneThreads();
+	benchVbapLookup();
+	benchAmbiDecode();
+	benchAmbiEncode();
+	benchDelayPool();
+	benchHashSpaceRebuild();
+	benchHashSpaceNearest();
+	benchField3DStencils();
+	benchFluidProjection();
+	benchMsgQueue();
+	benchMsgTubeMPSC();
+	benchParameterServer();
+	benchPresetHandler();
+	benchOSCSend();
+	return 0;
+}
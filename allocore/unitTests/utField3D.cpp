@@ -0,0 +1,95 @@
+#include "utAllocore.h"
+#include "alloutil/al_Field3D.hpp"
+
+// RMS of the divergence as measured by Field3D::calculateGradientMagnitude
+static double rmsDivergence(Field3D<float>& v){
+	Array div;
+	v.calculateGradientMagnitude(div);
+	const float * d = (const float *)div.data.ptr;
+	const size_t n = v.dimx()*v.dimy()*v.dimz();
+	double sum = 0;
+	for(size_t i=0; i<n; ++i) sum += d[i]*d[i];
+	return sqrt(sum/n);
+}
+
+// Whether fields have equal contents
+static bool equal(const Array& a, const Array& b){
+	return a.size() == b.size() && memcmp(a.data.ptr, b.data.ptr, a.size()) == 0;
+}
+
+int utField3D(){
+
+	// Stencils should give the same result for any number of threads
+	{
+		Field3D<float> field1(3, 32, 16, 8), field4(3, 32, 16, 8);
+		rnd::Random<> rng1(7), rng4(7);
+		field1.adduniformS(rng1);
+		field4.adduniformS(rng4);
+		field4.threads(4);
+
+		field1.diffuse(0.1, 6);
+		field4.diffuse(0.1, 6);
+		assert(equal(field1.front(), field4.front()));
+
+		Field3D<float>::Kernel3 kernel;
+		kernel.blur3();
+		field1.diffuse(kernel, 0.1, 6);
+		field4.diffuse(kernel, 0.1, 6);
+		assert(equal(field1.front(), field4.front()));
+
+		field1.relax(0.1, 6);
+		field4.relax(0.1, 6);
+		assert(equal(field1.back(), field4.back()));
+	}
+
+	// Multigrid should reach the tolerance within the cycle limit, with
+	// the same result for any number of threads
+	{
+		const int N = 32;
+		Field3D<float> p1(1, N, N, N), p4(1, N, N, N), f(1, N, N, N);
+		rnd::Random<> rng(3);
+		f.adduniformS(rng);
+
+		Multigrid3D<float> mg(N, N, N);
+		mg.tolerance(1e-5).maxCycles(10);
+		mg.solve(p1.front(), f.front());
+		assert(mg.cycles() < mg.maxCycles());
+		assert(mg.residual() <= mg.tolerance());
+
+		mg.threads(4).solve(p4.front(), f.front());
+		assert(equal(p1.front(), p4.front()));
+
+		// interleaved grids of the central difference Laplacian
+		Multigrid3D<float> mg2(N, N, N, 2);
+		mg2.tolerance(1e-5).maxCycles(10);
+		p1.front().zero();
+		mg2.solve(p1.front(), f.front());
+		assert(mg2.cycles() < mg2.maxCycles());
+		assert(mg2.residual() <= mg2.tolerance());
+	}
+
+	// Multigrid projection should remove the divergence, and more of it than
+	// relaxation does
+	{
+		const int N = 32;
+		Fluid3D<float> relax(N, N, N), multi(N, N, N);
+		rnd::Random<> rng(11);
+		relax.velocities.adduniformS(rng);
+		Array& v = multi.velocities.front();
+		memcpy(v.data.ptr, relax.velocities.front().data.ptr, v.size());
+
+		double before = rmsDivergence(relax.velocities);
+		relax.project();
+		multi.projection(Fluid3D<float>::MULTIGRID);
+		multi.poisson.tolerance(1e-5).maxCycles(10);
+		multi.project();
+
+		double afterRelax = rmsDivergence(relax.velocities);
+		double afterMulti = rmsDivergence(multi.velocities);
+		assert(afterRelax < before);
+		assert(afterMulti < 1e-3 * before);
+		assert(afterMulti < afterRelax);
+	}
+
+	return 0;
+}
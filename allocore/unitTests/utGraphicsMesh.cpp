@@ -1,4 +1,5 @@
 #include "utAllocore.h"
+#include "allocore/graphics/al_Isosurface.hpp"
 
 int utGraphicsMesh(){
 
@@ -43,5 +44,94 @@ int utGraphicsMesh(){
 
 	}
 
+	// Isosurface from field should match cell-at-a-time extraction
+	{
+		const int N = 21;
+		std::vector<float> field(N*N*N);
+		for(int z=0; z<N; ++z){
+		for(int y=0; y<N; ++y){
+		for(int x=0; x<N; ++x){
+			float fx = x*0.3f, fy = y*0.25f, fz = z*0.2f;
+			field[(z*N + y)*N + x] = sin(fx)*cos(fy) + sin(fz + fx*0.5f);
+		}}}
+
+		Isosurface ref(0.3);
+		ref.fieldDims(N).inBox(true);
+		ref.begin();
+		for(int z=N-2; z>=0; --z){
+		for(int y=0; y<N-1; ++y){
+		for(int x=0; x<N-1; ++x){
+			#define F(i,j,k) field[((z+k)*N + y+j)*N + x+i]
+			float v8[] = { F(0,0,0),F(1,0,0),F(0,1,0),F(1,1,0),F(0,0,1),F(1,0,1),F(0,1,1),F(1,1,1) };
+			#undef F
+			int i3[] = {x,y,z};
+			ref.addCell(i3, v8);
+		}}}
+		ref.end();
+		assert(ref.vertices().size() > 0);
+
+		for(int t=1; t<=3; ++t){
+			Isosurface iso(0.3);
+			iso.fieldDims(N).threads(t);
+			iso.generate(&field[0]);
+			assert(iso.validSurface());
+			assert(iso.vertices().size() == ref.vertices().size());
+			assert(iso.indices().size() == ref.indices().size());
+			for(int i=0; i<iso.vertices().size(); ++i){
+				assert(iso.vertices()[i] == ref.vertices()[i]);
+			}
+			for(int i=0; i<iso.indices().size(); ++i){
+				assert(iso.indices()[i] == ref.indices()[i]);
+			}
+		}
+	}
+
+	// Bricked isosurface should only update changed bricks
+	{
+		const int N = 33;
+		std::vector<float> field(N*N*N);
+		for(int z=0; z<N; ++z){
+		for(int y=0; y<N; ++y){
+		for(int x=0; x<N; ++x){
+			float fx = x*0.3f, fy = y*0.25f, fz = z*0.2f;
+			field[(z*N + y)*N + x] = sin(fx)*cos(fy) + sin(fz + fx*0.5f);
+		}}}
+
+		BrickedIsosurface bricks(8, 0.3);
+		bricks.fieldDims(N).threads(2);
+		bricks.update(&field[0]);
+		assert(bricks.numBricks() == 64);
+		assert(bricks.numUpdated() == 64);
+
+		// Nothing changed
+		bricks.update(&field[0]);
+		assert(bricks.numUpdated() == 0);
+
+		// Change field points within a single brick
+		for(int z=10; z<14; ++z){
+		for(int y=10; y<14; ++y){
+		for(int x=10; x<14; ++x){
+			field[(z*N + y)*N + x] += 0.5f;
+		}}}
+		bricks.dirty(10,10,10, 13,13,13);
+		bricks.update(&field[0]);
+		assert(bricks.numUpdated() == 1);
+
+		Isosurface iso(0.3);
+		iso.fieldDims(N).generate(&field[0]);
+		assert(bricks.validSurface());
+		assert(bricks.vertices().size() == iso.vertices().size());
+		assert(bricks.indices().size() == iso.indices().size());
+
+		// Surface replaced by a full generate() is merged again from bricks
+		std::vector<float> empty(N*N*N, 0.f);
+		bricks.generate(&empty[0]);
+		assert(bricks.vertices().size() == 0);
+		bricks.update(&field[0]);
+		assert(bricks.numUpdated() == 0);
+		assert(bricks.vertices().size() == iso.vertices().size());
+		assert(bricks.indices().size() == iso.indices().size());
+	}
+
 	return 0;
 }
@@ -60,6 +60,18 @@ int utIOSocket(){
 		assert(0 == strcmp(dataSend, dataRecv));
 	}
 
+	// Several datagrams in one call
+	{
+		const char * buffers[] = { dataSend, dataSend + 10, dataSend + 20 };
+		size_t lengths[] = { 10, 20, 30 };
+		assert(3 == c.sendBatch(buffers, lengths, 3));
+		for(int i=0; i<3; ++i){
+			int nr = s.recv(dataRecv, sizeof dataRecv);
+			assert(nr == int(lengths[i]));
+			assert(0 == memcmp(dataRecv, buffers[i], lengths[i]));
+		}
+	}
+
 	// make sure timeout works:
 	for(int i=0; i<20; ++i){
 		s.recv(dataRecv, sizeof dataRecv);
@@ -1,4 +1,5 @@
 #include "utAllocore.h"
+#include "allocore/ui/al_Parameter.hpp"
 
 struct PacketData{
 	PacketData(): i(0x12345678), f(1), d(1), c(1){}
@@ -130,5 +131,178 @@ int utProtocolOSC(){
 		}
 	}
 
+	// PacketWriter produces the same bytes as Packet
+	{
+		const char * str = "Hello World!";
+		char buf[512];
+		PacketWriter w(buf, sizeof(buf));
+
+		p.clear();
+		p.addMessage("/test", 1, 1.f, 1.0, '1', str, std::string(str), Blob(str, strlen(str)));
+		w.addMessage("/test", 1, 1.f, 1.0, '1', str, std::string(str), Blob(str, strlen(str)));
+			assert(w.ok());
+			assert(w.size() == p.size());
+			assert(0 == memcmp(w.data(), p.data(), p.size()));
+
+		p.clear();
+		p.addMessage("/test");
+		w.clear().addMessage("/test");
+			assert(w.size() == p.size() && 0 == memcmp(w.data(), p.data(), p.size()));
+
+		p.clear();
+		w.clear();
+		p.beginBundle(12345);
+		w.beginBundle(12345);
+			p.addMessage("/message11", (int)0x12345678, 1.f, 1., "hello world!");
+			w.addMessage("/message11", (int)0x12345678, 1.f, 1., "hello world!");
+			p.beginBundle(12346);
+			w.beginBundle(12346);
+				p.addMessage("/message21", (int)0x3456789a);
+				w.addMessage("/message21", (int)0x3456789a);
+			p.endBundle();
+			w.endBundle();
+			p.addMessage("/message13", Blob("abcde", 5));
+			w.addMessage("/message13", Blob("abcde", 5));
+		p.endBundle();
+		w.endBundle();
+			assert(w.ok());
+			assert(w.size() == p.size());
+			assert(0 == memcmp(w.data(), p.data(), p.size()));
+
+		// writes past the end of the buffer are refused
+		char small[24];
+		memset(small, 0x7f, sizeof(small));
+		PacketWriter ws(small, 20);
+		ws.addMessage("/test", 1);
+			assert(ws.ok() && ws.size() == 16);
+		ws.rewind(0).addMessage("/test", 1, 2, 3);
+			assert(!ws.ok() && ws.size() <= 20);
+			assert(0x7f == small[20]);
+		ws.rewind(0).endMessage();
+			assert(!ws.ok());
+	}
+
+	// Bundled sending
+	{
+		struct CountHandler : public osc::PacketHandler{
+			CountHandler(): count(0), sum(0){}
+			void onMessage(osc::Message& m){
+				int i;
+				m >> i;
+				++count;
+				sum += i;
+			}
+			int count, sum;
+		} handler;
+
+		unsigned port = 4112;
+		osc::Recv r(port);
+		r.timeout(0.1);
+		r.handler(handler);
+		r.bufferSize(2048);
+
+		{
+			osc::BundleSend s(port, "127.0.0.1", 0, 256, 4);
+			int sum = 0;
+			for(int i=0; i<100; ++i){
+				assert(s.send("/count", i));
+				sum += i;
+			}
+			s.flush();
+				assert(0 == s.dropped());
+				assert(s.packetsSent() > 1 && s.packetsSent() < 100);
+				assert(s.bytesSent() <= s.packetsSent() * 256);
+
+			// message larger than a bundle
+			char big[300] = {0};
+				assert(!s.send("/big", Blob(big, sizeof(big))));
+				assert(1 == s.dropped());
+
+			for(int i=0; i<100 && handler.count < 100; ++i) r.recv();
+				assert(100 == handler.count);
+				assert(sum == handler.sum);
+
+			// time-based flush
+			s.flushInterval(0.01);
+			s.send("/count", 1);
+			unsigned long long sent = s.packetsSent();
+			al_sleep(0.02);
+			s.update();
+				assert(s.packetsSent() == sent + 1);
+		}
+
+		// partial send, the second datagram is too large for UDP
+		{
+			osc::BundleSend s(port, "127.0.0.1", 0, 70000, 4);
+			std::vector<char> big(69950);
+				assert(s.send("/count", 1));
+				assert(s.send("/count", 2));
+				assert(s.send("/big", Blob(&big[0], big.size())));
+				assert(1 == s.flush());
+				assert(1 == s.packetsSent());
+				assert(1 == s.dropped());
+		}
+	}
+
+	// Address pattern matching
+	{
+		assert( matchPattern("/a/b", "/a/b"));
+		assert(!matchPattern("/a/b", "/a/bc"));
+		assert( matchPattern("/a/?", "/a/b"));
+		assert(!matchPattern("/a?b", "/a/b"));
+		assert( matchPattern("/a/*", "/a/bcd"));
+		assert( matchPattern("/a/*", "/a/"));
+		assert(!matchPattern("/a/*", "/a/b/c"));
+		assert( matchPattern("/*/*/c", "/a/b/c"));
+		assert( matchPattern("/a/b*d*", "/a/bxxdyy"));
+		assert( matchPattern("/a/[bc]", "/a/c"));
+		assert(!matchPattern("/a/[bc]", "/a/d"));
+		assert( matchPattern("/a/[a-c]x", "/a/bx"));
+		assert( matchPattern("/a/[!bc]", "/a/d"));
+		assert(!matchPattern("/a/[!bc]", "/a/b"));
+		assert( matchPattern("/a/{foo,bar}", "/a/bar"));
+		assert(!matchPattern("/a/{foo,bar}", "/a/baz"));
+		assert( matchPattern("/a/{b,bc}d", "/a/bcd"));
+		assert( isPattern("/a/*") && !isPattern("/a/b"));
+	}
+
+	// Parameter server dispatch
+	{
+		Parameter freq("freq", "synth1", 0);
+		Parameter amp("amp", "synth1", 0);
+		Parameter freq2("freq", "synth2", 0);
+		ParameterServer server("127.0.0.1", 4111);
+		server << freq << amp << freq2;
+
+		assert(1 == server.setParameters("/synth1/freq", 1));
+		assert(1 == freq.get() && 0 == freq2.get());
+		assert(0 == server.setParameters("/synth1/phase", 1));
+		assert(2 == server.setParameters("/synth?/freq", 2));
+		assert(2 == freq.get() && 2 == freq2.get());
+		assert(2 == server.setParameters("/synth1/*", 3));
+		assert(3 == amp.get() && 3 == freq.get() && 2 == freq2.get());
+		assert(1 == server.setParameters("/{synth2,synth3}/freq", 4));
+		assert(4 == freq2.get());
+
+		server.unregisterParameter(freq2);
+		assert(1 == server.setParameters("/synth[0-9]/freq", 5));
+		assert(4 == freq2.get());
+
+		// Unregistering while the same thread dispatches must not wait for itself
+		struct Unregister {
+			ParameterServer *server;
+			Parameter *param;
+			static void callback(float, void *, void *userData, void *) {
+				Unregister *u = (Unregister *) userData;
+				u->server->unregisterParameter(*u->param);
+			}
+		} unregister = {&server, &freq};
+		amp.registerChangeCallback(Unregister::callback, &unregister);
+		assert(1 == server.setParameters("/synth1/amp", 6));
+		assert(0 == server.setParameters("/synth1/freq", 7));
+		assert(5 == freq.get());
+		server.stopServer();
+	}
+
 	return 0;
 }
@@ -1,4 +1,148 @@
+#include <algorithm>
 #include "utAllocore.h"
+#include "allocore/spatial/al_HashSpace.hpp"
+
+// Get sorted indices and squared distances of query results
+static void queryResults(
+	std::vector<std::pair<int, double> >& res,
+	HashSpace::Query& q, int n, HashSpace& space
+){
+	res.clear();
+	for(int i=0; i<n; ++i){
+		res.push_back(std::make_pair(int(q[i] - &space.object(0)), q.distanceSquared(i)));
+	}
+	std::sort(res.begin(), res.end());
+}
+
+static void testHashSpacePacked(){
+	const int numObjects = 2000;
+	HashSpace linked(5, numObjects);
+	HashSpace packed(5, numObjects);
+
+	rnd::Random<> rng;
+	std::vector<Vec3d> positions(numObjects);
+	for(int i=0; i<numObjects; ++i){
+		// include positions outside the space, which are wrapped
+		positions[i].set(rng.uniform(-8., 40.), rng.uniform(-8., 40.), rng.uniform(-8., 40.));
+		linked.move(i, positions[i]);
+	}
+
+	for(int numThreads=1; numThreads<=3; ++numThreads){
+		packed.rebuild(&positions[0], numThreads);
+		assert(packed.packed());
+
+		HashSpace::Query q1(numObjects), q2(numObjects);
+		std::vector<std::pair<int, double> > r1, r2;
+		for(int k=0; k<20; ++k){
+			Vec3d center(rng.uniform(32.), rng.uniform(32.), rng.uniform(32.));
+			double radius = rng.uniform(1., 8.);
+			int n1 = q1.clear()(linked, center, radius);
+			int n2 = q2.clear()(packed, center, radius);
+			assert(n1 == n2);
+			queryResults(r1, q1, n1, linked);
+			queryResults(r2, q2, n2, packed);
+			assert(r1 == r2);
+
+			// query around an object, which is excluded
+			n1 = q1.clear()(linked, &linked.object(k), radius);
+			n2 = q2.clear()(packed, &packed.object(k), radius);
+			assert(n1 == n2);
+			queryResults(r1, q1, n1, linked);
+			queryResults(r2, q2, n2, packed);
+			assert(r1 == r2);
+		}
+	}
+
+	// moving an object returns to per voxel lists
+	linked.move(7, Vec3d(1,2,3));
+	packed.move(7, Vec3d(1,2,3));
+	assert(!packed.packed());
+	HashSpace::Query q1(numObjects), q2(numObjects);
+	std::vector<std::pair<int, double> > r1, r2;
+	int n1 = q1(linked, Vec3d(1,2,3), 6);
+	int n2 = q2(packed, Vec3d(1,2,3), 6);
+	assert(n1 == n2);
+	queryResults(r1, q1, n1, linked);
+	queryResults(r2, q2, n2, packed);
+	assert(r1 == r2);
+}
+
+// Check batched k nearest results against a brute force search
+static void testHashSpaceNearest(){
+	const int numObjects = 1500;
+	const unsigned k = 12;
+	HashSpace space(5, numObjects);
+
+	rnd::Random<> rng;
+	std::vector<Vec3d> positions(numObjects);
+	for(int i=0; i<numObjects; ++i){
+		positions[i].set(rng.uniform(32.), rng.uniform(32.), rng.uniform(32.));
+		space.move(i, positions[i]);
+	}
+	// a coincident pair, so that ties are ordered by index
+	space.move(1, positions[0]);
+	positions[1] = positions[0];
+
+	const int numCenters = 100;
+	std::vector<Vec3d> centers(numCenters);
+	for(int i=0; i<numCenters; ++i){
+		centers[i].set(rng.uniform(32.), rng.uniform(32.), rng.uniform(32.));
+	}
+	centers[0] = positions[0];
+
+	std::vector<uint32_t> ids(numObjects*k);
+	std::vector<double> d2s(numObjects*k);
+	std::vector<std::pair<double, uint32_t> > expect;
+
+	for(int pass=0; pass<2; ++pass){
+		if(pass) space.rebuild(&positions[0]);
+
+		for(int numThreads=1; numThreads<=3; numThreads+=2){
+		for(int r=0; r<2; ++r){
+			double radius = r ? 2.5 : space.maxRadius();
+
+			// arbitrary points
+			unsigned found = space.nearest(&centers[0], numCenters, k, radius, &ids[0], &d2s[0], numThreads);
+			unsigned total = 0;
+			for(int i=0; i<numCenters; ++i){
+				expect.clear();
+				for(int j=0; j<numObjects; ++j){
+					double d2 = space.wrapRelative(space.object(j).pos - centers[i]).magSqr();
+					if(d2 <= radius*radius) expect.push_back(std::make_pair(d2, j));
+				}
+				std::sort(expect.begin(), expect.end());
+				for(unsigned j=0; j<k; ++j){
+					if(j < expect.size()){
+						assert(ids[i*k+j] == expect[j].second);
+						assert(d2s[i*k+j] == expect[j].first);
+						++total;
+					}
+					else{
+						assert(ids[i*k+j] == HashSpace::invalidHash());
+					}
+				}
+			}
+			assert(found == total);
+
+			// all objects, excluding themselves
+			space.nearestAll(k, radius, &ids[0], NULL, numThreads);
+			for(int i=0; i<numObjects; i+=7){
+				expect.clear();
+				for(int j=0; j<numObjects; ++j){
+					if(j == i) continue;
+					double d2 = space.wrapRelative(space.object(j).pos - space.object(i).pos).magSqr();
+					if(d2 <= radius*radius) expect.push_back(std::make_pair(d2, j));
+				}
+				std::sort(expect.begin(), expect.end());
+				for(unsigned j=0; j<k; ++j){
+					uint32_t id = j < expect.size() ? expect[j].second : HashSpace::invalidHash();
+					assert(ids[i*k+j] == id);
+				}
+			}
+			assert(ids[0] == 1 && ids[k] == 0);
+		}}
+	}
+}
 
 int utSpatial(){
 
@@ -17,5 +161,8 @@ int utSpatial(){
 		a.step(0.5);	assert(a.vec() == Vec3d(2.5,0,0));
 	}
 
+	testHashSpacePacked();
+	testHashSpaceNearest();
+
 	return 0;
 }
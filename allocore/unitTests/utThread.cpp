@@ -1,9 +1,37 @@
 #include "utAllocore.h"
+#include <thread>
+#include "allocore/system/al_PeriodicThread.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
 
 void * threadFunc(void * user){
 	*(int *)user = 1; return NULL;
 }
 
+// Sums [0, n) by splitting it in half with nested task groups
+static long sumTree(ThreadPool& pool, int b, int e){
+	if(e - b <= 64){
+		long s = 0;
+		for(int i=b; i<e; ++i) s += i;
+		return s;
+	}
+	int m = (b + e)/2;
+	long lo, hi;
+	TaskGroup group(pool);
+	group.run([&](){ lo = sumTree(pool, b, m); });
+	hi = sumTree(pool, m, e);
+	group.wait();
+	return lo + hi;
+}
+
+// Counts calls, overrunning the period on every fifth
+struct Tick : public ThreadFunction{
+	Tick(): n(0){}
+	void operator()(){
+		if(0 == ++n % 5) al_sleep(0.005);
+	}
+	std::atomic<int> n;
+};
+
 struct MyThreadFunc : public ThreadFunction{
 	MyThreadFunc(int& x_): x(x_){}
 	void operator()(){
@@ -54,5 +82,72 @@ int utThread() {
 		assert(1 == x);
 	}
 
+	// Thread pool
+	{
+		ThreadPool pool(3);
+		assert(3 == pool.size());
+
+		// parallel for visits every index once
+		std::vector<std::atomic<int> > visits(1000);
+		for(unsigned i=0; i<visits.size(); ++i) visits[i] = 0;
+		pool.parallelFor(0, visits.size(), [&](int i){ ++visits[i]; });
+		for(unsigned i=0; i<visits.size(); ++i) assert(1 == visits[i]);
+
+		// nested groups
+		assert(sumTree(pool, 0, 100000) == 100000L*99999/2);
+
+		// a throwing task still finishes; with the workers busy, the waiting
+		// thread runs it and gets the exception
+		{
+			std::atomic<int> started(0), release(0);
+			TaskGroup busy(pool);
+			for(int i=0; i<pool.size(); ++i){
+				busy.run([&](){ ++started; while(!release) std::this_thread::yield(); });
+			}
+			while(started < pool.size()) std::this_thread::yield();
+			TaskGroup group(pool);
+			group.run([](){ throw 1; });
+			bool caught = false;
+			try{ group.wait(); } catch(int){ caught = true; }
+			assert(caught);
+			group.wait();
+			release = 1;
+			busy.wait();
+		}
+
+		// futures
+		std::future<int> f = pool.async([](){ return 42; });
+		assert(42 == f.get());
+
+		// real-time lane, falling back to workers without permission
+		pool.realtime(1);
+		std::future<int> g = pool.async([&pool](){
+			std::atomic<int> done(0);
+			pool.submitRealtime([&done](){ done = 1; });
+			while(!done) std::this_thread::yield();
+			return 2;
+		});
+		assert(2 == g.get());
+	}
+
+	// Periodic thread on a grid of deadlines
+	for(int c=0; c<3; ++c){
+		Tick tick;
+		PeriodicThread t(0.002);
+		t.precise(true).catchUp(PeriodicThread::CatchUp(c));
+		t.start(tick);
+		while(tick.n < 20) al_sleep(0.001);
+		t.stop();
+		t.join();
+
+		PeriodicThread::Stats s = t.stats();
+		assert(s.periods >= 20);
+		assert(s.missed >= 4);
+		assert(s.min <= s.mean && s.mean <= s.max);
+		assert(s.p99 <= s.max);
+		t.resetStats();
+		assert(0 == t.stats().periods);
+	}
+
 	return 0;
 }
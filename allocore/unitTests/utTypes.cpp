@@ -1,4 +1,53 @@
 #include "utAllocore.h"
+#include "allocore/types/al_MsgQueue.hpp"
+#include "allocore/types/al_MsgTube.hpp"
+#include "allocore/types/al_SingleRWRingBuffer.hpp"
+
+static std::vector<int> msgOrder;
+static void msgPush(al_sec t, int v){ msgOrder.push_back(v); }
+
+struct MsgBig { char bytes[1000]; int v; };
+static void msgPushBig(al_sec t, MsgBig b){ msgOrder.push_back(b.v + b.bytes[999]); }
+
+// Writes an increasing sequence of bytes in place
+static void * ringWriter(void * user){
+	SingleRWRingBuffer& rb = *(SingleRWRingBuffer *)user;
+	unsigned char v = 0;
+	for(int n=0; n<1000000; ){
+		SingleRWRingBuffer::Span a, b;
+		size_t sz = rb.reserveWrite(1 + n%97, a, b);
+		for(size_t i=0; i<a.size; ++i) a.data[i] = v++;
+		for(size_t i=0; i<b.size; ++i) b.data[i] = v++;
+		rb.commitWrite(sz);
+		n += sz;
+		if(!sz) al_sleep(1e-4);
+	}
+	return NULL;
+}
+
+// Several threads sending numbered messages into one MsgTubeMPSC
+static const int tubeMsgs = 20000;
+static int tubeLast[4];
+static int tubeCount = 0;
+static void tubeRecv(al_sec t, int writer, int n){
+	assert(n == tubeLast[writer] + 1);
+	tubeLast[writer] = n;
+	++tubeCount;
+}
+
+struct TubeWriter{
+	MsgTubeMPSC * tube;
+	int id;
+};
+
+static void * tubeWriter(void * user){
+	TubeWriter& w = *(TubeWriter *)user;
+	for(int n=0; n<tubeMsgs; ){
+		if(w.tube->send(tubeRecv, w.id, n)) ++n;
+		else al_sleep(1e-4);
+	}
+	return NULL;
+}
 
 typedef double data_t;
 
@@ -191,6 +240,44 @@ int utTypes(){
 		}	// end size loop
 	}
 
+	{	// Mapping Array data from file
+		const char * path = "utTypesArrayMap.bin";
+		const int N = 7;
+		const int offset = 5;
+		Array a(1, AlloFloat32Ty, N,N,N);
+		for(int i=0; i<N*N*N; ++i) a.elem<float>(0,i%N,(i/N)%N,i/(N*N)) = i;
+
+		FILE * fp = fopen(path, "wb");
+		assert(fp);
+		char pad[offset] = {0};
+		fwrite(pad, 1, offset, fp);
+		fwrite(a.data.ptr, a.size(), 1, fp);
+		fclose(fp);
+
+		{	Array b;
+			assert(b.dataMap(path, offset, a.header));
+			assert(b.isFormat(a));
+			assert(0 == memcmp(a.data.ptr, b.data.ptr, a.size()));
+
+			// changes are private
+			b.elem<float>(0,1,2,3) = -1;
+			assert(b.elem<float>(0,1,2,3) == -1);
+
+			// formatting to a new size releases mapping
+			b.format(1, AlloFloat32Ty, N+1);
+			assert(!b.mapped());
+		}
+
+		{	Array b;
+			assert(b.dataMap(path, offset, a.header));
+			assert(0 == memcmp(a.data.ptr, b.data.ptr, a.size()));
+			assert(!b.dataMap(path, offset+1, a.header)); // file too small
+			assert(!b.hasData());
+		}
+
+		remove(path);
+	}
+
 
 	{
 		Buffer<int> a(0,2);
@@ -286,6 +373,138 @@ int utTypes(){
 		assert(a.read(3) == 2);
 	}
 
+	{	// SingleRWRingBuffer
+		SingleRWRingBuffer rb(16);
+		assert(rb.writeSpace() == 15);
+		assert(rb.readSpace() == 0);
+
+		char src[16] = "abcdefghijklmno";
+		char dst[16];
+		assert(rb.write(src, 10) == 10);
+		assert(rb.read(dst, 6) == 6);
+		assert(0 == memcmp(dst, "abcdef", 6));
+
+		// reserved space wraps around end
+		SingleRWRingBuffer::Span a, b;
+		assert(rb.reserveWrite(100, a, b) == 11);
+		assert(a.size == 6 && b.size == 5);
+		memcpy(a.data, src, 6);
+		memcpy(b.data, src+6, 5);
+		rb.commitWrite(11);
+		assert(rb.writeSpace() == 0);
+		assert(rb.readSpace() == 15);
+
+		// readable data wraps around end
+		assert(rb.peekRead(100, a, b) == 15);
+		assert(a.size == 10 && b.size == 5);
+		assert(0 == memcmp(a.data, "ghij", 4));
+		assert(0 == memcmp(a.data+4, "abcdef", 6));
+		assert(0 == memcmp(b.data, "ghijk", 5));
+		rb.consume(15);
+		assert(rb.readSpace() == 0);
+		assert(rb.writeSpace() == 15);
+	}
+
+	{	// SingleRWRingBuffer with concurrent reader and writer
+		SingleRWRingBuffer rb(256);
+		Thread writer;
+		writer.start(ringWriter, &rb);
+		unsigned char v = 0;
+		for(int n=0; n<1000000; ){
+			SingleRWRingBuffer::Span a, b;
+			size_t sz = rb.peekRead(1 + n%89, a, b);
+			for(size_t i=0; i<a.size; ++i) assert((unsigned char)a.data[i] == v++);
+			for(size_t i=0; i<b.size; ++i) assert((unsigned char)b.data[i] == v++);
+			rb.consume(sz);
+			n += sz;
+			if(!sz) al_sleep(1e-4);
+		}
+		writer.join();
+	}
+
+	{	// MsgTubeMPSC
+		MsgTubeMPSC tube(3);
+		assert(tube.send(msgPush, 1));
+		tube.now(2);
+		assert(tube.send(msgPush, 2));
+		msgOrder.clear();
+		tube.executeUntil(1);
+		assert(msgOrder.size() == 1 && msgOrder[0] == 1);
+		tube.executeUntil(2);
+		assert(msgOrder.size() == 2 && msgOrder[1] == 2);
+
+		// full tube drops messages
+		for(int i=0; i<8; ++i) assert(tube.send(msgPush, i));
+		assert(!tube.send(msgPush, 8));
+		assert(tube.dropped() == 1);
+		tube.executeUntil(2);
+		assert(msgOrder.size() == 10);
+	}
+
+	{	// MsgTubeMPSC with concurrent writers
+		MsgTubeMPSC tube(6);
+		Thread threads[4];
+		TubeWriter writers[4];
+		for(int i=0; i<4; ++i){
+			tubeLast[i] = -1;
+			writers[i].tube = &tube;
+			writers[i].id = i;
+			threads[i].start(tubeWriter, &writers[i]);
+		}
+		while(tubeCount < 4*tubeMsgs){
+			int prev = tubeCount;
+			tube.executeUntil(0);
+			if(tubeCount == prev) al_sleep(1e-4);
+		}
+		for(int i=0; i<4; ++i){
+			threads[i].join();
+			assert(tubeLast[i] == tubeMsgs-1);
+		}
+	}
+
+	{	// MsgQueue
+		MsgQueue q(4);
+
+		// more messages than initial pool, out of order, with equal times
+		const int N = 20;
+		for(int i=0; i<N; ++i){
+			q.send(al_sec((i*7)%N / 2), msgPush, i);
+		}
+		MsgBig big;
+		memset(big.bytes, 1, sizeof(big.bytes));
+		big.v = 100;
+		q.send(al_sec(3.5), msgPushBig, big);
+		assert(q.len() == N+1);
+
+		msgOrder.clear();
+		q.update(5);
+		assert(q.len() == N+1-13);
+		for(unsigned i=1; i<msgOrder.size(); ++i){
+			int a = msgOrder[i-1], b = msgOrder[i];
+			if(a > 100 || b > 100) continue;
+			int ta = (a*7)%N / 2, tb = (b*7)%N / 2;
+			// time order, then order of sending
+			assert(ta < tb || (ta == tb && a < b));
+		}
+		assert(std::find(msgOrder.begin(), msgOrder.end(), 101) != msgOrder.end());
+
+		// message scheduled in the past is late
+		q.send(al_sec(4), msgPush, -1);
+		q.update(20);
+		assert(q.len() == 0);
+		assert(msgOrder.size() == N+2);
+
+		const MsgQueue::Stats& st = q.stats();
+		assert(st.scheduled == N+2);
+		assert(st.dispatched == N+2);
+		assert(st.late == 1);
+		assert(st.maxLatency == 1);
+		assert(st.maxLen == N+1);
+
+		q.resetStats();
+		assert(q.stats().scheduled == 0);
+	}
+
 	return 0;
 }
 
@@ -0,0 +1,89 @@
+#include "utAllocore.h"
+#include "allocore/ui/al_Parameter.hpp"
+
+static int changeCount = 0;
+static float changeValue = 0;
+static void onChange(float value, void *sender, void *userData, void *blockSender){
+	++changeCount;
+	changeValue = value;
+}
+
+// Writes values whose fields must stay consistent
+struct Pair{
+	double a, b;
+	Pair& operator= (float v){ a = v; b = -v; return *this; }
+};
+static bool operator< (const Pair& x, const Pair& y){ return false; }
+static bool operator> (const Pair& x, const Pair& y){ return false; }
+static void * pairWriter(void * user){
+	ParameterWrapper<Pair>& p = *(ParameterWrapper<Pair> *)user;
+	for(int i=0; i<100000; ++i){
+		Pair v = { double(i), double(-i) };
+		p.setNoCalls(v);
+	}
+	return NULL;
+}
+
+int utUIParameter(){
+
+	// Block smoothing
+	{
+		Parameter p("p", "", 0, "", -10, 10);
+
+		const float * b = p.block(8, 8);
+		for(int i=0; i<8; ++i) assert(0 == b[i]);
+
+		// step
+		p.set(1);
+		b = p.block(8, 8);
+		for(int i=0; i<8; ++i) assert(1 == b[i]);
+
+		// linear ramp over 4 frames
+		p.smoothing(Parameter::RAMP, 0.5);
+		p.set(5);
+		b = p.block(8, 8);
+		assert(2 == b[0] && 3 == b[1] && 4 == b[2]);
+		for(int i=3; i<8; ++i) assert(5 == b[i]);
+
+		// one-pole approaches target without overshoot
+		p.smoothing(Parameter::ONE_POLE, 0.01);
+		p.set(-5);
+		b = p.block(100, 1000);
+		for(int i=1; i<100; ++i) assert(b[i] < b[i-1] && b[i] > -5);
+		assert(fabs(b[99] + 5) < 0.01);
+	}
+
+	// Deferred callbacks
+	{
+		Parameter p("p", "", 0);
+		p.registerChangeCallback(onChange);
+		changeCount = 0;
+
+		p.set(1);
+		assert(1 == changeCount && 1 == changeValue);
+
+		p.deferCallbacks(true);
+		p.set(2);
+		p.set(3);
+		assert(1 == changeCount);
+		assert(p.processCallbacks());
+		assert(2 == changeCount && 3 == changeValue);
+		assert(!p.processCallbacks());
+		assert(2 == changeCount);
+	}
+
+	// Sequence lock never returns a torn value
+	{
+		Pair init = { 0, 0 };
+		ParameterWrapper<Pair> p("pair", "", init);
+		Thread writer(pairWriter, &p);
+		for(int i=0; i<100000; ++i){
+			Pair v = p.get();
+			assert(v.a == -v.b);
+		}
+		writer.join();
+		assert(p.get().a == 99999);
+	}
+
+	return 0;
+}
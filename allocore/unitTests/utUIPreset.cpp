@@ -0,0 +1,115 @@
+#include <cmath>
+#include <cstdio>
+#include "utAllocore.h"
+#include "allocore/ui/al_Preset.hpp"
+
+// Waits for the morphing thread to bring a parameter to a value
+static bool reaches(Parameter& p, float value){
+	for(int i=0; i<200; ++i){
+		if(std::abs(p.get() - value) < 1e-4) return true;
+		al::wait(0.01);
+	}
+	return false;
+}
+
+int utUIPreset(){
+
+	const char * dir = "utPresetDir";
+	const char * files[] = {
+		"utPresetDir/_presetMap.txt", "utPresetDir/_presetBank.bin",
+		"utPresetDir/low.preset", "utPresetDir/high.preset", "utPresetDir/mid.preset"
+	};
+
+	{
+		Parameter a("a", "", 0, "", -10, 10);
+		Parameter b("b", "", 0, "", -10, 10);
+		Parameter c("c", "", 0, "", -10, 10);
+		PresetHandler presets(dir);
+		presets << a << b << c;
+		presets.setPrefetch(1);
+
+		a.set(1); b.set(2); c.set(3);
+		presets.storePreset(0, "low");
+		a.set(5); b.set(6); c.set(7);
+		presets.storePreset(1, "high");
+		a.set(-1); b.set(-1); c.set(-1);
+		presets.storePreset(2, "mid");
+
+		presets.recallPreset(0);
+		assert(reaches(a, 1) && reaches(b, 2) && reaches(c, 3));
+
+		presets.setInterpolatedPreset(0, 1, 0.25);
+		assert(reaches(a, 2) && reaches(b, 3) && reaches(c, 4));
+
+		// reread from files, prefetching presets 0 and 2
+		presets.clearCache();
+		assert(presets.recallPreset(1) == "high");
+		assert(reaches(a, 5) && reaches(b, 6) && reaches(c, 7));
+
+		// morph curves, stepped by the caller
+		presets.setExternalMorphClock(true);
+		presets.setMorphTime(1);
+		presets.recallPreset(0);
+		assert(presets.getMorphProgress() == 0);
+		presets.stepMorph(0.25);
+		assert(presets.getMorphProgress() == 0.25);
+		assert(std::abs(a.get() - 4) < 1e-4);
+		presets.stepMorph(0.75);
+		assert(presets.getMorphProgress() == 1);
+		assert(a.get() == 1 && b.get() == 2 && c.get() == 3);
+
+		presets.setMorphCurve(PresetHandler::S_CURVE);
+		presets.recallPreset(1);
+		presets.stepMorph(0.5);
+		assert(std::abs(a.get() - 3) < 1e-4);
+		presets.stepMorph(0.1);
+		assert(a.get() < 3 + 4*0.6);
+
+		presets.setMorphCurve(PresetHandler::EXPONENTIAL);
+		presets.recallPreset(0);
+		float start = a.get();
+		presets.stepMorph(0.5);
+		assert(a.get() > start - (start - 1)*0.5); // less than half way
+		presets.stopMorph();
+		presets.stepMorph(1);
+		assert(a.get() > 1);
+
+		// morph timed by the morphing thread
+		presets.setMorphTime(0.1);
+		presets.setExternalMorphClock(false);
+		presets.recallPreset(1);
+		assert(reaches(a, 5) && reaches(c, 7));
+		assert(presets.getMorphProgress() == 1);
+		presets.setMorphTime(0);
+
+		assert(presets.storeBank());
+	}
+
+	// Load bank with a different set of parameters
+	{
+		for(int i=2; i<5; ++i) std::remove(files[i]);
+
+		Parameter c("c", "", 0, "", -10, 10);
+		Parameter a("a", "", 0, "", -10, 10);
+		Parameter d("d", "", 9, "", -10, 10);
+		PresetHandler presets(dir);
+		presets << c << a << d;
+		assert(presets.loadBank());
+		assert(presets.getPresetName(2) == "mid");
+
+		presets.recallPreset("mid");
+		assert(reaches(a, -1) && reaches(c, -1));
+		assert(d.get() == 9);
+
+		presets.setInterpolatedPreset(0, 1, 0.5);
+		assert(reaches(a, 3) && reaches(c, 5));
+		assert(d.get() == 9);
+
+		assert(!presets.loadBank("_presetMap.txt"));
+	}
+
+	for(int i=0; i<2; ++i) std::remove(files[i]);
+	assert(Dir::remove(dir));
+
+	return 0;
+}
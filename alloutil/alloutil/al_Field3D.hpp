@@ -38,18 +38,33 @@
 	File description:
 	A collection of utilites for 3D fields (including Jos Stam's fluids)
 
+	The relaxation solvers update cells in parity order (red-black for the
+	6-neighbor stencil, 8 colors for 3x3x3 kernels) so that the cells of one
+	color are independent. The planes are split into threads() slabs of the
+	z dimension, run as tasks on the global ThreadPool. Wrapping in y and z
+	is resolved once per row and only the first and last cells of a row wrap
+	in x.
+
+	Multigrid3D solves the Poisson equation of the pressure projection by
+	V-cycles over a hierarchy of coarser grids, which converges in a number
+	of cycles that does not grow with the grid size.
+
 	File author(s):
 	Graham Wakefield, 2010, grrrwaaa@gmail.com
 
 */
 
 
+#include <vector>
 #include "allocore/types/al_Array.hpp"
 #include "allocore/math/al_Functions.hpp"
 #include "allocore/math/al_Random.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
 
 namespace al {
 
+template<typename T> class Multigrid3D;
+
 /*!
 	Field processing often requires double-buffering
 */
@@ -67,6 +82,7 @@ public:
 		mDimWrapY(mDimY-1),
 		mDimWrapZ(mDimZ-1),
 		mFront(1),
+		mThreads(1),
 		mArray0(components, Array::type<T>(), mDimX, mDimY, mDimZ),
 		mArray1(components, Array::type<T>(), mDimX, mDimY, mDimZ)
 	{}
@@ -105,6 +121,10 @@ public:
 	// swap buffers:
 	void swap() { mFront = !mFront; }
 
+	/// set the number of threads used by diffuse(), advect() and relax()
+	Field3D& threads(int n) { mThreads = n > 1 ? n : 1; return *this; }
+	int threads() const { return mThreads; }
+
 	/// multiply the front array:
 	void scale(T v);
 	/// src must have matching layout
@@ -170,7 +190,7 @@ public:
 	// advect a field.
 	// velocity field should have 3 components
 	void advect(const Array& velocities, T rate = T(1.));
-	static void advect(Array& dst, const Array& src, const Array& velocities, T rate = T(1.));
+	static void advect(Array& dst, const Array& src, const Array& velocities, T rate = T(1.), int numThreads = 1);
 
 	/*
 		Clever part of Jos Stam's work.
@@ -189,7 +209,106 @@ public:
 protected:
 	size_t mDimX, mDimY, mDimZ, mDim3, mDimWrapX, mDimWrapY, mDimWrapZ;
 	volatile int mFront;	// which one is the front buffer?
+	int mThreads;
 	Array mArray0, mArray1; //mArrays[2];	// double-buffering
+
+	// call func(z0, z1) on slabs [z0, z1) of [0, dim) split into tasks
+	// on the global ThreadPool
+	template <class Func>
+	static void slabs(size_t dim, int numThreads, const Func& func);
+
+	// Gauss-Seidel sweeps of
+	//	next = factor * (prev + sum of weights * neighboring next)
+	// weights are in Kernel3 layout; the center weight is ignored
+	void relaxKernel(T * next, const T * prev, const T * weights, T factor, unsigned passes);
+
+	template<typename> friend class Multigrid3D;
+};
+
+/*!
+	Geometric multigrid solver of the periodic Poisson equation
+
+		(6 p(x) - (sum of the 6 neighbors of p(x), s cells away)) / s^2 = f(x)
+
+	on single component fields, where s is the spacing given to the
+	constructor. With a spacing greater than 1 the equation splits into s^3
+	interleaved grids, which are solved one after the other. A spacing of 2
+	matches the central differences of Field3D::calculateGradientMagnitude()
+	and Field3D::subtractGradientMagnitude(). Each V-cycle smooths the solution by
+	red-black Gauss-Seidel sweeps, restricts the residual to a grid of half
+	the resolution (averaging 2x2x2 cells), solves for the correction there
+	recursively and interpolates it back trilinearly. Cycles are run until
+	the RMS of the residual falls below tolerance() times the RMS of f, or
+	maxCycles() is reached. With a tolerance of 0 every solve runs exactly
+	maxCycles() cycles.
+
+	Only the mean-free part of f is solved for, and the solution is kept
+	mean-free, since a constant can be added to any periodic solution.
+*/
+template<typename T=float>
+class Multigrid3D {
+public:
+
+	Multigrid3D(int dimx=32, int dimy=32, int dimz=32, int spacing=1);
+	~Multigrid3D();
+
+	/// Solve for p given f, using the contents of p as initial guess
+
+	/// Both arrays must have the dimensions given to the constructor
+	/// (rounded up to powers of two) and a single component.
+	/// @return the number of V-cycles run
+	int solve(Array& p, const Array& f);
+
+	/// set the relative residual at which to stop
+	Multigrid3D& tolerance(double v) { mTolerance = v; return *this; }
+	double tolerance() const { return mTolerance; }
+
+	/// set the maximum number of V-cycles per solve
+	Multigrid3D& maxCycles(int n) { mMaxCycles = n; return *this; }
+	int maxCycles() const { return mMaxCycles; }
+
+	/// set the number of sweeps before and after each coarse grid correction
+	Multigrid3D& smoothing(int pre, int post) { mPre = pre; mPost = post; return *this; }
+
+	/// set the number of threads to solve with
+	Multigrid3D& threads(int n) { mThreads = n > 1 ? n : 1; return *this; }
+
+	/// number of V-cycles run by the last solve, the most of any interleaved grid
+	int cycles() const { return mCycles; }
+
+	/// relative residual (RMS of residual / RMS of f) after the last solve
+	double residual() const { return mResidual; }
+
+	/// number of grids, including the finest
+	int levels() const { return mCoarse.size() + 1; }
+
+protected:
+	// a grid of solution u and right hand side f, with spacing^2 h2
+	struct Grid {
+		T * u;
+		const T * f;
+		T fmean;		// subtracted from f
+		T h2[3];		// squared spacing per axis
+		size_t dim[3], wrap[3], stride[3];
+	};
+
+	size_t mDim[3];
+	size_t mStep[3];					// spacing of the interleaved grids per axis
+	std::vector<Field3D<T> *> mCoarse;	// u in front, f in back
+	std::vector<double> mSums;
+	double mTolerance, mResidual;
+	int mMaxCycles, mCycles, mPre, mPost, mThreads;
+
+	Grid grid(int level);
+	void weights(const Grid& g, T * w) const;
+	T residual(const Grid& g, const T * w, size_t x, size_t y, size_t z) const;
+	template<class Func> double reduce(const Grid& g, const Func& func);
+	void vcycle(int level, Grid& g);
+	int solve(Grid& g, double& f2, double& r2);
+	void smooth(Grid& g, int sweeps);
+	void removeMean(Grid& g);
+	void restrictResidual(Grid& fine, Grid& coarse);
+	void prolongate(Grid& coarse, Grid& fine);
 };
 
 template<typename T=float>
@@ -201,16 +320,23 @@ public:
 		FIELD = 2
 	};
 
+	enum ProjectionMode {
+		RELAXATION = 0,	///< a fixed number of relaxation passes
+		MULTIGRID = 1	///< solve to poisson.tolerance() by multigrid
+	};
+
 	Fluid3D(int dimx=32, int dimy=32, int dimz=32)
 	:	velocities(3, dimx, dimy, dimz),
 		gradient(1, dimx, dimy, dimz),
+		poisson(dimx, dimy, dimz, 2),
 		boundaries(1, Array::type<T>(), dimx, dimy, dimz),
 		passes(14),
 		viscocity(0.00001),
 		selfadvection(0.9),
 		selfdecay(0.99),
 		selfbackgroundnoise(0.001),
-		mBoundaryMode(CLAMP)
+		mBoundaryMode(CLAMP),
+		mProjectionMode(RELAXATION)
 	{
 		// set all values to T(1):
 		T one = 1;
@@ -286,6 +412,17 @@ public:
 	}
 
 	void project() {
+		if (mProjectionMode == MULTIGRID) {
+			// divergence into back, solve for pressure in front,
+			// starting from the previous pressure. The central differences
+			// of the divergence and gradient combine to a Laplacian over
+			// neighbors 2 cells away, which the solver is set up for.
+			gradient.back().zero();
+			velocities.calculateGradientMagnitude(gradient.back());
+			poisson.solve(gradient.front(), gradient.back());
+			velocities.subtractGradientMagnitude(gradient.front());
+			return;
+		}
 		gradient.back().zero();
 		// prepare new gradient data:
 		velocities.calculateGradientMagnitude(gradient.front());
@@ -297,12 +434,24 @@ public:
 
 	void boundary(BoundaryMode b) { mBoundaryMode = b; }
 
+	/// set how project() solves for the pressure
+	void projection(ProjectionMode m) { mProjectionMode = m; }
+
+	/// set the number of threads used to process the fields
+	void threads(int n) {
+		velocities.threads(n);
+		gradient.threads(n);
+		poisson.threads(n);
+	}
+
 	Field3D<T> velocities, gradient;
+	Multigrid3D<T> poisson;
 	Array boundaries;
 	unsigned passes;
 	T viscocity, selfadvection, selfdecay, selfbackgroundnoise;
 	rnd::Random<> rng;
 	BoundaryMode mBoundaryMode;
+	ProjectionMode mProjectionMode;
 };
 
 
@@ -348,6 +497,12 @@ public:
 		densities.scale(decay);
 	}
 
+	/// set the number of threads used to process the fields
+	void threads(int n) {
+		Super::threads(n);
+		densities.threads(n);
+	}
+
 	Field3D<T> densities;
 	T diffusion, decay;
 };
@@ -624,144 +779,184 @@ inline void Field3D<T>::add(Array& src) {
 	}
 }
 
-// Gauss-Seidel relaxation scheme:
+template<typename T>
+template<class Func>
+inline void Field3D<T> :: slabs(size_t dim, int numThreads, const Func& func) {
+	const size_t n = al::min(size_t(numThreads), dim);
+	if (n <= 1) {
+		func(size_t(0), dim);
+		return;
+	}
+	ThreadPool::global().parallelFor(0, n, [&func, dim, n](int t) {
+		func(dim*t/n, dim*(t+1)/n);
+	}, 1);
+}
+
+// Red-black Gauss-Seidel relaxation scheme:
 template<typename T>
 inline void Field3D<T> :: diffuse(T diffusion, unsigned passes) {
 	swap();
-	Array& out = front();
-	const Array& in = back();
-	const size_t stride0 = out.header.stride[0];
-	const size_t stride1 = out.header.stride[1];
-	const size_t stride2 = out.header.stride[2];
-	const size_t components = out.header.components;
-	const char * iptr = in.data.ptr;
-	const char * optr = out.data.ptr;
-	double div = 1.0/((1.+6.*diffusion));
-	#define INDEX(p, x, y, z) ((T *)(p + ((((x)&mDimWrapX)*stride0) + (((y)&mDimWrapY)*stride1) + (((z)&mDimWrapZ)*stride2))))
+	T * optr = (T *)front().data.ptr;
+	const T * iptr = (const T *)back().data.ptr;
+	const size_t comps = components();
+	const size_t sx = stride(0)/sizeof(T);
+	const size_t sy = stride(1)/sizeof(T);
+	const size_t sz = stride(2)/sizeof(T);
+	const T div = 1.0/((1.+6.*diffusion));
+
+	// update the cells of one color in plane z:
+	auto plane = [=](size_t z, size_t color) {
+		for (size_t y=0; y<mDimY; y++) {
+			T * next = optr + y*sy + z*sz;
+			const T * prev = iptr + y*sy + z*sz;
+			const T * v0a0 = optr + ((y-1)&mDimWrapY)*sy + z*sz;
+			const T * v0b0 = optr + ((y+1)&mDimWrapY)*sy + z*sz;
+			const T * v00a = optr + y*sy + ((z-1)&mDimWrapZ)*sz;
+			const T * v00b = optr + y*sy + ((z+1)&mDimWrapZ)*sz;
+
+			// update the cell at i, with x neighbors at ia and ib:
+			auto cell = [=](size_t i, size_t ia, size_t ib) {
+				for (size_t k=0;k<comps;k++) {
+					next[i+k] = div*(
+						prev[i+k] +
+						diffusion * (
+							next[ia+k] + next[ib+k] +
+							v0a0[i+k] + v0b0[i+k] +
+							v00a[i+k] + v00b[i+k]
+						)
+					);
+				}
+			};
+
+			size_t x = (y+z+color)&1;
+			if (x == 0) {
+				cell(0, mDimWrapX*sx, (1&mDimWrapX)*sx);
+				x = 2;
+			}
+			for (; x<mDimWrapX; x+=2) {
+				cell(x*sx, (x-1)*sx, (x+1)*sx);
+			}
+			if (x == mDimWrapX) {
+				cell(x*sx, (x-1)*sx, 0);
+			}
+		}
+	};
 
 	for (unsigned n=0 ; n<passes ; n++) {
-		for (size_t z=0;z<mDimZ;z++) {
-			for (size_t y=0;y<mDimY;y++) {
-				for (size_t x=0;x<mDimX;x++) {
-					const T * prev =	INDEX(iptr, x,	y,	z);
-					T *		  next =	INDEX(optr, x,	y,	z);
-					const T * va00 =	INDEX(optr, x-1,y,	z);
-					const T * vb00 =	INDEX(optr, x+1,y,	z);
-					const T * v0a0 =	INDEX(optr, x,	y-1,z);
-					const T * v0b0 =	INDEX(optr, x,	y+1,z);
-					const T * v00a =	INDEX(optr, x,	y,	z-1);
-					const T * v00b =	INDEX(optr, x,	y,	z+1);
-					for (size_t k=0;k<components;k++) {
-						next[k] = div*(
-							prev[k] +
-							diffusion * (
-								va00[k] + vb00[k] +
-								v0a0[k] + v0b0[k] +
-								v00a[k] + v00b[k]
-							)
-						);
+		// The black cells of a plane are updated right after the red cells
+		// of the next plane, while the planes are still in the cache. The
+		// black cells of the first and last planes of a slab depend on red
+		// cells of the neighboring slabs, so they are updated afterwards.
+		slabs(mDimZ, mThreads, [&](size_t z0, size_t z1) {
+			for (size_t z=z0; z<z1; z++) {
+				plane(z, 0);
+				if (z > z0+1) plane(z-1, 1);
+			}
+		});
+		slabs(mDimZ, mThreads, [&](size_t z0, size_t z1) {
+			plane(z0, 1);
+			if (z1-1 > z0) plane(z1-1, 1);
+		});
+	}
+}
+
+template<typename T>
+inline void Field3D<T> :: relaxKernel(T * optr, const T * iptr, const T * weights, T factor, unsigned passes) {
+	const size_t comps = components();
+	const size_t sx = stride(0)/sizeof(T);
+	const size_t sy = stride(1)/sizeof(T);
+	const size_t sz = stride(2)/sizeof(T);
+
+	// gather the neighbors with non-zero weights;
+	// row is the index of the (y, z) row and dx the x offset plus one
+	T weight[26];
+	int row[26], dx[26];
+	int numNeighbors = 0;
+	for (int k=-1; k<=1; k++) {
+		for (int j=-1; j<=1; j++) {
+			for (int i=-1; i<=1; i++) {
+				T w = weights[(i+1) + 3*(1-j) + 9*(1-k)];
+				if ((i || j || k) && w != T(0)) {
+					weight[numNeighbors] = w;
+					row[numNeighbors] = (j+1) + 3*(k+1);
+					dx[numNeighbors] = i+1;
+					numNeighbors++;
+				}
+			}
+		}
+	}
+
+	// update the cells of one color (parity of x and y) in plane z:
+	auto plane = [=](size_t z, size_t color) {
+		const T * rows[9];
+		const T * taps[26];
+		for (size_t y=(color>>1)&1; y<mDimY; y+=2) {
+			T * next = optr + y*sy + z*sz;
+			const T * prev = iptr + y*sy + z*sz;
+			for (int j=0; j<9; j++) {
+				rows[j] = optr
+					+ ((y + (j%3) - 1)&mDimWrapY)*sy
+					+ ((z + (j/3) - 1)&mDimWrapZ)*sz;
+			}
+			// neighbors of cell x are at taps[j][(x-1)*sx]:
+			for (int j=0; j<numNeighbors; j++) {
+				taps[j] = rows[row[j]] + dx[j]*sx;
+			}
+
+			// the first and last cells wrap in x:
+			auto edge = [&](size_t x) {
+				const size_t xo[3] = { ((x-1)&mDimWrapX)*sx, x*sx, ((x+1)&mDimWrapX)*sx };
+				for (size_t k=0; k<comps; k++) {
+					T sum = T(0);
+					for (int j=0; j<numNeighbors; j++) {
+						sum += weight[j] * rows[row[j]][xo[dx[j]]+k];
 					}
+					next[xo[1]+k] = factor * (prev[xo[1]+k] + sum);
 				}
+			};
+
+			size_t x = color&1;
+			if (x == 0) {
+				edge(0);
+				x = 2;
 			}
+			for (; x<mDimWrapX; x+=2) {
+				const size_t i = x*sx, ia = i-sx;
+				for (size_t k=0; k<comps; k++) {
+					T sum = T(0);
+					for (int j=0; j<numNeighbors; j++) {
+						sum += weight[j] * taps[j][ia+k];
+					}
+					next[i+k] = factor * (prev[i+k] + sum);
+				}
+			}
+			if (x == mDimWrapX) edge(x);
+		}
+	};
+
+	for (unsigned n=0 ; n<passes ; n++) {
+		// Cells of equal x, y and z parity share no neighbors. Planes of
+		// equal z parity do not depend on each other, so each can go
+		// through its four colors while it is in the cache.
+		for (size_t cz=0; cz<2; cz++) {
+			slabs(mDimZ, mThreads, [&](size_t z0, size_t z1) {
+				for (size_t z=z0+((z0^cz)&1); z<z1; z+=2) {
+					for (size_t color=0; color<4; color++) plane(z, color);
+				}
+			});
 		}
 	}
-	#undef INDEX
 }
 
 // Gauss-Seidel relaxation scheme:
 template<typename T>
 inline void Field3D<T> :: diffuse(const Kernel3& kernel, T diffusion, unsigned passes) {
 	swap();
-	Array& out = front();
-	const Array& in = back();
 	const T a = -kernel.coeffs[C111]; // kernel center value
 	const T afactor = 1./(1. + a*diffusion);	// balancing factor for relaxation scheme
-	const size_t stride0 = out.header.stride[0];
-	const size_t stride1 = out.header.stride[1];
-	const size_t stride2 = out.header.stride[2];
-	const size_t components = out.header.components;
-	const char * iptr = in.data.ptr;
-	const char * optr = out.data.ptr;
-	#define INDEX(p, x, y, z) ((T *)(p + ((((x)&mDimWrapX)*stride0) + (((y)&mDimWrapY)*stride1) + (((z)&mDimWrapZ)*stride2))))
-
-	for (unsigned n=0 ; n<passes ; n++) {
-		for (size_t z=0;z<mDimZ;z++) {
-			for (size_t y=0;y<mDimY;y++) {
-				for (size_t x=0;x<mDimX;x++) {
-					const T * prev =	INDEX(iptr, x,	y,	z);
-					T *		  next =	INDEX(optr, x,	y,	z);
-					// immediate neighbors
-					const T * v011 = INDEX(optr, x-1, y, z);
-					const T * v211 = INDEX(optr, x+1, y, z);
-					const T * v101 = INDEX(optr, x, y-1, z);
-					const T * v121 = INDEX(optr, x, y+1, z);
-					const T * v110 = INDEX(optr, x, y, z-1);
-					const T * v112 = INDEX(optr, x, y, z+1);
-					// mid corner neighbors
-					const T * v010 = INDEX(optr, x-1, y, z-1);
-					const T * v100 = INDEX(optr, x, y-1, z-1);
-					const T * v120 = INDEX(optr, x, y+1, z-1);
-					const T * v210 = INDEX(optr, x+1, y, z-1);
-					const T * v001 = INDEX(optr, x-1, y-1, z);
-					const T * v201 = INDEX(optr, x+1, y-1, z);
-					const T * v021 = INDEX(optr, x-1, y+1, z);
-					const T * v221 = INDEX(optr, x+1, y+1, z);
-					const T * v012 = INDEX(optr, x-1, y, z+1);
-					const T * v102 = INDEX(optr, x, y-1, z+1);
-					const T * v122 = INDEX(optr, x, y+1, z+1);
-					const T * v212 = INDEX(optr, x+1, y, z+1);
-					// far corner neighbors
-					const T * v000 = INDEX(optr, x-1, y-1, z-1);
-					const T * v200 = INDEX(optr, x+1, y-1, z-1);
-					const T * v020 = INDEX(optr, x-1, y+1, z-1);
-					const T * v220 = INDEX(optr, x+1, y+1, z-1);
-					const T * v002 = INDEX(optr, x-1, y-1, z+1);
-					const T * v202 = INDEX(optr, x+1, y-1, z+1);
-					const T * v022 = INDEX(optr, x-1, y+1, z+1);
-					const T * v222 = INDEX(optr, x+1, y+1, z+1);
-
-					for (size_t k=0;k<components;k++) {
-						next[k] = afactor * (
-										prev[k] +
-										diffusion * (
-											kernel.coeffs[C022] * v022[k] +
-											kernel.coeffs[C122] * v122[k] +
-											kernel.coeffs[C222] * v222[k] +
-											kernel.coeffs[C012] * v012[k] +
-											kernel.coeffs[C112] * v112[k] +
-											kernel.coeffs[C212] * v212[k] +
-											kernel.coeffs[C002] * v002[k] +
-											kernel.coeffs[C102] * v102[k] +
-											kernel.coeffs[C202] * v202[k] +
-
-											kernel.coeffs[C021] * v021[k] +
-											kernel.coeffs[C121] * v121[k] +
-											kernel.coeffs[C221] * v221[k] +
-											kernel.coeffs[C011] * v011[k] +
-											// no C111 term!
-											kernel.coeffs[C211] * v211[k] +
-											kernel.coeffs[C001] * v001[k] +
-											kernel.coeffs[C101] * v101[k] +
-											kernel.coeffs[C201] * v201[k] +
-
-											kernel.coeffs[C020] * v020[k] +
-											kernel.coeffs[C120] * v120[k] +
-											kernel.coeffs[C220] * v220[k] +
-											kernel.coeffs[C010] * v010[k] +
-											kernel.coeffs[C110] * v110[k] +
-											kernel.coeffs[C210] * v210[k] +
-											kernel.coeffs[C000] * v000[k] +
-											kernel.coeffs[C100] * v100[k] +
-											kernel.coeffs[C200] * v200[k]
-										)
-									);
-					}
-
-				}
-			}
-		}
-	}
-	#undef INDEX
+	T weights[27];
+	for (int i=0; i<27; i++) weights[i] = diffusion * kernel.coeffs[i];
+	relaxKernel((T *)front().data.ptr, (const T *)back().data.ptr, weights, afactor, passes);
 }
 
 /*
@@ -775,84 +970,28 @@ inline void Field3D<T> :: diffuse(const Kernel3& kernel, T diffusion, unsigned p
 */
 template<typename T>
 inline void Field3D<T> :: relax( double diffusion, int iterations) {
-	char * old = front().data.ptr;
-	char * out = back().data.ptr;
-	const uint32_t comps = components();
+	T weights[27];
+	for (int i=0; i<27; i++) weights[i] = T(0);
 #ifdef NoMerhstellen
 	const double c = 1./(1. + 6.*diffusion);
+	const T b = diffusion;
 #else
 	const double c = 1./(1. + 24.*diffusion);
+	const T b = 2.*diffusion;
+	// edges
+	weights[C010] = weights[C100] = weights[C120] = weights[C210] =
+	weights[C001] = weights[C201] = weights[C021] = weights[C221] =
+	weights[C012] = weights[C102] = weights[C122] = weights[C212] = diffusion;
 #endif
-	for (int iter=0; iter<iterations; iter++) {
-		for (size_t z=0;z<mDimZ;z++) {
-			for (size_t y=0;y<mDimY;y++) {
-				for (size_t x=0;x<mDimX;x++) {
-					const size_t idx = index(x, y, z);
-#ifdef NoMerhstellen
-					const size_t x0 = index(x-1, y, z);
-					const size_t x1 = index(x+1, y, z);
-					const size_t y0 = index(x, y-1, z);
-					const size_t y1 = index(x, y+1, z);
-					const size_t z0 = index(x, y, z-1);
-					const size_t z1 = index(x, y, z+1);
-					for (unsigned k=0; k<comps; k++) {
-						out[idx+k] = c * (
-										old[idx+k] +
-										diffusion * (
-											out[x0+k] + out[x1+k] +
-											out[y0+k] + out[y1+k] +
-											out[z0+k] + out[z1+k]
-										)
-									);
-					}
-#else
-					// immediate neighbors
-					const size_t idx011 = index(x-1, y, z);
-					const size_t idx211 = index(x+1, y, z);
-					const size_t idx101 = index(x, y-1, z);
-					const size_t idx121 = index(x, y+1, z);
-					const size_t idx110 = index(x, y, z-1);
-					const size_t idx112 = index(x, y, z+1);
-					// corner neighbors
-					const size_t idx010 = index(x-1, y, z-1);
-					const size_t idx100 = index(x, y-1, z-1);
-					const size_t idx120 = index(x, y+1, z-1);
-					const size_t idx210 = index(x+1, y, z-1);
-					const size_t idx001 = index(x-1, y-1, z);
-					const size_t idx201 = index(x+1, y-1, z);
-					const size_t idx021 = index(x-1, y+1, z);
-					const size_t idx221 = index(x+1, y+1, z);
-					const size_t idx012 = index(x-1, y, z+1);
-					const size_t idx102 = index(x, y-1, z+1);
-					const size_t idx122 = index(x, y+1, z+1);
-					const size_t idx212 = index(x+1, y, z+1);
-					for (unsigned k=0; k<comps; k++) {
-						out[idx+k] = c * (
-										old[idx+k] +
-										diffusion * (2.*(
-											out[idx011+k] + out[idx211+k] +
-											out[idx101+k] + out[idx121+k] +
-											out[idx110+k] + out[idx112+k]
-										) + out[idx010+k] + out[idx100+k] +
-											out[idx120+k] + out[idx210+k] +
-											out[idx001+k] + out[idx201+k] +
-											out[idx021+k] + out[idx221+k] +
-											out[idx012+k] + out[idx102+k] +
-											out[idx122+k] + out[idx212+k]
-										)
-									);
-					}
-#endif
-				}
-			}
-		}
-		// todo: apply boundary here?
-	}
-	#undef CELL
+	// faces
+	weights[C011] = weights[C211] = weights[C101] =
+	weights[C121] = weights[C110] = weights[C112] = b;
+	// todo: apply boundary here?
+	relaxKernel((T *)back().data.ptr, (const T *)front().data.ptr, weights, c, iterations);
 }
 
 template<typename T>
-inline void Field3D<T> :: advect(Array& dst, const Array& src, const Array& velocities, T rate) {
+inline void Field3D<T> :: advect(Array& dst, const Array& src, const Array& velocities, T rate, int numThreads) {
 	const size_t stride0 = src.stride(0);
 	const size_t stride1 = src.stride(1);
 	const size_t stride2 = src.stride(2);
@@ -882,21 +1021,24 @@ inline void Field3D<T> :: advect(Array& dst, const Array& src, const Array& velo
 	#define CELL(p, x, y, z, k) (((T *)((p) + (((x)&dimwrap0)*stride0) +  (((y)&dimwrap1)*stride1) +  (((z)&dimwrap2)*stride2)))[(k)])
 	#define VCELL(p, x, y, z, k) (((T *)((p) + (((x)&dimwrap0)*vstride0) +  (((y)&dimwrap1)*vstride1) +  (((z)&dimwrap2)*vstride2)))[(k)])
 
-	for (size_t z=0;z<dim2;z++) {
-		for (size_t y=0;y<dim1;y++) {
-			for (size_t x=0;x<dim0;x++) {
-				// back trace: (current cell offset by vector at cell)
-				T * bp  = &(CELL(outptr, x, y, z, 0));
-				T * vp	= &(VCELL(velptr, x, y, z, 0));
-				T vx = x - rate * vp[0];
-				T vy = y - rate * vp[1];
-				T vz = z - rate * vp[2];
-
-				// read interpolated input field value into back-traced location:
-				src.read_interp(bp, vx, vy, vz);
+	// each cell only reads src, so slabs are independent
+	slabs(dim2, numThreads, [&](size_t z0, size_t z1) {
+		for (size_t z=z0;z<z1;z++) {
+			for (size_t y=0;y<dim1;y++) {
+				for (size_t x=0;x<dim0;x++) {
+					// back trace: (current cell offset by vector at cell)
+					T * bp  = &(CELL(outptr, x, y, z, 0));
+					T * vp	= &(VCELL(velptr, x, y, z, 0));
+					T vx = x - rate * vp[0];
+					T vy = y - rate * vp[1];
+					T vz = z - rate * vp[2];
+
+					// read interpolated input field value into back-traced location:
+					src.read_interp(bp, vx, vy, vz);
+				}
 			}
 		}
-	}
+	});
 	#undef CELL
 	#undef VCELL
 }
@@ -904,7 +1046,7 @@ inline void Field3D<T> :: advect(Array& dst, const Array& src, const Array& velo
 template<typename T>
 inline void Field3D<T> :: advect(const Array& velocities, T rate) {
 	swap();
-	advect(front(), back(), velocities, rate);
+	advect(front(), back(), velocities, rate, mThreads);
 }
 
 template<typename T>
@@ -1065,5 +1207,295 @@ inline void Field3D<T> :: add(T * force) {
 }
 
 
+
+template<typename T>
+inline Multigrid3D<T> :: Multigrid3D(int dimx, int dimy, int dimz, int spacing)
+:	mTolerance(1e-4), mResidual(0),
+	mMaxCycles(10), mCycles(0), mPre(2), mPost(2), mThreads(1)
+{
+	mDim[0] = ceilPow2(dimx);
+	mDim[1] = ceilPow2(dimy);
+	mDim[2] = ceilPow2(dimz);
+	mSums.resize(mDim[2]);
+	for (int i=0; i<3; i++) {
+		mStep[i] = al::min(size_t(ceilPow2(spacing > 1 ? spacing : 1)), mDim[i]);
+	}
+	// halve each axis of the interleaved grids until it has 2 cells:
+	size_t d[3] = { mDim[0]/mStep[0], mDim[1]/mStep[1], mDim[2]/mStep[2] };
+	while (d[0] > 2 || d[1] > 2 || d[2] > 2) {
+		for (int i=0; i<3; i++) if (d[i] > 2) d[i] /= 2;
+		mCoarse.push_back(new Field3D<T>(1, d[0], d[1], d[2]));
+	}
+}
+
+template<typename T>
+inline Multigrid3D<T> :: ~Multigrid3D() {
+	for (unsigned i=0; i<mCoarse.size(); i++) delete mCoarse[i];
+}
+
+template<typename T>
+inline typename Multigrid3D<T>::Grid Multigrid3D<T> :: grid(int level) {
+	Field3D<T>& field = *mCoarse[level-1];
+	Grid g;
+	g.u = (T *)field.front().data.ptr;
+	g.f = (const T *)field.back().data.ptr;
+	g.fmean = 0;
+	for (int i=0; i<3; i++) {
+		g.dim[i] = field.front().dim(i);
+		g.wrap[i] = g.dim[i]-1;
+		g.stride[i] = field.stride(i)/sizeof(T);
+		// squared spacing relative to the finest grid:
+		T h = T(mDim[i]/g.dim[i]);
+		g.h2[i] = h*h;
+	}
+	return g;
+}
+
+template<typename T>
+template<class Func>
+inline double Multigrid3D<T> :: reduce(const Grid& g, const Func& func) {
+	// sum per plane, then in order, so the result is the same for any
+	// number of threads:
+	Field3D<T>::slabs(g.dim[2], mThreads, [&](size_t z0, size_t z1) {
+		for (size_t z=z0; z<z1; z++) {
+			double sum = 0;
+			for (size_t y=0; y<g.dim[1]; y++) {
+				for (size_t x=0; x<g.dim[0]; x++) sum += func(x, y, z);
+			}
+			mSums[z] = sum;
+		}
+	});
+	double sum = 0;
+	for (size_t z=0; z<g.dim[2]; z++) sum += mSums[z];
+	return sum;
+}
+
+template<typename T>
+inline T Multigrid3D<T> :: residual(const Grid& g, const T * w, size_t x, size_t y, size_t z) const {
+	const size_t * s = g.stride;
+	const T * u = g.u + y*s[1] + z*s[2];
+	const T * uy0 = g.u + ((y-1)&g.wrap[1])*s[1] + z*s[2];
+	const T * uy1 = g.u + ((y+1)&g.wrap[1])*s[1] + z*s[2];
+	const T * uz0 = g.u + y*s[1] + ((z-1)&g.wrap[2])*s[2];
+	const T * uz1 = g.u + y*s[1] + ((z+1)&g.wrap[2])*s[2];
+	const size_t i = x*s[0];
+	const size_t x0 = ((x-1)&g.wrap[0])*s[0];
+	const size_t x1 = ((x+1)&g.wrap[0])*s[0];
+	return (g.f[y*s[1] + z*s[2] + i] - g.fmean)
+		- w[3]*u[i]
+		+ w[0]*(u[x0] + u[x1])
+		+ w[1]*(uy0[i] + uy1[i])
+		+ w[2]*(uz0[i] + uz1[i]);
+}
+
+template<typename T>
+inline void Multigrid3D<T> :: weights(const Grid& g, T * w) const {
+	// an axis with a single cell is its own neighbor and drops out:
+	for (int i=0; i<3; i++) w[i] = g.dim[i] > 1 ? T(1)/g.h2[i] : T(0);
+	w[3] = 2*(w[0] + w[1] + w[2]);
+}
+
+template<typename T>
+inline void Multigrid3D<T> :: smooth(Grid& g, int sweeps) {
+	T w[4];
+	weights(g, w);
+	const T inv = T(1)/w[3];
+	for (int n=0; n<sweeps; n++) {
+		for (size_t color=0; color<2; color++) {
+			Field3D<T>::slabs(g.dim[2], mThreads, [&](size_t z0, size_t z1) {
+				for (size_t z=z0; z<z1; z++) {
+					for (size_t y=0; y<g.dim[1]; y++) {
+						T * u = g.u + y*g.stride[1] + z*g.stride[2];
+						for (size_t x=(y+z+color)&1; x<g.dim[0]; x+=2) {
+							// adding the residual over the diagonal solves for the cell:
+							u[x*g.stride[0]] += inv * residual(g, w, x, y, z);
+						}
+					}
+				}
+			});
+		}
+	}
+}
+
+template<typename T>
+inline void Multigrid3D<T> :: removeMean(Grid& g) {
+	const T mean = reduce(g, [&](size_t x, size_t y, size_t z) {
+		return g.u[x*g.stride[0] + y*g.stride[1] + z*g.stride[2]];
+	}) / double(g.dim[0]*g.dim[1]*g.dim[2]);
+	Field3D<T>::slabs(g.dim[2], mThreads, [&](size_t z0, size_t z1) {
+		for (size_t z=z0; z<z1; z++) {
+			for (size_t y=0; y<g.dim[1]; y++) {
+				T * u = g.u + y*g.stride[1] + z*g.stride[2];
+				for (size_t x=0; x<g.dim[0]; x++) u[x*g.stride[0]] -= mean;
+			}
+		}
+	});
+}
+
+template<typename T>
+inline void Multigrid3D<T> :: restrictResidual(Grid& fine, Grid& coarse) {
+	T w[4];
+	weights(fine, w);
+	size_t factor[3];
+	for (int i=0; i<3; i++) factor[i] = fine.dim[i]/coarse.dim[i];
+	const T scale = T(1)/(factor[0]*factor[1]*factor[2]);
+	T * cf = const_cast<T *>(coarse.f);
+	Field3D<T>::slabs(coarse.dim[2], mThreads, [&](size_t z0, size_t z1) {
+		for (size_t z=z0; z<z1; z++) {
+			for (size_t y=0; y<coarse.dim[1]; y++) {
+				for (size_t x=0; x<coarse.dim[0]; x++) {
+					// average the residual of the fine cells covered:
+					T sum = 0;
+					for (size_t k=0; k<factor[2]; k++)
+					for (size_t j=0; j<factor[1]; j++)
+					for (size_t i=0; i<factor[0]; i++) {
+						sum += residual(fine, w, x*factor[0]+i, y*factor[1]+j, z*factor[2]+k);
+					}
+					const size_t c = x*coarse.stride[0] + y*coarse.stride[1] + z*coarse.stride[2];
+					cf[c] = sum * scale;
+					coarse.u[c] = 0;
+				}
+			}
+		}
+	});
+}
+
+template<typename T>
+inline void Multigrid3D<T> :: prolongate(Grid& coarse, Grid& fine) {
+	// trilinear interpolation between cell centers; a fine cell lies a
+	// quarter of a coarse cell from the center of its coarse cell, towards
+	// the neighbor on its side:
+	Field3D<T>::slabs(fine.dim[2], mThreads, [&](size_t z0, size_t z1) {
+		size_t c[3][2];
+		T wc[3][2];
+		size_t xyz[3];
+		for (xyz[2]=z0; xyz[2]<z1; xyz[2]++) {
+			for (xyz[1]=0; xyz[1]<fine.dim[1]; xyz[1]++) {
+				for (xyz[0]=0; xyz[0]<fine.dim[0]; xyz[0]++) {
+					for (int i=0; i<3; i++) {
+						if (fine.dim[i] == coarse.dim[i]) {
+							c[i][0] = c[i][1] = xyz[i];
+							wc[i][0] = 1; wc[i][1] = 0;
+						} else {
+							c[i][0] = xyz[i]>>1;
+							c[i][1] = ((xyz[i]&1) ? c[i][0]+1 : c[i][0]-1) & coarse.wrap[i];
+							wc[i][0] = 0.75; wc[i][1] = 0.25;
+						}
+					}
+					T sum = 0;
+					for (int k=0; k<2; k++)
+					for (int j=0; j<2; j++)
+					for (int i=0; i<2; i++) {
+						sum += wc[0][i]*wc[1][j]*wc[2][k] * coarse.u[
+							c[0][i]*coarse.stride[0] +
+							c[1][j]*coarse.stride[1] +
+							c[2][k]*coarse.stride[2]
+						];
+					}
+					fine.u[xyz[0]*fine.stride[0] + xyz[1]*fine.stride[1] + xyz[2]*fine.stride[2]] += sum;
+				}
+			}
+		}
+	});
+}
+
+template<typename T>
+inline void Multigrid3D<T> :: vcycle(int level, Grid& g) {
+	if (level+1 == levels()) {
+		// at most 2x2x2 cells; smoothing is enough
+		smooth(g, 16);
+		removeMean(g);
+		return;
+	}
+	smooth(g, mPre);
+	Grid coarse = grid(level+1);
+	restrictResidual(g, coarse);
+	vcycle(level+1, coarse);
+	prolongate(coarse, g);
+	smooth(g, mPost);
+}
+
+template<typename T>
+inline int Multigrid3D<T> :: solve(Grid& g, double& f2, double& r2) {
+	// only the mean-free part of f has a periodic solution:
+	const double count = double(g.dim[0]*g.dim[1]*g.dim[2]);
+	g.fmean = 0;
+	g.fmean = reduce(g, [&](size_t x, size_t y, size_t z) {
+		return g.f[x*g.stride[0] + y*g.stride[1] + z*g.stride[2]];
+	}) / count;
+	const double gf2 = reduce(g, [&](size_t x, size_t y, size_t z) {
+		double v = g.f[x*g.stride[0] + y*g.stride[1] + z*g.stride[2]] - g.fmean;
+		return v*v;
+	});
+
+	T w[4];
+	weights(g, w);
+	auto residualSquared = [&]() {
+		return reduce(g, [&](size_t x, size_t y, size_t z) {
+			double r = residual(g, w, x, y, z);
+			return r*r;
+		});
+	};
+
+	int cycles = 0;
+	if (mTolerance > 0) {
+		const double stop = mTolerance*mTolerance*gf2;
+		while (cycles < mMaxCycles && residualSquared() > stop) {
+			vcycle(0, g);
+			cycles++;
+		}
+	} else {
+		for (; cycles < mMaxCycles; cycles++) vcycle(0, g);
+	}
+	removeMean(g);
+	f2 += gf2;
+	r2 += residualSquared();
+	return cycles;
+}
+
+template<typename T>
+inline int Multigrid3D<T> :: solve(Array& p, const Array& f) {
+	for (int i=0; i<2; i++) {
+		const Array& a = i ? f : p;
+		if (a.header.type != Array::type<T>() ||
+			a.header.components != 1 ||
+			a.header.dimcount != 3 ||
+			a.dim(0) != mDim[0] || a.dim(1) != mDim[1] || a.dim(2) != mDim[2])
+		{
+			printf("Multigrid3D::solve() Array format mismatch\n");
+			return 0;
+		}
+	}
+	if (f.stride(1) != p.stride(1) || f.stride(2) != p.stride(2)) {
+		printf("Multigrid3D::solve() Array format mismatch\n");
+		return 0;
+	}
+
+	size_t stride[3];
+	for (int i=0; i<3; i++) stride[i] = p.stride(i)/sizeof(T);
+
+	// each interleaved grid starts at a cell of the first mStep cells:
+	double f2 = 0, r2 = 0;
+	mCycles = 0;
+	size_t o[3];
+	for (o[2]=0; o[2]<mStep[2]; o[2]++)
+	for (o[1]=0; o[1]<mStep[1]; o[1]++)
+	for (o[0]=0; o[0]<mStep[0]; o[0]++) {
+		const size_t offset = o[0]*stride[0] + o[1]*stride[1] + o[2]*stride[2];
+		Grid g;
+		g.u = (T *)p.data.ptr + offset;
+		g.f = (const T *)f.data.ptr + offset;
+		for (int i=0; i<3; i++) {
+			g.dim[i] = mDim[i]/mStep[i];
+			g.wrap[i] = g.dim[i]-1;
+			g.stride[i] = stride[i]*mStep[i];
+			g.h2[i] = T(mStep[i]*mStep[i]);
+		}
+		mCycles = al::max(mCycles, solve(g, f2, r2));
+	}
+	mResidual = f2 > 0 ? sqrt(r2/f2) : 0;
+	return mCycles;
+}
+
 }; // al
 #endif